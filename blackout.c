@@ -2,6 +2,9 @@
 #define _GNU_SOURCE
 // Headers
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stdarg.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,6 +13,22 @@
 #include <semaphore.h>
 #include <signal.h>
 #include <sched.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include "telemetry.h"
 
 // Colors definition
 const char *c_red = "\033[31m";
@@ -35,522 +54,8108 @@ const float DILUVIO_INCREMENT = 4.0;  // Incremento para Diluvio
 const int NO_RAIN_DURATION = 0;
 const int AGUACERO_DURATION = 10; // Duración de Aguacero
 const int DILUVIO_DURATION = 5;   // Duración de Diluvio
+const int RECOVERY_SHOTS = 4;     // Recovery attempts of a region before the fleet is shut down
 volatile sig_atomic_t shutdownRequested = 0;
 
-// HydroelectricPlantNode structure
+// Plants advanced per batch by an engine worker; a multiple of the SIMD width
+#define PLANT_BATCH_SIZE 256
+// Event scheduling: idle plants wait on a hierarchical timer wheel of TIMER_WHEEL_LEVELS levels of
+// 2^TIMER_WHEEL_BITS slots, and the weather stream of an idle plant is scanned at most WEATHER_SCAN_TICKS ahead
+#define TIMER_WHEEL_BITS 8
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 3
+#define WEATHER_SCAN_TICKS (1 << 16) // Below TIMER_WHEEL_SLOTS^TIMER_WHEEL_LEVELS, the reach of the wheel
+// Idle plants a run of busy plants may span: advancing them before their rain is a no-op, and cheaper than a new run
+#define EVENT_RUN_GAP 2
+// Children per node of the plant priority heap
+#define PLANT_HEAP_ARITY 4
+// Maximum number of distinct plant classes in a fleet; class ids are stored in one byte
+#define MAX_PLANT_CLASSES 256
+// Bytes reserved per plant class name and per derived plant name, terminator included
+#define PLANT_CLASS_NAME_SIZE 32
+#define PLANT_NAME_SIZE 48
+// Columns of the plant store carved out of its arena
+#define PLANT_STORE_COLUMNS 11
+// Maximum number of grid regions; region ids are stored in one byte
+#define MAX_REGIONS 64
+// Checkpoint sections and weather trace rows start at page boundaries so they can be mapped in place
+#define CHECKPOINT_ALIGNMENT 4096
+#define CHECKPOINT_VERSION 4
+// Counters saved in a checkpoint: every counter of the shutdown report and stats dumps but those of the log and telemetry files
+#define CHECKPOINT_COUNTERS 19
+// Weather traces: rows start at a page boundary, and about this many bytes of rows are kept resident ahead of the tick
+#define WEATHER_TRACE_VERSION 1
+#define WEATHER_PREFETCH_BYTES (64 << 20)
+// Memory policy of the mbind system call (linux/mempolicy.h), called directly so the build needs no libnuma
+#define MEMORY_POLICY_PREFERRED 1
+#define MEMORY_POLICY_MOVE 2 // MPOL_MF_MOVE: migrate the pages already allocated
+// Physical cores a machine needs before two of them are set aside for dispatch and sorting by default
+#define RESERVED_CORES_MIN_CORES 4
+// Smallest slice of a fleet file worth its own parsing thread
+#define FLEET_CHUNK_MIN_BYTES 65536
+// Slots of the per-chunk class lookup table of the fleet loader; a power of two above 2 * MAX_PLANT_CLASSES
+#define FLEET_CLASS_SLOTS 512
+// Buffers per snapshot ring: one being written, one published and one pinned by each concurrent reader
+#define SNAPSHOT_BUFFERS 4
+// An activation undone by a deactivation within this many ticks counts as churn
+#define CHURN_WINDOW_TICKS 10
+// Tick recorded for something that did not happen
+#define NO_TICK ULONG_MAX
+// Standard normal quantile of the 95% confidence intervals reported by an ensemble
+#define ENSEMBLE_CONFIDENCE_Z 1.959964
+// Replicas a sweep point runs per round before the dominated points are pruned, and in all by default
+#define SWEEP_BATCH_REPLICAS 32
+#define SWEEP_DEFAULT_REPLICAS 256
+// Weather probability triples a sweep runs every fleet mix under, the positional one included
+#define MAX_SWEEP_WEATHERS 16
+// Staging buffers of the telemetry writer: one filled by the engine while the other is encoded
+#define TELEMETRY_BUFFERS 2
+// Control socket: plants the status snapshot keeps for the top-N query, bytes reserved for each of them as JSON,
+// and how often the status thread rebuilds it
+#define STATUS_TOP_PLANTS 1024
+#define STATUS_PLANT_JSON_SIZE 192
+#define STATUS_REFRESH_MS 100
+// Control socket: clients served at once, longest command line, runtime changes waiting for the next tick
+// boundary (a power of two) and the largest reply, a top-N listing
+#define CONTROL_MAX_CLIENTS 16
+#define CONTROL_LINE_SIZE 256
+#define CONTROL_CHANGES 16
+#define CONTROL_REPLY_SIZE (STATUS_PLANT_JSON_SIZE * (STATUS_TOP_PLANTS + 1))
+// Capacity units per MW used by the exact dispatch solver
+#define DISPATCH_UNITS_PER_MW 10
+// Ready standby plants kept for incremental dispatch
+#define STANDBY_POOL_SIZE 64
+// Alignment of the plant store columns, one cache line
+#define COLUMN_ALIGNMENT 64
+// Records per thread log ring; a power of two
+#define LOG_RING_SIZE 16384
+// Latency histograms keep 2^HISTOGRAM_SUB_BITS sub-buckets per power of two (about 3% precision) up to 2^64 ns
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 2) << (HISTOGRAM_SUB_BITS - 1))
+
+// Rain event types and their short codes
+enum
+{
+    RAIN_NONE,
+    RAIN_AGUACERO,
+    RAIN_DILUVIO
+};
+const char *rainTypeCodes[] = {"NL", "AG", "DI"};
+
+// What the series of a weather trace stand for
+enum
+{
+    WEATHER_SERIES_PLANT, // One series per plant, in plant id order
+    WEATHER_SERIES_CLASS, // One series per plant class (basin), in plantClasses order
+    WEATHER_SERIES_REGION // One series per grid region, in region order
+};
+const char *weatherSeriesNames[] = {"plant", "class", "region"};
+
+// Thread placement policies selectable with --placement
+enum
+{
+    PLACEMENT_SPREAD,  // Workers shared out across the NUMA nodes, each node owning a contiguous shard of the fleet
+    PLACEMENT_COMPACT, // Workers fill the cores of one node before moving on to the next
+    PLACEMENT_NONE     // No pinning, the scheduler places every thread
+};
+const char *placementNames[] = {"spread", "compact", "none"};
+
+// Threads placed by the placement policy
+enum
+{
+    ROLE_WORKER,
+    ROLE_DISPATCH, // The main thread, also driving the virtual clock
+    ROLE_SORTING,
+    ROLE_SERVICE // Clock, log writer, weather prefetch, status and control threads, and the dispatchers of the other regions
+};
+
+// Simulation clocks selectable with --clock
+enum
+{
+    CLOCK_WALL,   // One tick per second of wall-clock time
+    CLOCK_VIRTUAL // Ticks run back to back, one tick per simulated second
+};
+
+// Plant scheduling selectable with --schedule
+enum
+{
+    SCHEDULE_TICK, // Every plant is advanced on every tick
+    SCHEDULE_EVENT // Idle plants are skipped until the tick their weather stream next draws rain
+};
+const char *scheduleNames[] = {"tick", "event"};
+
+// Recovery budget refill rules selectable with --recovery-refill
+enum
+{
+    REFILL_NEVER,   // Every region has its recovery attempts for the whole run
+    REFILL_SUCCESS, // A successful recovery restores the full budget
+    REFILL_TICKS    // One attempt comes back per recoveryRefillTicks consecutive ticks at or above the minimum
+};
+
+// State of a telemetry staging buffer
+enum
+{
+    TELEMETRY_FREE,    // Available to the engine
+    TELEMETRY_FILLING, // Filled by the engine, one row per tick
+    TELEMETRY_FULL     // Handed to the writer thread
+};
+
+// Runtime changes received on the control socket, applied by the engine at the next tick boundary
+enum
+{
+    CONTROL_SET_WEATHER, // values: probA, probB and probC
+    CONTROL_SET_BAND     // region, values: minimum and maximum generation
+};
+
+// Outcome of an ensemble replica
+enum
+{
+    REPLICA_PENDING, // Not run yet, or still running
+    REPLICA_DONE,    // Ran to the horizon or to a fleet shutdown and reported
+    REPLICA_FAILED   // Exited without reporting
+};
+
+// Dispatch algorithms selectable with --dispatch
+enum
+{
+    DISPATCH_GREEDY,
+    DISPATCH_EXACT
+};
+
+// Per-plant outcome of the water-level kernel for one tick
+enum
+{
+    PLANT_EVENT_DRAW_WEATHER = 1, // The rain event ended, a new one must be drawn
+    PLANT_EVENT_GENERATED = 2,    // The plant generated energy this tick
+    PLANT_EVENT_OUT_OF_BOUNDS = 4 // The plant must be deactivated
+};
+
+// Log levels selectable with --log-level, from most to least severe
+enum
+{
+    LOG_ERROR,
+    LOG_WARN,
+    LOG_INFO,
+    LOG_DEBUG // Per-plant tick lines
+};
+const char *logLevelNames[] = {"error", "warn", "info", "debug"};
+
+// Log output formats selectable with --log-format
+enum
+{
+    LOG_FORMAT_TEXT,  // Lines formatted by the writer thread
+    LOG_FORMAT_BINARY // LogFileHeader followed by the raw LogRecords
+};
+
+// Events recorded by the logging subsystem, with the meaning of their record fields
+enum
+{
+    LOG_EVENT_PLANT_GENERATED,     // plant, count: rain type, value: water level and water flow
+    LOG_EVENT_PLANT_DEACTIVATED,   // plant
+    LOG_EVENT_PLANT_ACTIVATED,     // plant
+    LOG_EVENT_STANDBY_ACTIVATED,   // plant
+    LOG_EVENT_ADJUSTMENT_REQUIRED, // count: deactivations, value: generation and lost capacity
+    LOG_EVENT_ADJUSTED,            // value: generation
+    LOG_EVENT_GREEDY_PASS,
+    LOG_EVENT_EXACT_PASS,
+    LOG_EVENT_RECOVERY_ATTEMPT, // count: attempts left
+    LOG_EVENT_FLEET_SHUTDOWN,
+    LOG_EVENT_PLANT_FINAL_STATE, // plant, count: active, value: water level
+    LOG_EVENT_TRANSFER,          // count: lender * MAX_REGIONS + borrower, value: loan and borrower generation
+    LOG_EVENT_RECOVERED,         // count: attempts left, value: generation
+    LOG_EVENT_WEATHER_CHANGED,   // value: probA and probB
+    LOG_EVENT_BAND_CHANGED       // count: region, value: minimum and maximum generation
+};
+const unsigned char logEventLevels[] = {LOG_DEBUG, LOG_INFO, LOG_INFO, LOG_INFO, LOG_WARN, LOG_INFO,
+                                        LOG_INFO, LOG_INFO, LOG_WARN, LOG_ERROR, LOG_ERROR, LOG_INFO, LOG_WARN,
+                                        LOG_WARN, LOG_WARN};
+
+// Latency histograms kept by the instrumentation
+enum
+{
+    LATENCY_REDISPATCH,     // Deactivation published -> generation back above the minimum
+    LATENCY_SORT,           // One refresh of the plant order
+    LATENCY_DISPATCH,       // One pass of the selected dispatch algorithm
+    LATENCY_LOCK_WAIT,      // Acquiring dirtyMutex, standbyMutex or dispatchMutex, 0 when uncontended
+    LATENCY_SORTING_WAIT,   // Order refresh requested -> sorting thread running it
+    LATENCY_RECOVERY_WAIT,  // Recovery attempt scheduled -> dispatch pass running it
+    LATENCY_QUERY,          // Control command received -> reply sent
+    LATENCY_HISTOGRAMS
+};
+const char *latencyNames[] = {"redispatch", "sort", "dispatch", "lockWait", "sortingWait", "recoveryWait", "query"};
+
+// Plant class (e.g. H1, H2, H3): plants sharing a capacity and water-level limits
 typedef struct
 {
-    char *name;
+    char name[PLANT_CLASS_NAME_SIZE];
     float capacity;
     float minWaterLevel;
     float maxWaterLevel;
-    float waterLevel;
-    int isActive;
+} PlantClass;
+
+// Columnar plant store: one contiguous, cache-line aligned array per attribute, indexed by plant id.
+// All columns are carved out of a single arena; plant names are derived from class and ordinal.
+typedef struct
+{
+    int count;
+    int reserved;
+    void *arena;                 // Backing memory of every column
+    size_t arenaSize;
+    void *mapping;               // Checkpoint file the arena lives in after a restore, NULL if allocated
+    size_t mappingSize;
+    int *ordinal;                // Index of the plant within its class, used to derive its name
+    float *capacity;
+    float *minWaterLevel;
+    float *maxWaterLevel;
+    float *waterLevel;           // Written only by the worker that owns the plant
+    atomic_int *isActive;        // Switched with compare-and-swap by dispatch (on) and workers (off)
+    float *rainIncrement;        // Water added per tick by the current rain event
+    int *rainDuration;           // Remaining ticks of the current rain event
+    unsigned char *rainType;     // Current rain event, index into rainTypeCodes
+    unsigned char *classId;      // Index into plantClasses
+    unsigned char *regionId;     // Index into regions; the plants of a region have consecutive ids
+} PlantStore;
+
+// Contiguous range of the fleet advanced by one engine worker
+typedef struct
+{
+    int first;
+    int last;
+    int *deactivated;     // Plants of the slice deactivated during the current tick
+    int deactivatedCount;
+    int cpu;              // CPU the worker is pinned to, -1 if unpinned
+    int node;             // NUMA node its slice of the fleet is placed on
     pthread_t thread;
-} HydroelectricPlant;
+    // Event scheduling
+    unsigned long long *busy;                          // One bit per plant of the slice advanced on every tick
+    int wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS]; // Heads of the lists of idle plants by wake-up tick, -1 if empty
+    int *woken;                                        // Plants switched on by dispatch since the last tick, each once
+    atomic_int wokenCount;
+    pthread_mutex_t wakeMutex;
+} EngineWorker;
+
+// One CPU the process may run on, as described by sysfs
+typedef struct
+{
+    int cpu;
+    int package;   // Socket
+    int core;      // Physical core within the socket
+    int node;      // NUMA node
+    bool sibling;  // Another hardware thread of a core listed before it
+    bool reserved; // Set aside for dispatch and sorting
+} CpuInfo;
+
+// Indexed d-ary max-heap of plant ids, ordered by comparePlants on each plant's cached key
+typedef struct
+{
+    int size;
+    int *slots;        // Heap position -> plant id
+    int *position;     // Plant id -> heap position
+    float *key;        // Plant id -> relative water level the plant is currently ordered by
+} PlantHeap;
+
+// Best-first walk over a PlantHeap that visits plants in priority order without popping them
+typedef struct
+{
+    const PlantHeap *heap;
+    int size;
+    int capacity;
+    int *frontier; // Binary max-heap of heap positions whose plants have not been visited yet
+} PlantWalk;
+
+// Ring of immutable snapshots published RCU-style. Readers pin the published buffer with a reader
+// count and never block the writer, which only refills buffers that are neither published nor pinned.
+typedef struct
+{
+    void *buffers[SNAPSHOT_BUFFERS];
+    unsigned long epoch[SNAPSHOT_BUFFERS]; // Tick the buffer was taken at
+    atomic_int readers[SNAPSHOT_BUFFERS];
+    atomic_int published; // Index of the published buffer
+} SnapshotRing;
+
+// Fleet state at the end of a tick, as seen by dispatch and sorting
+typedef struct
+{
+    float *waterLevel;
+    int *isActive;
+    float *rainIncrement; // The ongoing rain events, only kept for lookahead dispatch, NULL otherwise
+    int *rainDuration;
+} FleetSnapshot;
+
+// Consistent view used by a dispatch pass: the fleet at the end of a tick and the region's part of the latest plant order
+typedef struct
+{
+    int fleetBuffer;
+    int orderBuffer;
+    const FleetSnapshot *fleet;
+    const float *waterLevel;
+    PlantHeap order;
+    int classOrderBuffer;           // With exact dispatch only, -1 otherwise
+    const PlantHeap *classOrder;
+} DispatchView;
+
+// Grid region: a contiguous range of plant ids with its own demand band and its own dispatcher, which
+// only ever activates plants of the region. Holds the dispatch state of the region.
+typedef struct
+{
+    int first;                       // First plant id of the region
+    int last;                        // One past its last plant id
+    float minGeneration;             // Demand band
+    float maxGeneration;
+    atomic_llong generatedKilowatts; // Generation of its active plants, in kW
+    atomic_llong importedKilowatts;  // Borrowed from other regions
+    atomic_llong exportedKilowatts;  // Lent to other regions
+    atomic_int lastShots;            // Recovery attempts left
+    atomic_bool waitingForRecover;   // Recovering: generation is paused until a dispatch pass reaches the minimum
+    atomic_ulong retryTick;          // Tick from which the next recovery attempt is due
+    atomic_bool bandChanged;         // The band was changed on the control socket since the last dispatch pass
+    int classFirst[MAX_PLANT_CLASSES + 1]; // With exact dispatch, first slot of each class in the class order
+    unsigned long long retryScheduledAt; // When that attempt was scheduled, for the recovery wait latency
+    unsigned long inBandTicks;       // Consecutive ticks ended at or above the minimum, for the refill rule
+    unsigned long blackoutTicks;     // Ticks left below the minimum generation by their dispatch passes (blackout-seconds)
+    unsigned long recoveringTicks;   // Of those, ticks spent recovering
+    sem_t adjustmentSemaphore;       // Posted once per coalescing window with deactivations in the region
+    pthread_t dispatchThread;
+    pthread_mutex_t dispatchMutex;   // Held through every adjustment, and by a checkpoint to hold the dispatcher off
+
+    // Adjustment requests: deactivations are merged into one dirty set and flushed to the dispatcher once per window
+    pthread_mutex_t dirtyMutex;
+    int *dirtyPlants;                    // Plants deactivated since the last dispatch pass
+    unsigned long long *dirtyTimes;      // When each of them was published, for the redispatch latency
+    unsigned long long *adjustmentTimes; // Copy of dirtyTimes taken by the adjustment being handled
+    int dirtyCount;
+    bool adjustmentPending;              // The dispatcher was posted and has not drained the dirty set yet
+
+    // Exact dispatch: room for the plants collected per class by a pass, each class at its slots of the class order
+    int *exactCandidates; // Eligible plants, those that sustain the horizon first
+    int *exactSpares;     // With lookahead, eligible plants that cannot sustain the horizon
+    int *exactEligible;   // The first eligible plants, for the greedy outcome
+
+    // Incremental dispatch: deficits are first covered from a pool of ready standby plants, best first
+    pthread_mutex_t standbyMutex;
+    int standbyPool[STANDBY_POOL_SIZE];
+    int standbyCount; // Plants in the pool
+    int standbyNext;  // Next plant of the pool to try
+} Region;
+
+// One logged event. Fixed size and free of pointers, so it is also the record of the binary log format.
+typedef struct
+{
+    unsigned long long time; // CLOCK_MONOTONIC nanoseconds
+    unsigned long long tick;
+    int plant;
+    int count;
+    float value[2];
+    unsigned char event;
+    unsigned char level;
+    unsigned char reserved[6];
+} LogRecord;
+
+// Header of a binary log file
+typedef struct
+{
+    char magic[8]; // "BLACKLOG"
+    unsigned int version;
+    unsigned int recordSize;
+} LogFileHeader;
+
+// Single-producer single-consumer ring of log records owned by one thread and drained by the writer thread
+typedef struct LogRing
+{
+    _Alignas(COLUMN_ALIGNMENT) atomic_ulong tail; // Next record to write, advanced by the owning thread
+    _Alignas(COLUMN_ALIGNMENT) atomic_ulong head; // Next record to drain, advanced by the writer thread
+    unsigned long limit;                          // Tail seen by the writer at the start of the current pass
+    atomic_ulong dropped;                         // Records lost because the ring was full
+    struct LogRing *next;
+    LogRecord records[LOG_RING_SIZE];
+} LogRing;
+
+// HDR-style histogram of nanosecond latencies: log-linear buckets, updated with relaxed atomics from any thread
+typedef struct
+{
+    atomic_ulong counts[HISTOGRAM_BUCKETS];
+    atomic_ulong total;
+    atomic_ullong sum;
+} LatencyHistogram;
+
+// Header of a checkpoint file. The sections follow at the given offsets: the plant classes, the regions,
+// the plants waiting for an adjustment, region by region, the generation lent between regions, the plant
+// store arena and the keys of the plant order.
+typedef struct
+{
+    char magic[8]; // "BLACKCKP"
+    unsigned int version;
+    unsigned int headerSize;
+    unsigned long long tick;
+    unsigned long long seed; // With the tick, the position of every weather random stream
+    int plantCount;
+    int numPlantClasses;
+    int numRegions;
+    int coalesceTicks;
+    unsigned long long arenaSize;
+    unsigned long long classesOffset;
+    unsigned long long regionsOffset;
+    unsigned long long dirtyOffset;
+    unsigned long long transfersOffset;
+    unsigned long long arenaOffset;
+    unsigned long long keysOffset;
+    unsigned long long counters[CHECKPOINT_COUNTERS]; // Dispatch and instrumentation counters, in the order writeCheckpoint lists them
+} CheckpointHeader;
+
+// Dispatch state of one region in a checkpoint
+typedef struct
+{
+    float minGeneration;
+    float maxGeneration;
+    int lastShots;
+    int waitingForRecover;
+    int dirtyCount;
+    int standbyCount;
+    int standbyNext;
+    int standbyPool[STANDBY_POOL_SIZE];
+    unsigned long long retryTick;
+    unsigned long long inBandTicks;
+    unsigned long long blackoutTicks;
+    unsigned long long recoveringTicks;
+} CheckpointRegion;
+
+// Header of a weather trace file: rows of `series` float rain increments, one row per tick from firstTick + 1,
+// starting at rowsOffset
+typedef struct
+{
+    char magic[8]; // "BLACKWTR"
+    unsigned int version;
+    unsigned int headerSize;
+    unsigned long long firstTick; // Tick before the first row
+    unsigned long long ticks;     // Rows in the trace
+    int series;                   // Increments per row
+    int layout;                   // WEATHER_SERIES_PLANT, WEATHER_SERIES_CLASS or WEATHER_SERIES_REGION
+    unsigned long long rowsOffset;
+} WeatherTraceHeader;
+
+// One data row of a fleet file
+typedef struct
+{
+    const char *className;
+    int classNameLength;
+    float capacity;
+    float minWaterLevel;
+    float maxWaterLevel;
+    float waterLevel; // NAN if the row leaves it to the middle of the band
+    long count;       // Plants the row stands for
+    int region;       // Index into regions
+} FleetRow;
+
+// Slice of a fleet file parsed by one loader thread, starting at a line start
+typedef struct
+{
+    const char *begin;
+    const char *end;
+    int lines;                                  // Lines in the slice
+    long plantCount;                            // Plants defined by the slice
+    int classCount;                             // Classes seen by the slice, in order of first appearance
+    FleetRow classes[MAX_PLANT_CLASSES];        // First row of each of them
+    long classPlants[MAX_PLANT_CLASSES];        // Plants of each of them in the slice
+    short slots[FLEET_CLASS_SLOTS];             // Hash of the class name -> local class + 1, 0 if free
+    int globalClass[MAX_PLANT_CLASSES];         // Local class -> plantClasses index, set after the scan
+    long firstOrdinal[MAX_PLANT_CLASSES];       // Local class -> ordinal within its class of the first plant of the slice
+    long firstPlant;                            // Id of the first plant of the slice
+    int errorLine;                              // Line of the first error in the slice, -1 if none
+    const char *error;
+} FleetChunk;
+
+// Staging buffer of the telemetry writer: the fleet state of up to TELEMETRY_CHUNK_TICKS consecutive ticks
+typedef struct
+{
+    atomic_int state;        // TELEMETRY_FREE, TELEMETRY_FILLING or TELEMETRY_FULL
+    unsigned long long firstTick;
+    int ticks;
+    float *waterLevel;       // One row of plants.count levels per tick
+    unsigned char *states;   // isActive | rainType << 1, one row per tick
+    long long generatedKilowatts[TELEMETRY_CHUNK_TICKS];
+} TelemetryBuffer;
+
+// Bit-packed run being written, least significant bits first
+typedef struct
+{
+    unsigned char *data;
+    size_t bytes;
+    unsigned long long pending; // Bits not yet stored
+    int pendingBits;
+} BitWriter;
+
+// Summary of one ensemble replica, written by the replica process into the memory it shares with the ensemble
+typedef struct
+{
+    atomic_int state;                // REPLICA_PENDING, then REPLICA_DONE or REPLICA_FAILED
+    int plantCount;
+    unsigned long ticks;             // Ticks run, up to the fleet shutdown if there was one
+    unsigned long shutdownTick;      // Tick the fleet was shut down at, NO_TICK if it never was
+    unsigned long firstRecoveryTick; // Tick of the first recovery attempt, NO_TICK if there was none
+    double meanGeneration;           // MW/s averaged over the horizon, the ticks after a shutdown counting as 0
+} ReplicaResult;
+
+// Memory shared by the processes of an ensemble: the next replica to hand out and the summaries of all of them
+typedef struct
+{
+    atomic_int nextReplica;
+    ReplicaResult replicas[];
+} EnsembleRun;
+
+// Point of a fleet-composition sweep: one mix of H1, H2 and H3 plants under one weather, and what its replicas found
+typedef struct
+{
+    int numH1;
+    int numH2;
+    int numH3;
+    int weather;          // Index into sweepWeathers
+    bool feasible;        // Every region has plants and the capacity to reach its minimum
+    bool pruned;          // Dominated by a point with no more plants and a lower blackout probability
+    int replicas;         // Replicas run so far
+    int blackouts;        // Replicas whose fleet was shut down within the horizon
+    double generationSum; // Mean generations of the replicas, summed
+    double blackoutLow;   // 95% Wilson interval of the blackout probability
+    double blackoutHigh;
+} SweepPoint;
+
+// Replica of a sweep round: the point it runs and its index among the replicas of that point, which gives its seed
+typedef struct
+{
+    int point;
+    int replica;
+} SweepTask;
+
+// Runtime change received on the control socket, queued for the engine
+typedef struct
+{
+    int kind;  // CONTROL_SET_WEATHER or CONTROL_SET_BAND
+    int region;
+    float values[3];
+} ControlChange;
+
+// Recovery state and generation of a region in a status snapshot
+typedef struct
+{
+    float generation;
+    int shotsLeft;
+    bool recovering;
+    unsigned long retryTick;
+} RegionStatus;
 
-typedef struct HydroelectricPlantNode
+// What the control socket answers queries from: rebuilt by the status thread from the published fleet snapshot
+// and published in its own ring, so a query only pins it and formats the reply
+typedef struct
+{
+    unsigned long tick;         // Of the fleet snapshot the plant figures were taken from
+    unsigned long long builtAt; // CLOCK_MONOTONIC nanoseconds, when the generation and recovery figures were read
+    float generation;
+    unsigned long recoveryAttempts;
+    unsigned long recoveries;
+    int topCount;
+    int topPlants[STATUS_TOP_PLANTS];   // Highest relative water level first, ties by plant id
+    float topLevels[STATUS_TOP_PLANTS]; // Relative water level of each of them
+    int topJsonEnd[STATUS_TOP_PLANTS];  // End of each of them in topJson
+    char topJson[STATUS_TOP_PLANTS * STATUS_PLANT_JSON_SIZE]; // The top plants as comma-separated JSON objects
+    int classPlants[MAX_PLANT_CLASSES];
+    int classActive[MAX_PLANT_CLASSES];      // Active plants of each class
+    RegionStatus regions[MAX_REGIONS];
+} StatusSnapshot;
+
+// Connection to the control socket, with the part of a command line received so far
+typedef struct
 {
-    HydroelectricPlant *plant;
-    struct HydroelectricPlantNode *next;
-} HydroelectricPlantNode;
+    int fd;
+    int length;
+    char line[CONTROL_LINE_SIZE];
+} ControlClient;
 
 // Gobal variables
-HydroelectricPlantNode *head = NULL;
-pthread_mutex_t listMutex, energyMutex;
-sem_t adjustmentSemaphore, sortingSemaphore;
+PlantStore plants = {0};
+PlantClass plantClasses[MAX_PLANT_CLASSES];
+int numPlantClasses = 0;
+PlantHeap plantOrder = {0}; // Working heap, only touched by the thread refreshing the order
+PlantHeap classOrder = {0}; // With exact dispatch, working heap of every class of every region, touched likewise
+sem_t sortingSemaphore;
 float probA, probB, probC;
-float totalEnergyGenerated = 0.0;
-int lastShots = 4;
-bool waitingForRecover = false;
+atomic_llong generatedKilowatts = 0; // Lock-free generation total of the fleet, in kW so that it adds up exactly
+
+// Regions: the fleet is split into contiguous regions, each with its own demand band and dispatcher
+Region regions[MAX_REGIONS];
+int numRegions = 1;
+bool regionBandsGiven = false;                      // --regions was given, otherwise one region with the default band
+float transferLimit = 0.0;                          // MW one region may lend to another, 0 disables transfers
+long long transferKilowatts[MAX_REGIONS][MAX_REGIONS]; // [lender][borrower] generation currently lent
+pthread_mutex_t transferMutex;
+atomic_ulong transfers = 0;                         // Loans made to regions short of their minimum
+
+// Snapshots: the engine publishes the fleet after every tick, the sorting thread publishes the plant order
+SnapshotRing fleetSnapshots = {0};
+SnapshotRing orderSnapshots = {0};
+SnapshotRing classOrderSnapshots = {0}; // With exact dispatch, published along with the plant order
+int buildingFleetSnapshot = -1; // Buffer the workers copy their slices into during the current tick
+
+// Dispatch; the counters are shared by the dispatchers of every region
+int dispatchMode = DISPATCH_GREEDY;
+atomic_ulong dispatchPasses = 0;   // Dispatch passes run by the selected algorithm
+atomic_ulong greedyShortfalls = 0; // Passes in which greedy would have started a recovery attempt
+atomic_ulong exactRescues = 0;     // Of those, passes in which the exact solver found a feasible dispatch
+
+// Recovery: a region that cannot reach its minimum pauses generation and retries on later ticks
+int recoveryBudget = RECOVERY_SHOTS; // Attempts per region
+int recoveryInterval = 1;            // Ticks between two attempts
+int recoveryRefill = REFILL_NEVER;
+int recoveryRefillTicks = 0;
+atomic_ulong recoveryAttempts = 0;
+atomic_ulong recoveries = 0; // Recoveries that brought a region back to its minimum
+
+// Lookahead dispatch: candidates must sustain generation over the next lookaheadHorizon ticks
+int lookaheadHorizon = 0;             // 0 only looks at the current water level
+atomic_ulong lookaheadSkips = 0;      // Candidates passed over because they would leave their bounds within the horizon
+atomic_ulong lookaheadFallbacks = 0;  // Passes that had to take such candidates to reach the minimum
+unsigned long *activationTicks = NULL; // Tick each plant was last activated, to tell churn
+atomic_ulong activations = 0;
+atomic_ulong churnPairs = 0;          // Activations undone within CHURN_WINDOW_TICKS
+unsigned long activationsAtStart = 0;      // Counters already counted when the engine started, for the hourly rates
+unsigned long churnPairsAtStart = 0;
+unsigned long adjustmentPassesAtStart = 0;
+
+// Incremental dispatch: deficits are first covered from the standby pool of the region
+bool incrementalDispatch = false;
+atomic_ulong incrementalAdjustments = 0; // Adjustments covered by the standby pool
+atomic_ulong fullAdjustments = 0;        // Adjustments that needed a full dispatch pass
+
+// Simulation engine
+EngineWorker *workers = NULL;
+int numWorkers = 0; // 0 sizes the pool to the online cores
+pthread_t clockThread;
+pthread_barrier_t tickStartBarrier, tickEndBarrier;
+bool inlineWorker = false; // The virtual clock advances the slice of a lone worker itself, without its thread
+volatile bool engineStopping = false;
+unsigned long currentTick = 0;
+int clockMode = CLOCK_WALL;
+unsigned long tickLimit = 0;  // Ticks to simulate, 0 runs until interrupted
+unsigned long long randomSeed = 1; // Seed of the per-plant weather random streams
+atomic_ullong advancedPlantTicks = 0; // Plants advanced, summed over the ticks
+unsigned long engineStartTick = 0;     // Tick the engine started from, past the restored ones
+unsigned long long advancedPlantTicksAtStart = 0; // Plants advanced before the engine started, in the restored ticks
+
+// Ensemble: --ensemble replicas of the simulation, each run by a forked process, --jobs of them at a time
+int ensembleReplicas = 0;     // 0 runs a single simulation
+int ensembleJobs = 0;         // 0 runs one replica per allowed CPU
+EnsembleRun *ensemble = NULL; // Shared mapping, inherited by the runners and the replicas
+size_t ensembleSize = 0;
+cpu_set_t ensembleCpus;       // CPUs the runners may be pinned to
+int ensembleCpuCount = 0;
+int ensembleReplica = -1;     // Replica run by this process, -1 outside of a replica
+double generationSum = 0.0;   // Generation at the end of every tick, summed over the run
+atomic_ulong fleetShutdownTick = NO_TICK;
+atomic_ulong firstRecoveryTick = NO_TICK;
+
+// Sweep: every fleet mix within the --sweep ranges, under every weather, run as an ensemble in rounds
+bool sweepMode = false;
+int sweepRanges[3][3];                       // First, last and step of the H1, H2 and H3 counts
+float sweepWeathers[MAX_SWEEP_WEATHERS][3];  // probA, probB and probC of each weather, the positional one first
+int numSweepWeathers = 1;
+double reliabilityTarget = -1.0;             // Blackout probability a fleet must stay under, negative for none
+SweepPoint *sweepPoints = NULL;
+int numSweepPoints = 0;
+SweepTask *sweepTasks = NULL;                // Replicas of the current round, inherited by the runners
+const SweepPoint *sweepPoint = NULL;         // Point run by this process, NULL outside of a sweep replica
+bool weatherByClassOrdinal = false;          // Key the weather streams by class and ordinal instead of plant id
+
+// Event scheduling: timer wheel links of the idle plants, allocated only with --schedule event
+int scheduleMode = SCHEDULE_TICK;
+unsigned long *wakeTicks = NULL; // Tick the weather stream of an idle plant next draws rain
+int *timerNext = NULL;
+int *timerPrev = NULL;
+int *timerSlot = NULL;           // Level * TIMER_WHEEL_SLOTS + slot of the plant on the wheel, -1 if busy
+
+// Placement: CPU topology read from sysfs, ordered by node, then primary hardware threads before their siblings
+int placementPolicy = PLACEMENT_SPREAD;
+int reservedCores = -1; // Physical cores kept for dispatch and sorting, -1 picks 2 on machines with enough cores
+CpuInfo *cpus = NULL;
+int numCpus = 0;
+int numNodes = 1;
+int dispatchCpu = -1; // CPU of the main thread, -1 if unpinned
+int sortingCpu = -1;  // CPU of the sorting thread, -1 if unpinned
+
+// Adjustment requests: deactivations are merged into the dirty set of their region and flushed once per window
+int coalesceTicks = 1;              // Ticks per coalescing window
+atomic_ulong adjustmentEvents = 0;  // Deactivation events received
+atomic_ulong adjustmentPasses = 0;  // Dispatch passes executed for them
+
+// Fleet file given with --fleet, NULL to build the fleet from the H1, H2 and H3 counts
+const char *fleetPath = NULL;
+
+// Weather trace replayed with --weather instead of the random streams; a prefetch thread keeps the rows of the
+// coming ticks resident so the workers never fault on them
+const char *weatherPath = NULL;
+const WeatherTraceHeader *weatherTrace = NULL; // Mapped trace, NULL draws the weather from the random streams
+size_t weatherTraceSize = 0;
+const float *weatherRows = NULL;
+unsigned long weatherWindowTicks = 0;       // Rows prefetched ahead of the current tick
+atomic_ulong weatherPrefetched = 0;         // Rows resident from the start of the trace on
+unsigned long weatherStalls = 0;            // Ticks whose row was not prefetched in time
+pthread_t weatherPrefetchThread;
+sem_t weatherSemaphore;
+volatile bool weatherStopping = false;
+
+// Weather recorded with --weather-record: the rain increment every plant received, one row per tick
+const char *weatherRecordPath = NULL;
+FILE *weatherRecordFile = NULL;
+float *weatherRecordRow = NULL;
+WeatherTraceHeader weatherRecordHeader;
+
+// Telemetry recorded with --telemetry: the workers copy the state of their slices into a staging buffer
+// every tick, and a writer thread encodes the full buffers into chunks of the columnar file
+const char *telemetryPath = NULL;
+FILE *telemetryFile = NULL;
+TelemetryHeader telemetryHeader;
+TelemetryBuffer telemetryBuffers[TELEMETRY_BUFFERS];
+TelemetryBuffer *telemetryFilling = NULL;  // Buffer of the current tick, NULL while every buffer waits for the writer
+float *telemetryLevelRow = NULL;           // Row of the current tick in the buffer, NULL if the tick is dropped
+unsigned char *telemetryStateRow = NULL;
+TelemetryChunkEntry *telemetryIndex = NULL; // Written chunks, grown by the writer thread
+int telemetryIndexCapacity = 0;
+unsigned char *telemetryChunk = NULL;      // Chunk being encoded by the writer thread
+int *telemetryValues = NULL;               // Integer water levels of the block being encoded
+unsigned long long telemetryBytes = 0;     // Size of the finished file
+pthread_t telemetryWriterThread;
+sem_t telemetrySemaphore;
+atomic_bool telemetryStopping = false;
+unsigned long telemetryStalls = 0;     // Virtual ticks that waited for the writer to free a buffer
+
+// Control socket given with --control: the status thread rebuilds a StatusSnapshot every STATUS_REFRESH_MS and the
+// control thread answers queries from the published one; changes are queued in a single-producer ring the engine
+// drains at the next tick boundary
+const char *controlPath = NULL;
+int controlSocket = -1;
+SnapshotRing statusSnapshots = {0};
+ControlChange controlChanges[CONTROL_CHANGES];
+atomic_uint controlChangeHead = 0;  // Next slot the control thread fills
+atomic_uint controlChangeTail = 0;  // Next slot the engine applies
+float controlWeather[3];            // Probabilities and bands as last accepted, only touched by the control thread
+float controlBands[MAX_REGIONS][2];
+float controlCapacity[MAX_REGIONS]; // Total capacity of every region, the highest minimum a band may ask for
+char *controlReply = NULL;
+pthread_t statusThread;
+pthread_t controlThread;
+atomic_bool controlStopping = false;
+atomic_ulong controlQueries = 0;
+unsigned long controlChangesApplied = 0;
+
+// Checkpoints: written every checkpointEvery ticks, on SIGUSR2 and at shutdown; restored with --restore
+const char *checkpointPath = NULL;
+unsigned long checkpointEvery = 0;
+volatile sig_atomic_t checkpointRequested = 0;
+const char *restorePath = NULL;
+const CheckpointHeader *restoredCheckpoint = NULL; // Header in the mapped checkpoint, NULL for a new fleet
+
+// Instrumentation: dumped as JSON lines on SIGUSR1 and at shutdown
+LatencyHistogram latencies[LATENCY_HISTOGRAMS];
+atomic_ullong orderRequestedAt = 0;     // When the sorting thread was last posted, 0 once it picked it up
+unsigned long ticksBelowMinimum = 0;    // Ticks that left a region below its minimum generation after their dispatch passes
+unsigned long sampledTick = 0;          // Last tick whose outcome was sampled, once its dispatch passes had run
+volatile sig_atomic_t statsDumpRequested = 0;
+unsigned long long fleetCreationNanos = 0; // Startup: creating the plants of the store
+unsigned long long orderBuildNanos = 0;    // Startup: building the plant priority heap
+unsigned long long engineStartedAt = 0;    // When the engine started ticking, for the tick throughput
+const char *statsPath = NULL; // NULL writes the dumps to stderr
+FILE *statsOutput = NULL;
+
+// Logging: every thread records events into its own ring, and one writer thread drains them all
+int logLevel = LOG_DEBUG;
+int logFormat = LOG_FORMAT_TEXT;
+const char *logPath = NULL; // NULL writes to stdout
+FILE *logOutput = NULL;
+_Atomic(LogRing *) logRings = NULL; // Rings of every thread that logged, newest first
+_Thread_local LogRing *threadLogRing = NULL;
+pthread_t logWriterThread;
+atomic_bool logStopping = false;
+unsigned long logWritten = 0; // Records written by the writer thread
+unsigned long logDropped = 0; // Records dropped by full rings, summed when the logger stops
 
 // Functions definition
-void createAndInsertPlants(int numPlants, const char *plantType, float capacity, float minWaterLevel, float maxWaterLevel);
-void *hydroelectricPlantRoutine(void *arg);
+int parseOptions(int argc, char *argv[]);
+void printUsage(const char *program);
+void *allocateColumn(size_t count, size_t elementSize);
+void *carveColumn(char **cursor, size_t count, size_t elementSize);
+const char *plantName(int plant, char *buffer);
+void reservePlantStore(int count);
+void freePlantStore();
+void createAndInsertPlants(int numPlants, const char *plantType, float capacity, float minWaterLevel, float maxWaterLevel, int region);
+bool parseCount(const char *text, unsigned long long *value);
+bool parseRegionBands(const char *spec);
+bool parseSweepRanges(const char *spec);
+bool parseSweepWeathers(const char *spec);
+void initRegions();
+void freeRegions();
+float regionGeneration(const Region *region);
+PlantHeap regionHeap(const Region *region, const PlantHeap *heap);
+PlantHeap classHeap(const Region *region, int classId, const PlantHeap *heap);
+void dispatchLoop(Region *region);
+void *regionDispatchRoutine(void *arg);
+bool borrowGeneration(Region *region);
+void releaseImports(Region *region);
+void loadFleetFile(const char *path);
+void *scanFleetChunk(void *arg);
+void *fillFleetChunk(void *arg);
+bool parseFleetRow(const char **cursor, const char *end, FleetRow *row, bool *isData, const char **error);
+bool parseFleetNumber(const char **cursor, const char *end, double *value);
+int findFleetClass(FleetChunk *chunk, const FleetRow *row);
+void initPlacement();
+int readSysfsNumber(const char *format, int cpu, int fallback);
+int readCpuNode(int cpu);
+int compareCpus(const void *a, const void *b);
+void assignWorkerCpus();
+bool placementCpus(int role, int worker, cpu_set_t *set);
+void placeThread(pthread_attr_t *attr, int role, int worker);
+void placeFleetMemory();
+void bindToNode(void *address, size_t bytes, int node);
+void startEngine();
+void stopEngine();
+void runEngineTick();
+bool adjustmentDue(const Region *region, bool windowClosed);
+void sampleTick();
+void updateRecoveryClocks();
+void runVirtualClock();
+void requestOrderRefresh();
+unsigned long long fleetDigest();
+void *engineClockRoutine();
+void *engineWorkerRoutine(void *arg);
+void advanceWorkerSlice(EngineWorker *worker);
+void advanceBatch(EngineWorker *worker, int first, int last);
+void publishDeactivations(EngineWorker *worker);
+void initEventSchedule(EngineWorker *worker);
+void advanceEventSlice(EngineWorker *worker);
+int nextBusyPlant(const EngineWorker *worker, int plant);
+bool isBusyPlant(const EngineWorker *worker, int plant);
+void setBusyPlant(EngineWorker *worker, int plant, bool busy);
+bool isIdlePlant(int plant);
+unsigned long nextRainTick(int plant, unsigned long from);
+void insertTimer(EngineWorker *worker, int plant, unsigned long now);
+void removeTimer(EngineWorker *worker, int plant);
+void advanceTimerWheel(EngineWorker *worker, unsigned long tick);
+void wakePlant(int plant);
+void flushAdjustments(bool windowClosed);
+void waterLevelKernel(int first, int last, bool recovering, const int *active, unsigned char *events);
+unsigned long long mixBits(unsigned long long bits);
+float weatherDraw(int plant, unsigned long tick);
+void fillWeatherDraws(int first, int last, unsigned long tick, float *draws);
+unsigned long long weatherStream(int plant);
+void drawWeather(int plant, float prob);
 void *sortingThreadRoutine();
-bool applyGreedyAlgorithm();
-void insertSorted(HydroelectricPlant *plant);
-int comparePlants(HydroelectricPlant *a, HydroelectricPlant *b);
-void sortList();
-void activatePlant(HydroelectricPlant *plant);
-void deactivatePlant(HydroelectricPlant *plant);
+void handleAdjustment(Region *region);
+bool applyIncrementalDispatch(Region *region);
+bool isReadyStandby(int plant, const FleetSnapshot *fleet);
+bool sustainsHorizon(int plant, const FleetSnapshot *fleet);
+void refillStandbyPool(Region *region);
+bool adjustCapacity(Region *region);
+bool applyGreedyAlgorithm(Region *region);
+bool applyExactDispatch(Region *region);
+void initSnapshots();
+void freeSnapshots();
+int acquireSnapshot(SnapshotRing *ring);
+void releaseSnapshot(SnapshotRing *ring, int buffer);
+int reserveSnapshot(SnapshotRing *ring);
+void publishSnapshot(SnapshotRing *ring, int buffer, unsigned long epoch);
+void publishPlantOrder(unsigned long epoch);
+void openDispatchView(DispatchView *view, const Region *region);
+void closeDispatchView(DispatchView *view);
+float currentGeneration();
+long long capacityKilowatts(int plant);
+float relativeWaterLevel(int plant, float waterLevel);
+int comparePlants(const PlantHeap *heap, int a, int b);
+bool hasPriorityOver(const PlantHeap *heap, int a, int b);
+void buildPlantOrder(const float *keys);
+void freePlantOrder();
+void siftPlantUp(PlantHeap *heap, int position);
+void siftPlantDown(PlantHeap *heap, int position);
+void updatePlantKey(PlantHeap *heap, int plant, float key);
+void refreshPlantOrder();
+void beginPlantWalk(PlantWalk *walk, const PlantHeap *heap);
+int nextPlantInOrder(PlantWalk *walk);
+void pushWalkPosition(PlantWalk *walk, int position);
+void endPlantWalk(PlantWalk *walk);
+bool activatePlant(int plant);
+bool deactivatePlant(int plant);
 void shutdownPlantsAndPrintFinalStatus();
+void startLogger();
+void stopLogger();
+void logEvent(int event, int plant, int count, float first, float second);
+LogRing *attachLogRing();
+void *logWriterRoutine();
+unsigned long drainLogRings();
+void writeLogRecord(const LogRecord *record);
+unsigned long long monotonicNanos();
+void lockMutex(pthread_mutex_t *mutex);
+int latencyBucket(unsigned long long nanos);
+unsigned long long latencyBucketStart(int bucket);
+void recordLatency(int histogram, unsigned long long nanos);
+void writeHistogramJson(const LatencyHistogram *histogram);
+void dumpStats(const char *reason);
+size_t plantStoreSize(int count);
+void carvePlantStore(void *arena, int count);
+void writeCheckpoint(const char *path);
+void restoreCheckpoint(const char *path);
+bool checkpointSectionFits(unsigned long long offset, unsigned long long length, size_t size);
+void resumePendingAdjustments();
+void openWeatherTrace(const char *path);
+void closeWeatherTrace();
+void *weatherPrefetchRoutine();
+void prefetchWeatherRows(unsigned long row);
+void replayWeather(int first, int last, unsigned long tick);
+void startWeatherRecording(const char *path);
+void stopWeatherRecording();
+void startTelemetry(const char *path);
+void stopTelemetry();
+void beginTelemetryTick();
+void endTelemetryTick();
+void recordTelemetrySlice(int first, int last);
+void *telemetryWriterRoutine();
+void writeTelemetryChunk(const TelemetryBuffer *buffer);
+void encodeTelemetryBlock(BitWriter *writer, const TelemetryBuffer *buffer, int first, int last);
+void putBits(BitWriter *writer, unsigned long long value, unsigned int count);
+void alignBits(BitWriter *writer);
+unsigned int bitWidth(unsigned long long value);
+unsigned long long zigzag(long long value);
+void runEnsemble();
+int ensembleJobCount(int replicas);
+void openEnsemble(int replicas);
+bool runEnsembleRound(int replicas, int jobs);
+void runEnsembleJob(int cpu, int replicas);
+void finishReplica();
+void reportEnsemble(int jobs, unsigned long long nanos);
+void wilsonInterval(int successes, int trials, double *low, double *high);
+int compareTicks(const void *a, const void *b);
+void runSweep();
+bool sweepFleetFeasible(int numH1, int numH2, int numH3);
+void pruneSweepPoints();
+void reportSweep(int jobs, unsigned long long nanos, unsigned long replicas);
+int compareSweepPoints(const void *a, const void *b);
+unsigned long tickPercentile(const unsigned long *sorted, int count, double fraction);
+void startControl(const char *path);
+void stopControl();
+void *statusThreadRoutine();
+void buildStatusSnapshot(StatusSnapshot *status, const FleetSnapshot *fleet, unsigned long tick);
+void readStatusCounters(StatusSnapshot *status);
+bool ranksBelow(const StatusSnapshot *status, int a, int b);
+void siftStatusPlant(StatusSnapshot *status, int position, int size);
+void *controlThreadRoutine();
+bool serveControlClient(ControlClient *client);
+size_t answerControlCommand(char *command, char *reply);
+size_t appendReply(char *reply, size_t length, const char *format, ...);
+bool queueControlChange(const ControlChange *change);
+void applyControlChanges();
+void rescheduleIdlePlants();
 /**
  * Handles system signals.
  * Specifically handles the SIGINT signal (Ctrl+C interruption).
  * When SIGINT is received, it sets the shutdownRequested flag to 1
  * indicating that a graceful shutdown of the program is requested.
+ * SIGUSR1 asks for the instrumentation to be dumped and SIGUSR2 for a checkpoint, at the end of the current tick.
  *
  * @param sig The signal received.
  */
-void signalHandler(int sig)
+void signalHandler(int sig)
+{
+    static const char message[] = "\033[31m\nShutting down simulation - shutdown signal received***\n\033[0m";
+    if (sig == SIGINT)
+    {
+        shutdownRequested = 1;
+        write(STDOUT_FILENO, message, sizeof(message) - 1); // printf is not async-signal-safe
+    }
+    else if (sig == SIGUSR1)
+    {
+        statsDumpRequested = 1;
+    }
+    else if (sig == SIGUSR2)
+    {
+        checkpointRequested = 1;
+    }
+}
+/**
+ * Main function of the program.
+ * It initializes and manages the simulation of hydroelectric plants.
+ *
+ * @param argc The count of command-line arguments.
+ * @param argv The command-line arguments.
+ * @return int Returns 0 on successful execution, 1 on error.
+ */
+int main(int argc, char *argv[])
+{
+    // Parse the engine options and validate the correct number of positional arguments
+    int argi = parseOptions(argc, argv);
+    if (argi < 0 || argc - argi != (fleetPath != NULL || restorePath != NULL || sweepMode ? 3 : 6))
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // Parse the input arguments
+    probA = atof(argv[argi]);
+    probB = atof(argv[argi + 1]);
+    probC = atof(argv[argi + 2]);
+
+    // Ensure the sum of probabilities is equal to 1.0
+    if (probA + probB + probC != 1.0f)
+    {
+        fprintf(stderr, "Error: The sum of probabilities must be 1.\n");
+        return 1;
+    }
+    if (scheduleMode == SCHEDULE_EVENT && weatherPath != NULL)
+    {
+        fprintf(stderr, "Error: --schedule event draws the weather ahead and cannot replay a weather trace.\n");
+        return 1;
+    }
+    if (ensembleReplicas > 0 && (tickLimit == 0 || restorePath != NULL || checkpointPath != NULL || weatherPath != NULL || weatherRecordPath != NULL))
+    {
+        fprintf(stderr, "Error: --ensemble needs a --ticks horizon and cannot be combined with checkpoints or weather traces.\n");
+        return 1;
+    }
+    if (controlPath != NULL && (ensembleReplicas > 0 || sweepMode))
+    {
+        fprintf(stderr, "Error: --control serves a single run and cannot be combined with --ensemble or --sweep.\n");
+        return 1;
+    }
+    if (sweepMode && (tickLimit == 0 || fleetPath != NULL || restorePath != NULL || checkpointPath != NULL || weatherPath != NULL ||
+                      weatherRecordPath != NULL))
+    {
+        fprintf(stderr, "Error: --sweep needs a --ticks horizon and cannot be combined with a fleet file, checkpoints or weather traces.\n");
+        return 1;
+    }
+
+    // An ensemble or a sweep forks its replicas here, before any thread exists, and each of them goes on as a single run
+    if (sweepMode)
+    {
+        runSweep();
+    }
+    else if (ensembleReplicas > 0)
+    {
+        runEnsemble();
+    }
+
+    // Create the power plants, from a checkpoint, from the fleet file or as H1, H2 and H3 plants
+    unsigned long long start = monotonicNanos();
+    if (restorePath != NULL)
+    {
+        restoreCheckpoint(restorePath);
+    }
+    else if (fleetPath != NULL)
+    {
+        loadFleetFile(fleetPath);
+    }
+    else
+    {
+        int numH1 = sweepPoint != NULL ? sweepPoint->numH1 : atoi(argv[argi + 3]);
+        int numH2 = sweepPoint != NULL ? sweepPoint->numH2 : atoi(argv[argi + 4]);
+        int numH3 = sweepPoint != NULL ? sweepPoint->numH3 : atoi(argv[argi + 5]);
+        reservePlantStore(numH1 + numH2 + numH3);
+        for (int r = 0; r < numRegions; r++)
+        {
+            // Every region gets its share of each plant type
+            createAndInsertPlants(numH1 / numRegions + (r < numH1 % numRegions), "H1", H1_CAPACITY, 50.0, 200.0, r);
+            createAndInsertPlants(numH2 / numRegions + (r < numH2 % numRegions), "H2", H2_CAPACITY, 25.0, 100.0, r);
+            createAndInsertPlants(numH3 / numRegions + (r < numH3 % numRegions), "H3", H3_CAPACITY, 10.0, 50.0, r);
+        }
+    }
+    fleetCreationNanos = monotonicNanos() - start;
+    initRegions();
+    activationTicks = allocateColumn(plants.count, sizeof(unsigned long));
+
+    // Validate if the total capacity of every region is sufficient
+    for (int r = 0; r < numRegions; r++)
+    {
+        float totalMaxCapacity = 0.0;
+        for (int plant = regions[r].first; plant < regions[r].last; plant++)
+        {
+            totalMaxCapacity += plants.capacity[plant];
+        }
+        if (totalMaxCapacity < regions[r].minGeneration)
+        {
+            fprintf(stderr, "Error: The maximum total capacity of %f MW/s of region %d does not reach the required minimum of %f MW/s.\n",
+                    totalMaxCapacity, r + 1, regions[r].minGeneration);
+            return 1;
+        }
+    }
+
+    // The exact dispatch counts capacities in 1/DISPATCH_UNITS_PER_MW MW units, so they must be whole units
+    for (int c = 0; dispatchMode == DISPATCH_EXACT && c < numPlantClasses; c++)
+    {
+        float scaled = plantClasses[c].capacity * DISPATCH_UNITS_PER_MW;
+        if (fabsf(scaled - roundf(scaled)) > 1e-2f)
+        {
+            fprintf(stderr, "Error: The capacity of %f MW of plant class %s is not a multiple of %g MW, which the exact dispatch requires.\n",
+                    plantClasses[c].capacity, plantClasses[c].name, 1.0 / DISPATCH_UNITS_PER_MW);
+            return 1;
+        }
+    }
+
+    // Map the weather trace now that the fleet it describes is known
+    if (weatherPath != NULL)
+    {
+        openWeatherTrace(weatherPath);
+    }
+    if (weatherRecordPath != NULL)
+    {
+        startWeatherRecording(weatherRecordPath);
+    }
+    if (telemetryPath != NULL)
+    {
+        startTelemetry(telemetryPath);
+    }
+
+    // Signal handler setup
+    struct sigaction sa;
+    sa.sa_handler = &signalHandler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+    sigaction(SIGUSR2, &sa, NULL);
+
+    statsOutput = statsPath != NULL ? fopen(statsPath, "w") : stderr;
+    if (statsOutput == NULL)
+    {
+        fprintf(stderr, "Error: Could not open the stats file %s.\n", statsPath);
+        return 1;
+    }
+
+    // Read the CPU topology and set aside the dispatch and sorting cores before any thread is placed
+    initPlacement();
+
+    // Start the log writer before any thread logs
+    startLogger();
+
+    // Initialize mutexes and semaphores; those of the regions are set up with the regions
+    sem_init(&sortingSemaphore, 0, 0);
+
+    // Order the plants by priority, in the order dispatch last saw if restoring
+    start = monotonicNanos();
+    buildPlantOrder(restoredCheckpoint != NULL ? (const float *)((const char *)restoredCheckpoint + restoredCheckpoint->keysOffset) : NULL);
+    orderBuildNanos = monotonicNanos() - start;
+    initSnapshots();
+
+    // Apply the dispatch algorithm to determine active plants before thread creation; a restored fleet already has them
+    if (restoredCheckpoint == NULL)
+    {
+        for (int r = 0; r < numRegions && !shutdownRequested; r++)
+        {
+            adjustCapacity(&regions[r]);
+        }
+    }
+
+    // Advance the fleet on a shared tick with a fixed pool of workers
+    startEngine();
+    if (restoredCheckpoint != NULL)
+    {
+        resumePendingAdjustments();
+    }
+    if (controlPath != NULL)
+    {
+        startControl(controlPath);
+    }
+
+    // Every other thread is placed, so the main thread can move to the dispatch core
+    cpu_set_t dispatchCpus;
+    if (placementCpus(ROLE_DISPATCH, 0, &dispatchCpus))
+    {
+        pthread_setaffinity_np(pthread_self(), sizeof(dispatchCpus), &dispatchCpus);
+    }
+
+    pthread_t sortingThread;
+    if (clockMode == CLOCK_VIRTUAL)
+    {
+        // Ticks, dispatch and sorting run back to back on this thread
+        runVirtualClock();
+    }
+    else
+    {
+        // Create and launch the sorting thread
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        placeThread(&attr, ROLE_SORTING, 0);
+        pthread_create(&sortingThread, &attr, sortingThreadRoutine, NULL);
+        pthread_attr_destroy(&attr);
+
+        // The other regions get their own dispatcher, next to the service threads
+        for (int r = 1; r < numRegions; r++)
+        {
+            pthread_attr_init(&attr);
+            placeThread(&attr, ROLE_SERVICE, 0);
+            pthread_create(&regions[r].dispatchThread, &attr, regionDispatchRoutine, &regions[r]);
+            pthread_attr_destroy(&attr);
+        }
+
+        // Main loop for the dispatch algorithm of the first region
+        dispatchLoop(&regions[0]);
+
+        // The clock thread releases the other dispatchers on its way out; they may wake plants until then
+        for (int r = 1; r < numRegions; r++)
+        {
+            pthread_join(regions[r].dispatchThread, NULL);
+        }
+    }
+
+    // Wait for all threads to finish
+    stopEngine();
+    if (weatherTrace != NULL)
+    {
+        weatherStopping = true;
+        sem_post(&weatherSemaphore); // Release the prefetch thread if it is waiting for work
+        pthread_join(weatherPrefetchThread, NULL);
+    }
+    if (weatherRecordFile != NULL)
+    {
+        stopWeatherRecording();
+    }
+    if (telemetryFile != NULL)
+    {
+        stopTelemetry();
+    }
+    if (controlSocket >= 0)
+    {
+        stopControl();
+    }
+    if (clockMode == CLOCK_WALL)
+    {
+        sem_post(&sortingSemaphore); // Release the sorting thread if it is waiting for work
+        pthread_join(sortingThread, NULL);
+    }
+    stopLogger(); // Every thread that logs has stopped, so the writer can drain the rings and exit
+    if (checkpointPath != NULL)
+    {
+        writeCheckpoint(checkpointPath);
+    }
+    bool passesDue = false; // With the virtual clock the passes of the last tick are left to a restored run
+    for (int r = 0; r < numRegions; r++)
+    {
+        passesDue = passesDue || adjustmentDue(&regions[r], currentTick % coalesceTicks == 0);
+    }
+    if (currentTick > sampledTick && !passesDue)
+    {
+        sampleTick(); // The last tick, unless its outcome is still open
+    }
+    if (ensembleReplica >= 0)
+    {
+        finishReplica(); // A replica only hands its summary to the ensemble
+    }
+
+    printf("Final state after %lu ticks: generation %f MW/s, fleet digest %016llx.\n", currentTick, currentGeneration(), fleetDigest());
+
+    if (dispatchMode == DISPATCH_EXACT)
+    {
+        printf("Exact dispatch: %lu passes, greedy would have started a recovery in %lu, feasible dispatch found in %lu of those.\n",
+               dispatchPasses, greedyShortfalls, exactRescues);
+    }
+    printf("Adjustment requests: %lu deactivation events handled in %lu dispatch passes.\n", adjustmentEvents, adjustmentPasses);
+    if (currentTick > engineStartTick)
+    {
+        double hours = (double)(currentTick - engineStartTick) / 3600.0;
+        printf("Churn: %.1f activations, %.1f of them undone within %d ticks, and %.1f dispatch passes per simulated hour.\n",
+               (activations - activationsAtStart) / hours, (churnPairs - churnPairsAtStart) / hours, CHURN_WINDOW_TICKS,
+               (adjustmentPasses - adjustmentPassesAtStart) / hours);
+    }
+    unsigned long blackoutTicks = 0;
+    unsigned long recoveringTicks = 0;
+    for (int r = 0; r < numRegions; r++)
+    {
+        blackoutTicks += regions[r].blackoutTicks;
+        recoveringTicks += regions[r].recoveringTicks;
+    }
+    printf("Recovery: %lu attempts, %lu recoveries, %lu blackout-seconds below the minimum generation, %lu of them recovering.\n",
+           recoveryAttempts, recoveries, blackoutTicks, recoveringTicks);
+    if (lookaheadHorizon > 0)
+    {
+        printf("Lookahead dispatch: horizon of %d ticks, %lu candidates passed over, %lu passes fell back on them to reach the minimum.\n",
+               lookaheadHorizon, lookaheadSkips, lookaheadFallbacks);
+    }
+    if (numRegions > 1)
+    {
+        for (int r = 0; r < numRegions; r++)
+        {
+            const Region *region = &regions[r];
+            printf("Region %d: plants %d to %d, band %.1f-%.1f MW/s, generation %f MW/s, imported %f MW/s, exported %f MW/s.\n",
+                   r + 1, region->first, region->last - 1, region->minGeneration, region->maxGeneration, regionGeneration(region),
+                   (float)atomic_load(&region->importedKilowatts) / 1000.0f, (float)atomic_load(&region->exportedKilowatts) / 1000.0f);
+        }
+        printf("Transfers: %lu loans between regions, up to %.1f MW/s per pair.\n", transfers, transferLimit);
+    }
+    if (weatherTrace != NULL)
+    {
+        printf("Weather trace: %lu ticks replayed, %lu waited for their row to be prefetched.\n",
+               currentTick > weatherTrace->firstTick ? currentTick - (unsigned long)weatherTrace->firstTick : 0, weatherStalls);
+    }
+    if (scheduleMode == SCHEDULE_EVENT)
+    {
+        unsigned long long plantTicks = (unsigned long long)plants.count * (currentTick - engineStartTick);
+        unsigned long long advanced = advancedPlantTicks - advancedPlantTicksAtStart;
+        printf("Event scheduling: %llu of %llu plant-ticks advanced, %.1f%% skipped.\n", advanced, plantTicks,
+               plantTicks > 0 ? 100.0 * (double)(plantTicks - advanced) / (double)plantTicks : 0.0);
+    }
+    if (incrementalDispatch)
+    {
+        printf("Incremental dispatch: %lu adjustments covered by standby plants, %lu needed a full pass.\n",
+               incrementalAdjustments, fullAdjustments);
+    }
+    if (placementPolicy != PLACEMENT_NONE)
+    {
+        printf("Placement: %s, %d workers over %d NUMA nodes, ", placementNames[placementPolicy], numWorkers, numNodes);
+        if (dispatchCpu >= 0)
+        {
+            printf("dispatch on CPU %d, sorting on CPU %d.\n", dispatchCpu, sortingCpu);
+        }
+        else
+        {
+            printf("no cores reserved for dispatch and sorting.\n");
+        }
+    }
+    if (logDropped > 0)
+    {
+        printf("Log: %lu records written, %lu dropped because a log ring was full.\n", logWritten, logDropped);
+    }
+    if (telemetryPath != NULL)
+    {
+        unsigned long long plantTicks = (unsigned long long)plants.count * telemetryHeader.ticks;
+        printf("Telemetry: %llu ticks in %d chunks, %.2f bytes per plant-tick; the writer was behind on %llu ticks, %lu of them waited for.\n",
+               telemetryHeader.ticks, telemetryHeader.chunks, plantTicks > 0 ? (double)telemetryBytes / (double)plantTicks : 0.0,
+               telemetryHeader.droppedTicks + telemetryStalls, telemetryStalls);
+    }
+    if (controlPath != NULL)
+    {
+        printf("Control: %lu queries answered, %lu runtime changes applied.\n", controlQueries, controlChangesApplied);
+    }
+    dumpStats("shutdown");
+    if (statsOutput != stderr)
+    {
+        fclose(statsOutput);
+    }
+
+    // Free resources
+    sem_destroy(&sortingSemaphore);
+    freeRegions();
+    freeSnapshots();
+    freePlantOrder();
+    closeWeatherTrace();
+    freePlantStore();
+    free(activationTicks);
+    free(cpus);
+    return 0;
+}
+
+/**
+ * Parses the optional engine flags that may precede or follow the positional arguments.
+ * Supported options:
+ *   --workers N          Number of engine worker threads (defaults to the number of online cores).
+ *   --dispatch ALGORITHM greedy (default) or exact.
+ *   --incremental        Cover deficits from the standby pool before running a full dispatch pass.
+ *   --coalesce-ticks N   Merge the deactivations of N ticks into a single dispatch pass (default 1).
+ *   --clock MODE         wall (default) paces one tick per second, virtual runs ticks as fast as possible.
+ *   --ticks N            Stop after N ticks.
+ *   --seed S             Seed of the weather random streams.
+ *   --log-level LEVEL    error, warn, info or debug (default); debug adds the per-plant tick lines.
+ *   --log-format FORMAT  text (default) or binary.
+ *   --log-file PATH      Write the log to a file instead of stdout.
+ *   --stats-file PATH    Write the instrumentation dumps to a file instead of stderr.
+ *   --fleet PATH         Load the fleet from a CSV file; only the three probabilities are then positional.
+ *   --checkpoint PATH    Write checkpoints to PATH on SIGUSR2 and at shutdown.
+ *   --checkpoint-every N Also write one every N ticks.
+ *   --restore PATH       Resume from a checkpoint; only the three probabilities are then positional.
+ *   --weather PATH       Replay the rain increments of a weather trace instead of drawing the weather.
+ *   --weather-record PATH Record the rain increment of every plant and tick to a weather trace.
+ *   --telemetry PATH     Record the water level, state and rain of every plant and the generation every tick.
+ *   --control PATH       Serve queries and runtime weather and band changes on a Unix-domain socket.
+ *   --placement POLICY   spread (default), compact or none.
+ *   --reserved-cores N   Physical cores set aside for dispatch and sorting: 0, 1 (shared) or 2.
+ *   --regions BANDS      Split the fleet into regions, one MIN:MAX demand band each, comma-separated.
+ *   --transfer-limit MW  Generation one region may lend to another that is short of its minimum.
+ *   --schedule MODE      tick (default) advances every plant every tick, event skips idle plants.
+ *   --horizon K          Prefer plants that can sustain generation over the next K ticks (default 0, off).
+ *   --recovery-attempts N Recovery attempts per region before the fleet is shut down (default 4).
+ *   --recovery-interval T Ticks between two recovery attempts (default 1).
+ *   --recovery-refill RULE never (default), success or a number of ticks at or above the minimum per attempt regained.
+ *   --ensemble N         Run N independent replicas up to the --ticks horizon and report blackout statistics.
+ *   --jobs J             Replicas of an ensemble run at once (default one per allowed CPU).
+ *   --sweep RANGES       Run an ensemble for every H1, H2 and H3 mix in FIRST[:LAST[:STEP]] ranges; only the three
+ *                        probabilities are then positional, and --ensemble gives the replicas per mix (default 256).
+ *   --sweep-weather PROBS Also sweep these A:B:C probability triples, comma-separated.
+ *   --target P           Report the smallest mix of a sweep whose blackout probability stays under P.
+ *
+ * @param argc The count of command-line arguments.
+ * @param argv The command-line arguments, permuted so the positional arguments come last.
+ * @return The index of the first positional argument, or -1 if an option is invalid.
+ */
+int parseOptions(int argc, char *argv[])
+{
+    static struct option longOptions[] = {
+        {"workers", required_argument, NULL, 'w'},
+        {"dispatch", required_argument, NULL, 'd'},
+        {"incremental", no_argument, NULL, 'i'},
+        {"coalesce-ticks", required_argument, NULL, 'c'},
+        {"clock", required_argument, NULL, 'k'},
+        {"ticks", required_argument, NULL, 't'},
+        {"seed", required_argument, NULL, 's'},
+        {"log-level", required_argument, NULL, 'l'},
+        {"log-format", required_argument, NULL, 'f'},
+        {"log-file", required_argument, NULL, 'o'},
+        {"stats-file", required_argument, NULL, 'j'},
+        {"fleet", required_argument, NULL, 'F'},
+        {"checkpoint", required_argument, NULL, 'C'},
+        {"checkpoint-every", required_argument, NULL, 'E'},
+        {"restore", required_argument, NULL, 'R'},
+        {"weather", required_argument, NULL, 'W'},
+        {"weather-record", required_argument, NULL, 'r'},
+        {"telemetry", required_argument, NULL, 'Z'},
+        {"control", required_argument, NULL, 'K'},
+        {"placement", required_argument, NULL, 'P'},
+        {"reserved-cores", required_argument, NULL, 'X'},
+        {"regions", required_argument, NULL, 'G'},
+        {"transfer-limit", required_argument, NULL, 'T'},
+        {"schedule", required_argument, NULL, 'S'},
+        {"horizon", required_argument, NULL, 'H'},
+        {"recovery-attempts", required_argument, NULL, 'A'},
+        {"recovery-interval", required_argument, NULL, 'N'},
+        {"recovery-refill", required_argument, NULL, 'B'},
+        {"ensemble", required_argument, NULL, 'M'},
+        {"jobs", required_argument, NULL, 'J'},
+        {"sweep", required_argument, NULL, 'Y'},
+        {"sweep-weather", required_argument, NULL, 'Q'},
+        {"target", required_argument, NULL, 'U'},
+        {NULL, 0, NULL, 0}};
+
+    int opt;
+    unsigned long long count; // A parsed count option
+    while ((opt = getopt_long(argc, argv, "", longOptions, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'w':
+            numWorkers = atoi(optarg);
+            if (numWorkers <= 0)
+            {
+                fprintf(stderr, "Error: --workers must be a positive number.\n");
+                return -1;
+            }
+            break;
+        case 'd':
+            if (strcmp(optarg, "greedy") == 0)
+            {
+                dispatchMode = DISPATCH_GREEDY;
+            }
+            else if (strcmp(optarg, "exact") == 0)
+            {
+                dispatchMode = DISPATCH_EXACT;
+            }
+            else
+            {
+                fprintf(stderr, "Error: --dispatch must be greedy or exact.\n");
+                return -1;
+            }
+            break;
+        case 'i':
+            incrementalDispatch = true;
+            break;
+        case 'c':
+            coalesceTicks = atoi(optarg);
+            if (coalesceTicks <= 0)
+            {
+                fprintf(stderr, "Error: --coalesce-ticks must be a positive number.\n");
+                return -1;
+            }
+            break;
+        case 'k':
+            if (strcmp(optarg, "wall") == 0)
+            {
+                clockMode = CLOCK_WALL;
+            }
+            else if (strcmp(optarg, "virtual") == 0)
+            {
+                clockMode = CLOCK_VIRTUAL;
+            }
+            else
+            {
+                fprintf(stderr, "Error: --clock must be wall or virtual.\n");
+                return -1;
+            }
+            break;
+        case 't':
+            if (!parseCount(optarg, &count) || count > ULONG_MAX)
+            {
+                fprintf(stderr, "Error: --ticks must be a number of ticks, or 0 to run until interrupted.\n");
+                return -1;
+            }
+            tickLimit = (unsigned long)count;
+            break;
+        case 's':
+            if (!parseCount(optarg, &randomSeed))
+            {
+                fprintf(stderr, "Error: --seed must be a non-negative integer.\n");
+                return -1;
+            }
+            break;
+        case 'l':
+            logLevel = -1;
+            for (int level = LOG_ERROR; level <= LOG_DEBUG; level++)
+            {
+                if (strcmp(optarg, logLevelNames[level]) == 0)
+                {
+                    logLevel = level;
+                }
+            }
+            if (logLevel < 0)
+            {
+                fprintf(stderr, "Error: --log-level must be error, warn, info or debug.\n");
+                return -1;
+            }
+            break;
+        case 'f':
+            if (strcmp(optarg, "text") == 0)
+            {
+                logFormat = LOG_FORMAT_TEXT;
+            }
+            else if (strcmp(optarg, "binary") == 0)
+            {
+                logFormat = LOG_FORMAT_BINARY;
+            }
+            else
+            {
+                fprintf(stderr, "Error: --log-format must be text or binary.\n");
+                return -1;
+            }
+            break;
+        case 'o':
+            logPath = optarg;
+            break;
+        case 'j':
+            statsPath = optarg;
+            break;
+        case 'F':
+            fleetPath = optarg;
+            break;
+        case 'C':
+            checkpointPath = optarg;
+            break;
+        case 'E':
+            if (!parseCount(optarg, &count) || count > ULONG_MAX)
+            {
+                fprintf(stderr, "Error: --checkpoint-every must be a number of ticks.\n");
+                return -1;
+            }
+            checkpointEvery = (unsigned long)count;
+            break;
+        case 'R':
+            restorePath = optarg;
+            break;
+        case 'W':
+            weatherPath = optarg;
+            break;
+        case 'r':
+            weatherRecordPath = optarg;
+            break;
+        case 'Z':
+            telemetryPath = optarg;
+            break;
+        case 'K':
+            controlPath = optarg;
+            break;
+        case 'P':
+            placementPolicy = -1;
+            for (int policy = PLACEMENT_SPREAD; policy <= PLACEMENT_NONE; policy++)
+            {
+                if (strcmp(optarg, placementNames[policy]) == 0)
+                {
+                    placementPolicy = policy;
+                }
+            }
+            if (placementPolicy < 0)
+            {
+                fprintf(stderr, "Error: --placement must be spread, compact or none.\n");
+                return -1;
+            }
+            break;
+        case 'X':
+            reservedCores = atoi(optarg);
+            if (reservedCores < 0 || reservedCores > 2)
+            {
+                fprintf(stderr, "Error: --reserved-cores must be 0, 1 or 2.\n");
+                return -1;
+            }
+            break;
+        case 'G':
+            if (!parseRegionBands(optarg))
+            {
+                fprintf(stderr, "Error: --regions must list 1 to %d MIN:MAX bands with 0 <= MIN <= MAX.\n", MAX_REGIONS);
+                return -1;
+            }
+            break;
+        case 'T':
+            transferLimit = atof(optarg);
+            if (transferLimit < 0.0f)
+            {
+                fprintf(stderr, "Error: --transfer-limit must not be negative.\n");
+                return -1;
+            }
+            break;
+        case 'S':
+            if (strcmp(optarg, scheduleNames[SCHEDULE_TICK]) == 0)
+            {
+                scheduleMode = SCHEDULE_TICK;
+            }
+            else if (strcmp(optarg, scheduleNames[SCHEDULE_EVENT]) == 0)
+            {
+                scheduleMode = SCHEDULE_EVENT;
+            }
+            else
+            {
+                fprintf(stderr, "Error: --schedule must be tick or event.\n");
+                return -1;
+            }
+            break;
+        case 'H':
+            lookaheadHorizon = atoi(optarg);
+            if (lookaheadHorizon < 0)
+            {
+                fprintf(stderr, "Error: --horizon must not be negative.\n");
+                return -1;
+            }
+            break;
+        case 'A':
+            recoveryBudget = atoi(optarg);
+            if (recoveryBudget < 0)
+            {
+                fprintf(stderr, "Error: --recovery-attempts must not be negative.\n");
+                return -1;
+            }
+            break;
+        case 'N':
+            recoveryInterval = atoi(optarg);
+            if (recoveryInterval <= 0)
+            {
+                fprintf(stderr, "Error: --recovery-interval must be a positive number.\n");
+                return -1;
+            }
+            break;
+        case 'B':
+            if (strcmp(optarg, "never") == 0)
+            {
+                recoveryRefill = REFILL_NEVER;
+            }
+            else if (strcmp(optarg, "success") == 0)
+            {
+                recoveryRefill = REFILL_SUCCESS;
+            }
+            else if ((recoveryRefillTicks = atoi(optarg)) > 0)
+            {
+                recoveryRefill = REFILL_TICKS;
+            }
+            else
+            {
+                fprintf(stderr, "Error: --recovery-refill must be never, success or a positive number of ticks.\n");
+                return -1;
+            }
+            break;
+        case 'M':
+            ensembleReplicas = atoi(optarg);
+            if (ensembleReplicas <= 0)
+            {
+                fprintf(stderr, "Error: --ensemble must be a positive number.\n");
+                return -1;
+            }
+            break;
+        case 'J':
+            ensembleJobs = atoi(optarg);
+            if (ensembleJobs <= 0)
+            {
+                fprintf(stderr, "Error: --jobs must be a positive number.\n");
+                return -1;
+            }
+            break;
+        case 'Y':
+            if (!parseSweepRanges(optarg))
+            {
+                fprintf(stderr, "Error: --sweep must list three FIRST[:LAST[:STEP]] ranges of H1, H2 and H3 plants, e.g. 0:20,0:20:5,0:60:10.\n");
+                return -1;
+            }
+            break;
+        case 'Q':
+            if (!parseSweepWeathers(optarg))
+            {
+                fprintf(stderr, "Error: --sweep-weather must list up to %d A:B:C probability triples summing to 1, comma-separated.\n",
+                        MAX_SWEEP_WEATHERS - 1);
+                return -1;
+            }
+            break;
+        case 'U':
+            reliabilityTarget = atof(optarg);
+            if (!(reliabilityTarget > 0.0 && reliabilityTarget < 1.0))
+            {
+                fprintf(stderr, "Error: --target must be a blackout probability between 0 and 1.\n");
+                return -1;
+            }
+            break;
+        default:
+            return -1;
+        }
+    }
+    return optind;
+}
+
+/**
+ * Prints the command-line usage of the program.
+ *
+ * @param program The name the program was invoked with.
+ */
+void printUsage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [options] <Prob A> <Prob B> <Prob C> <Num H1> <Num H2> <Num H3>\n", program);
+    fprintf(stderr, "       %s [options] --fleet FILE <Prob A> <Prob B> <Prob C>\n", program);
+    fprintf(stderr, "       %s [options] --restore CHECKPOINT <Prob A> <Prob B> <Prob C>\n", program);
+    fprintf(stderr, "       %s [options] --ticks N --sweep RANGES <Prob A> <Prob B> <Prob C>\n", program);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --workers N           Number of engine worker threads (default: online cores)\n");
+    fprintf(stderr, "  --dispatch ALGORITHM  greedy (default) or exact\n");
+    fprintf(stderr, "  --incremental         Cover deficits from standby plants before a full pass\n");
+    fprintf(stderr, "  --coalesce-ticks N    Merge the deactivations of N ticks into one dispatch pass (default: 1)\n");
+    fprintf(stderr, "  --clock MODE          wall (default, one tick per second) or virtual (as fast as possible)\n");
+    fprintf(stderr, "  --ticks N             Stop after N ticks (default: run until interrupted)\n");
+    fprintf(stderr, "  --seed S              Seed of the weather random streams (default: 1)\n");
+    fprintf(stderr, "  --log-level LEVEL     error, warn, info or debug (default, adds per-plant tick lines)\n");
+    fprintf(stderr, "  --log-format FORMAT   text (default) or binary\n");
+    fprintf(stderr, "  --log-file PATH       Write the log to PATH instead of stdout\n");
+    fprintf(stderr, "  --stats-file PATH     Write the SIGUSR1 and shutdown stats dumps to PATH instead of stderr\n");
+    fprintf(stderr, "  --fleet FILE          Load the plants from a CSV file: class,capacity,min_level,max_level[,initial_level[,count[,region]]]\n");
+    fprintf(stderr, "  --checkpoint PATH     Write a checkpoint to PATH on SIGUSR2 and at shutdown\n");
+    fprintf(stderr, "  --checkpoint-every N  Also write a checkpoint every N ticks\n");
+    fprintf(stderr, "  --restore PATH        Resume the simulation from a checkpoint\n");
+    fprintf(stderr, "  --weather PATH        Replay the rain increments of a weather trace instead of drawing the weather\n");
+    fprintf(stderr, "  --weather-record PATH Record the rain increment of every plant and tick to a weather trace\n");
+    fprintf(stderr, "  --telemetry PATH      Record the per-tick fleet state to a columnar file, read with blackout-telemetry\n");
+    fprintf(stderr, "  --control PATH        Answer queries and take weather and band changes on a Unix socket at PATH\n");
+    fprintf(stderr, "  --placement POLICY    spread (default, workers across NUMA nodes), compact (fill one node first) or none\n");
+    fprintf(stderr, "  --reserved-cores N    Cores set aside for dispatch and sorting: 0, 1 (shared) or 2 (default: 2 with 4+ cores)\n");
+    fprintf(stderr, "  --regions BANDS       Split the fleet into regions with their own demand band, e.g. 100:150,60:90\n");
+    fprintf(stderr, "  --transfer-limit MW   Generation a region may lend to another short of its minimum (default: 0, no transfers)\n");
+    fprintf(stderr, "  --schedule MODE       tick (default, every plant every tick) or event (skip idle plants until their next rain)\n");
+    fprintf(stderr, "  --horizon K           Prefer plants that can sustain generation over the next K ticks (default: 0, current level only)\n");
+    fprintf(stderr, "  --recovery-attempts N Recovery attempts per region before the fleet is shut down (default: 4)\n");
+    fprintf(stderr, "  --recovery-interval T Ticks between two recovery attempts (default: 1)\n");
+    fprintf(stderr, "  --recovery-refill RULE never (default), success (full budget back) or N (one attempt back per N ticks in band)\n");
+    fprintf(stderr, "  --ensemble N          Run N seeded replicas up to --ticks and report the blackout probability\n");
+    fprintf(stderr, "  --jobs J              Replicas of an ensemble run at once (default: one per allowed CPU)\n");
+    fprintf(stderr, "  --sweep RANGES        Run an ensemble per H1,H2,H3 mix in FIRST[:LAST[:STEP]] ranges, e.g. 0:20,0:20:5,0:60:10\n");
+    fprintf(stderr, "  --sweep-weather PROBS Also run every mix under these A:B:C probability triples, e.g. 0.8:0.1:0.1,0.7:0.2:0.1\n");
+    fprintf(stderr, "  --target P            Report the smallest swept mix whose blackout probability stays under P\n");
+}
+
+/**
+ * Parses a non-negative decimal integer option, such as a tick count or a seed, as a whole.
+ *
+ * @param text The argument of the option.
+ * @param value Where to store the number.
+ * @return false if the argument is not a number, has anything after it or does not fit.
+ */
+bool parseCount(const char *text, unsigned long long *value)
+{
+    if (*text < '0' || *text > '9')
+    {
+        return false; // strtoull would skip spaces and accept a sign
+    }
+    char *end;
+    errno = 0;
+    *value = strtoull(text, &end, 10);
+    return *end == '\0' && errno != ERANGE;
+}
+
+/**
+ * Parses the --regions list: one MIN:MAX demand band per region, separated by commas.
+ *
+ * @param spec The argument of --regions.
+ * @return false if the list is invalid.
+ */
+bool parseRegionBands(const char *spec)
+{
+    int count = 0;
+    const char *cursor = spec;
+    while (true)
+    {
+        char *end;
+        float minGeneration = strtof(cursor, &end);
+        if (end == cursor || *end != ':' || count == MAX_REGIONS)
+        {
+            return false;
+        }
+        cursor = end + 1;
+        float maxGeneration = strtof(cursor, &end);
+        if (end == cursor || (*end != ',' && *end != '\0') || !(minGeneration >= 0.0f && minGeneration <= maxGeneration))
+        {
+            return false;
+        }
+        regions[count].minGeneration = minGeneration;
+        regions[count].maxGeneration = maxGeneration;
+        count++;
+        if (*end == '\0')
+        {
+            break;
+        }
+        cursor = end + 1;
+    }
+    numRegions = count;
+    regionBandsGiven = true;
+    return true;
+}
+
+/**
+ * Parses the --sweep ranges: FIRST[:LAST[:STEP]] counts of H1, H2 and H3 plants, separated by commas.
+ * A lone count is swept as itself and the step defaults to 1.
+ *
+ * @param spec The argument of --sweep.
+ * @return false if the ranges are invalid.
+ */
+bool parseSweepRanges(const char *spec)
+{
+    const char *cursor = spec;
+    for (int c = 0; c < 3; c++)
+    {
+        char *end;
+        long bounds[3] = {0, 0, 1};
+        int given = 0;
+        do
+        {
+            bounds[given++] = strtol(cursor, &end, 10);
+            if (end == cursor)
+            {
+                return false;
+            }
+            cursor = end + 1;
+        } while (*end == ':' && given < 3);
+        bounds[1] = given > 1 ? bounds[1] : bounds[0];
+        if (*end != (c < 2 ? ',' : '\0') || !(bounds[0] >= 0 && bounds[0] <= bounds[1] && bounds[1] <= INT_MAX / 4 && bounds[2] > 0 &&
+                                               bounds[2] <= INT_MAX / 4))
+        {
+            return false;
+        }
+        for (int k = 0; k < 3; k++)
+        {
+            sweepRanges[c][k] = (int)bounds[k];
+        }
+    }
+    sweepMode = true;
+    return true;
+}
+
+/**
+ * Parses the --sweep-weather list: A:B:C probability triples, separated by commas, each summing to 1.
+ * They follow the positional probabilities in sweepWeathers.
+ *
+ * @param spec The argument of --sweep-weather.
+ * @return false if the list is invalid.
+ */
+bool parseSweepWeathers(const char *spec)
+{
+    int count = 1;
+    const char *cursor = spec;
+    while (true)
+    {
+        char *end;
+        if (count == MAX_SWEEP_WEATHERS)
+        {
+            return false;
+        }
+        for (int k = 0; k < 3; k++)
+        {
+            sweepWeathers[count][k] = strtof(cursor, &end);
+            if (end == cursor || (k < 2 && *end != ':') || sweepWeathers[count][k] < 0.0f)
+            {
+                return false;
+            }
+            cursor = end + 1;
+        }
+        if ((*end != ',' && *end != '\0') || sweepWeathers[count][0] + sweepWeathers[count][1] + sweepWeathers[count][2] != 1.0f)
+        {
+            return false;
+        }
+        count++;
+        if (*end == '\0')
+        {
+            break;
+        }
+    }
+    numSweepWeathers = count;
+    return true;
+}
+
+/**
+ * Allocates one column of the plant store, aligned to a cache line so the kernels can stream it.
+ * Exits the program if the memory cannot be allocated.
+ *
+ * @param count The number of elements in the column.
+ * @param elementSize The size of each element in bytes.
+ * @return A pointer to the zero-initialized column.
+ */
+void *allocateColumn(size_t count, size_t elementSize)
+{
+    size_t bytes = count * elementSize;
+    bytes = (bytes + COLUMN_ALIGNMENT - 1) / COLUMN_ALIGNMENT * COLUMN_ALIGNMENT; // aligned_alloc needs a multiple of the alignment
+    void *column = aligned_alloc(COLUMN_ALIGNMENT, bytes > 0 ? bytes : COLUMN_ALIGNMENT);
+    if (column == NULL)
+    {
+        fprintf(stderr, "Error: Could not allocate memory for the power plants.\n");
+        exit(-1); // Exit the program entirely if memory allocation fails
+    }
+    memset(column, 0, bytes);
+    return column;
+}
+
+/**
+ * Allocates the plant store for the given number of plants: one arena, sized up front, from which
+ * every column is carved at a cache-line boundary. Plant ids stay stable for the whole simulation.
+ *
+ * @param count The total number of plants in the fleet.
+ */
+void reservePlantStore(int count)
+{
+    plants.count = 0;
+    plants.reserved = count;
+    plants.arenaSize = plantStoreSize(count);
+    plants.arena = allocateColumn(plants.arenaSize, 1);
+    carvePlantStore(plants.arena, count);
+}
+
+/**
+ * Computes the size of the plant store arena for a number of plants.
+ *
+ * @param count The total number of plants in the fleet.
+ * @return The size of the arena in bytes.
+ */
+size_t plantStoreSize(int count)
+{
+    size_t columnBytes[PLANT_STORE_COLUMNS] = {sizeof(int), sizeof(float), sizeof(float), sizeof(float), sizeof(float),
+                                               sizeof(atomic_int), sizeof(float), sizeof(int), sizeof(unsigned char),
+                                               sizeof(unsigned char), sizeof(unsigned char)};
+    size_t size = 0;
+    for (int c = 0; c < PLANT_STORE_COLUMNS; c++)
+    {
+        size += (columnBytes[c] * count + COLUMN_ALIGNMENT - 1) / COLUMN_ALIGNMENT * COLUMN_ALIGNMENT;
+    }
+    return size;
+}
+
+/**
+ * Points the columns of the plant store into an arena, in a fixed layout that only depends on the
+ * number of plants, so an arena written to a checkpoint can be used again as is.
+ *
+ * @param arena The arena, of plantStoreSize(count) bytes at a cache-line boundary.
+ * @param count The total number of plants in the fleet.
+ */
+void carvePlantStore(void *arena, int count)
+{
+    char *cursor = arena;
+    plants.ordinal = carveColumn(&cursor, count, sizeof(int));
+    plants.capacity = carveColumn(&cursor, count, sizeof(float));
+    plants.minWaterLevel = carveColumn(&cursor, count, sizeof(float));
+    plants.maxWaterLevel = carveColumn(&cursor, count, sizeof(float));
+    plants.waterLevel = carveColumn(&cursor, count, sizeof(float));
+    plants.isActive = carveColumn(&cursor, count, sizeof(atomic_int));
+    plants.rainIncrement = carveColumn(&cursor, count, sizeof(float));
+    plants.rainDuration = carveColumn(&cursor, count, sizeof(int));
+    plants.rainType = carveColumn(&cursor, count, sizeof(unsigned char));
+    plants.classId = carveColumn(&cursor, count, sizeof(unsigned char));
+    plants.regionId = carveColumn(&cursor, count, sizeof(unsigned char));
+}
+
+/**
+ * Carves the next column out of the plant store arena.
+ *
+ * @param cursor The first free byte of the arena, always at a cache-line boundary; advanced past the column.
+ * @param count The number of elements in the column.
+ * @param elementSize The size of each element in bytes.
+ * @return A pointer to the column.
+ */
+void *carveColumn(char **cursor, size_t count, size_t elementSize)
+{
+    void *column = *cursor;
+    *cursor += (count * elementSize + COLUMN_ALIGNMENT - 1) / COLUMN_ALIGNMENT * COLUMN_ALIGNMENT;
+    return column;
+}
+
+/**
+ * Releases the plant store, a single free of its arena, or unmaps the checkpoint it was restored from.
+ */
+void freePlantStore()
+{
+    if (plants.mapping != NULL)
+    {
+        munmap(plants.mapping, plants.mappingSize);
+    }
+    else
+    {
+        free(plants.arena);
+    }
+    memset(&plants, 0, sizeof(plants));
+}
+
+/**
+ * Derives the name of a plant from its class and its ordinal within the class, e.g. ID_3_H1.
+ *
+ * @param plant The id of the plant in the plant store.
+ * @param buffer A buffer of at least PLANT_NAME_SIZE bytes.
+ * @return The buffer holding the name.
+ */
+const char *plantName(int plant, char *buffer)
+{
+    snprintf(buffer, PLANT_NAME_SIZE, "ID_%d_%s", plants.ordinal[plant], plantClasses[plants.classId[plant]].name);
+    return buffer;
+}
+
+/**
+ * Creates and inserts a specified number of hydroelectric plants into the plant store.
+ * Each plant is initialized with the given capacity, minimum and maximum water levels.
+ * The plants are named according to their type and index, ensuring unique identifiers: a type
+ * inserted again, in another region, continues the numbering of its class.
+ *
+ * @param numPlants The number of plants to create.
+ * @param plantType The type of the plant, used as a part of the plant's name.
+ * @param capacity The capacity of each plant in megawatts.
+ * @param minWaterLevel The minimum water level for each plant.
+ * @param maxWaterLevel The maximum water level for each plant.
+ * @param region The index of the region the plants belong to.
+ */
+void createAndInsertPlants(int numPlants, const char *plantType, float capacity, float minWaterLevel, float maxWaterLevel, int region)
+{
+    static int classPlants[MAX_PLANT_CLASSES]; // Plants created so far in each class
+
+    // Register the plant class shared by these plants, unless an earlier region already did
+    int classId = 0;
+    while (classId < numPlantClasses && strcmp(plantClasses[classId].name, plantType) != 0)
+    {
+        classId++;
+    }
+    if (classId == numPlantClasses)
+    {
+        if (numPlantClasses == MAX_PLANT_CLASSES)
+        {
+            fprintf(stderr, "Error: Too many plant classes.\n");
+            exit(-1);
+        }
+        numPlantClasses++;
+        plantClasses[classId] = (PlantClass){"", capacity, minWaterLevel, maxWaterLevel};
+        snprintf(plantClasses[classId].name, PLANT_CLASS_NAME_SIZE, "%s", plantType);
+        classPlants[classId] = 0;
+    }
+
+    for (int i = 0; i < numPlants; ++i)
+    {
+        if (plants.count == plants.reserved)
+        {
+            fprintf(stderr, "Error: The plant store is full.\n");
+            exit(-1);
+        }
+        int plant = plants.count++;
+
+        // Initialize plant properties; the ordinal within the class gives the plant its unique name
+        plants.ordinal[plant] = classPlants[classId]++;
+        plants.capacity[plant] = capacity;
+        plants.minWaterLevel[plant] = minWaterLevel;
+        plants.maxWaterLevel[plant] = maxWaterLevel;
+        plants.waterLevel[plant] = (minWaterLevel + maxWaterLevel) / 2;
+        atomic_init(&plants.isActive[plant], 0);
+        plants.rainIncrement[plant] = NO_RAIN_INCREMENT;
+        plants.rainDuration[plant] = NO_RAIN_DURATION;
+        plants.rainType[plant] = RAIN_NONE;
+        plants.classId[plant] = (unsigned char)classId;
+        plants.regionId[plant] = (unsigned char)region;
+    }
+}
+
+/**
+ * Sets up the regions once the fleet is in the plant store. Each region is the range of consecutive
+ * plants carrying its id, so the fleet must list its regions in order, each one non-empty. Without
+ * --regions there is a single region with the default demand band, or the regions of the checkpoint
+ * being restored. A restored checkpoint also gives back the recovery state, standby pools and loans of
+ * every region. Exits the program if the regions do not match the fleet.
+ */
+void initRegions()
+{
+    const CheckpointRegion *records = NULL;
+    if (restoredCheckpoint != NULL)
+    {
+        records = (const CheckpointRegion *)((const char *)restoredCheckpoint + restoredCheckpoint->regionsOffset);
+        if (regionBandsGiven && numRegions != restoredCheckpoint->numRegions)
+        {
+            fprintf(stderr, "Error: The checkpoint has %d regions, --regions lists %d.\n", restoredCheckpoint->numRegions, numRegions);
+            exit(-1);
+        }
+        numRegions = restoredCheckpoint->numRegions;
+    }
+    for (int r = 0; r < numRegions; r++)
+    {
+        Region *region = &regions[r];
+        if (!regionBandsGiven)
+        {
+            region->minGeneration = records != NULL ? records[r].minGeneration : MIN_GENERATION;
+            region->maxGeneration = records != NULL ? records[r].maxGeneration : MAX_GENERATION;
+        }
+        region->first = region->last = 0;
+    }
+
+    // Ranges of plant ids
+    int previous = 0;
+    for (int plant = 0; plant < plants.count; plant++)
+    {
+        int r = plants.regionId[plant];
+        if (r >= numRegions)
+        {
+            fprintf(stderr, "Error: Plant %d belongs to region %d, but only %d regions are set up (--regions).\n", plant, r + 1, numRegions);
+            exit(-1);
+        }
+        if (r < previous)
+        {
+            fprintf(stderr, "Error: The plants must be grouped by region in ascending order.\n");
+            exit(-1);
+        }
+        if (regions[r].last == 0)
+        {
+            regions[r].first = plant;
+        }
+        regions[r].last = plant + 1;
+        previous = r;
+    }
+
+    // A restored region may only wait for, and hold in standby, plants of its own range
+    const int *pending = records != NULL ? (const int *)((const char *)restoredCheckpoint + restoredCheckpoint->dirtyOffset) : NULL;
+    for (int r = 0; r < numRegions && records != NULL; r++)
+    {
+        bool valid = records[r].dirtyCount <= regions[r].last - regions[r].first;
+        for (int i = 0; valid && i < records[r].dirtyCount; i++)
+        {
+            valid = pending[i] >= regions[r].first && pending[i] < regions[r].last;
+        }
+        for (int i = 0; valid && i < records[r].standbyCount; i++)
+        {
+            valid = records[r].standbyPool[i] >= regions[r].first && records[r].standbyPool[i] < regions[r].last;
+        }
+        if (!valid)
+        {
+            fprintf(stderr, "Error: The checkpoint is damaged: region %d holds plants outside its range.\n", r + 1);
+            exit(-1);
+        }
+        pending += records[r].dirtyCount;
+    }
+
+    for (int r = 0; r < numRegions; r++)
+    {
+        Region *region = &regions[r];
+        int count = region->last - region->first;
+        if (count == 0)
+        {
+            fprintf(stderr, "Error: Region %d has no plants.\n", r + 1);
+            exit(-1);
+        }
+        pthread_mutex_init(&region->dirtyMutex, NULL);
+        pthread_mutex_init(&region->standbyMutex, NULL);
+        pthread_mutex_init(&region->dispatchMutex, NULL);
+        sem_init(&region->adjustmentSemaphore, 0, 0);
+        region->dirtyPlants = malloc(sizeof(int) * count);
+        region->dirtyTimes = malloc(sizeof(unsigned long long) * count);
+        region->adjustmentTimes = malloc(sizeof(unsigned long long) * count);
+        region->exactCandidates = dispatchMode == DISPATCH_EXACT ? malloc(sizeof(int) * count) : NULL;
+        region->exactSpares = dispatchMode == DISPATCH_EXACT && lookaheadHorizon > 0 ? malloc(sizeof(int) * count) : NULL;
+        region->exactEligible = dispatchMode == DISPATCH_EXACT ? malloc(sizeof(int) * count) : NULL;
+        if (region->dirtyPlants == NULL || region->dirtyTimes == NULL || region->adjustmentTimes == NULL ||
+            (dispatchMode == DISPATCH_EXACT && (region->exactCandidates == NULL || region->exactEligible == NULL)) ||
+            (dispatchMode == DISPATCH_EXACT && lookaheadHorizon > 0 && region->exactSpares == NULL))
+        {
+            fprintf(stderr, "Error: Could not allocate memory for the regions.\n");
+            exit(-1);
+        }
+        region->dirtyCount = 0;
+        region->adjustmentPending = false;
+
+        // Generation of the plants already active, which only a restored fleet has
+        long long kilowatts = 0;
+        for (int plant = region->first; plant < region->last; plant++)
+        {
+            kilowatts += atomic_load_explicit(&plants.isActive[plant], memory_order_relaxed) ? capacityKilowatts(plant) : 0;
+        }
+        atomic_init(&region->generatedKilowatts, kilowatts);
+        atomic_fetch_add(&generatedKilowatts, kilowatts);
+        atomic_init(&region->importedKilowatts, 0);
+        atomic_init(&region->exportedKilowatts, 0);
+
+        atomic_init(&region->lastShots, records != NULL ? records[r].lastShots : recoveryBudget);
+        atomic_init(&region->waitingForRecover, records != NULL && records[r].waitingForRecover != 0);
+        atomic_init(&region->retryTick, records != NULL ? records[r].retryTick : 0);
+        region->retryScheduledAt = monotonicNanos();
+        region->inBandTicks = records != NULL ? records[r].inBandTicks : 0;
+        region->blackoutTicks = records != NULL ? records[r].blackoutTicks : 0;
+        region->recoveringTicks = records != NULL ? records[r].recoveringTicks : 0;
+        region->standbyCount = records != NULL ? records[r].standbyCount : 0;
+        region->standbyNext = records != NULL ? records[r].standbyNext : 0;
+        if (records != NULL)
+        {
+            memcpy(region->standbyPool, records[r].standbyPool, sizeof(int) * region->standbyCount);
+        }
+    }
+
+    // Loans between regions
+    pthread_mutex_init(&transferMutex, NULL);
+    memset(transferKilowatts, 0, sizeof(transferKilowatts));
+    if (restoredCheckpoint != NULL)
+    {
+        const long long *loans = (const long long *)((const char *)restoredCheckpoint + restoredCheckpoint->transfersOffset);
+        for (int lender = 0; lender < numRegions; lender++)
+        {
+            for (int borrower = 0; borrower < numRegions; borrower++)
+            {
+                long long loan = loans[lender * numRegions + borrower];
+                transferKilowatts[lender][borrower] = loan;
+                atomic_fetch_add(&regions[lender].exportedKilowatts, loan);
+                atomic_fetch_add(&regions[borrower].importedKilowatts, loan);
+            }
+        }
+    }
+}
+
+/**
+ * Releases the locks, semaphores and dirty sets of the regions.
+ */
+void freeRegions()
+{
+    for (int r = 0; r < numRegions; r++)
+    {
+        Region *region = &regions[r];
+        sem_destroy(&region->adjustmentSemaphore);
+        pthread_mutex_destroy(&region->dirtyMutex);
+        pthread_mutex_destroy(&region->standbyMutex);
+        pthread_mutex_destroy(&region->dispatchMutex);
+        free(region->dirtyPlants);
+        free(region->dirtyTimes);
+        free(region->adjustmentTimes);
+        free(region->exactCandidates);
+        free(region->exactSpares);
+        free(region->exactEligible);
+        region->dirtyPlants = region->exactCandidates = region->exactSpares = region->exactEligible = NULL;
+        region->dirtyTimes = region->adjustmentTimes = NULL;
+    }
+    pthread_mutex_destroy(&transferMutex);
+}
+
+/**
+ * Returns the generation a region counts towards its demand band: that of its active plants, plus what
+ * it borrows from other regions, minus what it lends to them.
+ *
+ * @param region The region.
+ * @return The generation in MW/s.
+ */
+float regionGeneration(const Region *region)
+{
+    return (float)(atomic_load(&region->generatedKilowatts) + atomic_load(&region->importedKilowatts) -
+                   atomic_load(&region->exportedKilowatts)) /
+           1000.0f;
+}
+
+/**
+ * Returns the part of a plant priority heap that belongs to a region. Every region is a heap of its
+ * own over its range of slots, with positions relative to the range, so the view can be sifted and
+ * walked like a whole heap. Keys and positions stay indexed by plant id.
+ *
+ * @param region The region.
+ * @param heap The working heap or a published order.
+ * @return The heap of the region.
+ */
+PlantHeap regionHeap(const Region *region, const PlantHeap *heap)
+{
+    return (PlantHeap){region->last - region->first, heap->slots + region->first, heap->position, heap->key};
+}
+
+/**
+ * Returns the part of the class order that holds the plants of one class of a region. Like the region
+ * heaps of the plant order, every class of every region is a heap of its own over its range of slots.
+ *
+ * @param region The region.
+ * @param classId The plant class.
+ * @param heap The working class order or a published one.
+ * @return The heap of the class within the region.
+ */
+PlantHeap classHeap(const Region *region, int classId, const PlantHeap *heap)
+{
+    return (PlantHeap){region->classFirst[classId + 1] - region->classFirst[classId], heap->slots + region->classFirst[classId],
+                       heap->position, heap->key};
+}
+
+/**
+ * Dispatch loop of a region with the wall clock: waits for the engine to post the region's adjustment
+ * semaphore and handles each adjustment, until shutdown.
+ *
+ * @param region The region to dispatch.
+ */
+void dispatchLoop(Region *region)
+{
+    while (!shutdownRequested)
+    {
+        if (sem_wait(&region->adjustmentSemaphore) != 0)
+        {
+            continue; // Interrupted by a signal
+        }
+        if (shutdownRequested)
+        {
+            break;
+        }
+        handleAdjustment(region);
+    }
+}
+
+/**
+ * The routine for the dispatch thread of every region but the first, whose loop runs on the main thread.
+ *
+ * @param arg A pointer to the Region to dispatch.
+ * @return Returns NULL upon completion.
+ */
+void *regionDispatchRoutine(void *arg)
+{
+    dispatchLoop((Region *)arg);
+    pthread_exit(NULL); // Clean up and orderly exit the thread
+    return NULL;
+}
+
+/**
+ * Covers the deficit of a region below its minimum generation with loans from the surplus of the
+ * other regions, above their own minimum, in region order. The generation lent by one region to
+ * another never exceeds --transfer-limit.
+ *
+ * @param region The region short of its minimum generation.
+ * @return true if the region reaches its minimum generation.
+ */
+bool borrowGeneration(Region *region)
+{
+    int borrower = (int)(region - regions);
+    long long limit = llroundf(transferLimit * 1000.0f);
+    lockMutex(&transferMutex);
+    for (int lender = 0; lender < numRegions && regionGeneration(region) < region->minGeneration; lender++)
+    {
+        Region *source = &regions[lender];
+        if (lender == borrower)
+        {
+            continue;
+        }
+        long long deficit = llroundf(region->minGeneration * 1000.0f) - (atomic_load(&region->generatedKilowatts) +
+                            atomic_load(&region->importedKilowatts) - atomic_load(&region->exportedKilowatts));
+        long long surplus = atomic_load(&source->generatedKilowatts) + atomic_load(&source->importedKilowatts) -
+                            atomic_load(&source->exportedKilowatts) - llroundf(source->minGeneration * 1000.0f);
+        long long loan = limit - transferKilowatts[lender][borrower];
+        loan = loan < surplus ? loan : surplus;
+        loan = loan < deficit ? loan : deficit;
+        if (loan <= 0)
+        {
+            continue;
+        }
+        transferKilowatts[lender][borrower] += loan;
+        atomic_fetch_add(&source->exportedKilowatts, loan);
+        atomic_fetch_add(&region->importedKilowatts, loan);
+        transfers++;
+        logEvent(LOG_EVENT_TRANSFER, -1, lender * MAX_REGIONS + borrower, (float)loan / 1000.0f, regionGeneration(region));
+    }
+    pthread_mutex_unlock(&transferMutex);
+    return regionGeneration(region) >= region->minGeneration;
+}
+
+/**
+ * Returns every loan a region holds to its lenders, before the region dispatches its own plants again.
+ *
+ * @param region The borrowing region.
+ */
+void releaseImports(Region *region)
+{
+    int borrower = (int)(region - regions);
+    if (atomic_load(&region->importedKilowatts) == 0)
+    {
+        return;
+    }
+    lockMutex(&transferMutex);
+    for (int lender = 0; lender < numRegions; lender++)
+    {
+        long long loan = transferKilowatts[lender][borrower];
+        transferKilowatts[lender][borrower] = 0;
+        atomic_fetch_sub(&regions[lender].exportedKilowatts, loan);
+        atomic_fetch_sub(&region->importedKilowatts, loan);
+    }
+    pthread_mutex_unlock(&transferMutex);
+}
+
+/**
+ * Loads the fleet from a CSV file straight into the plant store. Each data row reads
+ *     class,capacity,min_level,max_level[,initial_level[,count[,region]]]
+ * and stands for count plants (default 1) of the given class, starting at initial_level (default: the
+ * middle of the band), in the given region (default 1). Rows of the same class must agree on capacity
+ * and levels, and the rows of a region must come after those of the regions before it. Blank lines,
+ * lines starting with '#' and a header line starting with "class" are skipped.
+ * The file is mapped into memory and cut into slices at line boundaries, parsed by one thread each in
+ * two passes: the first counts the plants and classes of every slice, the second writes each slice's
+ * plants to the columns from its own first plant id. Exits the program if the file is invalid.
+ *
+ * @param path The path of the fleet file.
+ */
+void loadFleetFile(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+        fprintf(stderr, "Error: Could not open the fleet file %s.\n", path);
+        exit(-1);
+    }
+    size_t size = (size_t)info.st_size;
+    const char *data = size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        fprintf(stderr, "Error: Could not map the fleet file %s.\n", path);
+        exit(-1);
+    }
+    if (size > 0)
+    {
+        madvise((void *)data, size, MADV_SEQUENTIAL);
+    }
+
+    // Cut the file into slices that start at line starts
+    int threads = numWorkers > 0 ? numWorkers : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int numChunks = (int)(size / FLEET_CHUNK_MIN_BYTES) + 1;
+    numChunks = numChunks < threads ? numChunks : threads;
+    FleetChunk *chunks = calloc(numChunks, sizeof(FleetChunk));
+    pthread_t *loaders = malloc(sizeof(pthread_t) * numChunks);
+    if (chunks == NULL || loaders == NULL)
+    {
+        fprintf(stderr, "Error: Could not allocate memory for the fleet loader.\n");
+        exit(-1);
+    }
+    const char *cursor = data;
+    for (int c = 0; c < numChunks; c++)
+    {
+        const char *end = c == numChunks - 1 ? data + size : data + size * (c + 1) / numChunks;
+        end = end > cursor ? end : cursor;
+        while (end < data + size && end[-1] != '\n')
+        {
+            end++;
+        }
+        chunks[c].begin = cursor;
+        chunks[c].end = end;
+        cursor = end;
+    }
+
+    // First pass: count the plants and collect the classes of every slice
+    for (int c = 0; c < numChunks; c++)
+    {
+        pthread_create(&loaders[c], NULL, scanFleetChunk, &chunks[c]);
+    }
+    for (int c = 0; c < numChunks; c++)
+    {
+        pthread_join(loaders[c], NULL);
+    }
+
+    // Merge the classes in file order, and give each slice its first plant id and per-class ordinals
+    long plantCount = 0;
+    long classPlants[MAX_PLANT_CLASSES] = {0};
+    int line = 1;
+    for (int c = 0; c < numChunks; c++)
+    {
+        FleetChunk *chunk = &chunks[c];
+        if (chunk->errorLine >= 0)
+        {
+            fprintf(stderr, "Error: %s:%d: %s.\n", path, line + chunk->errorLine, chunk->error);
+            exit(-1);
+        }
+        for (int k = 0; k < chunk->classCount; k++)
+        {
+            const FleetRow *row = &chunk->classes[k];
+            int g = 0;
+            while (g < numPlantClasses && ((int)strlen(plantClasses[g].name) != row->classNameLength ||
+                                           memcmp(plantClasses[g].name, row->className, row->classNameLength) != 0))
+            {
+                g++;
+            }
+            if (g == numPlantClasses)
+            {
+                if (numPlantClasses == MAX_PLANT_CLASSES)
+                {
+                    fprintf(stderr, "Error: %s: More than %d plant classes.\n", path, MAX_PLANT_CLASSES);
+                    exit(-1);
+                }
+                numPlantClasses++;
+                plantClasses[g] = (PlantClass){"", row->capacity, row->minWaterLevel, row->maxWaterLevel};
+                memcpy(plantClasses[g].name, row->className, row->classNameLength);
+                plantClasses[g].name[row->classNameLength] = '\0';
+            }
+            else if (plantClasses[g].capacity != row->capacity || plantClasses[g].minWaterLevel != row->minWaterLevel ||
+                     plantClasses[g].maxWaterLevel != row->maxWaterLevel)
+            {
+                fprintf(stderr, "Error: %s: Rows of class %s disagree on capacity or water levels.\n", path, plantClasses[g].name);
+                exit(-1);
+            }
+            chunk->globalClass[k] = g;
+            chunk->firstOrdinal[k] = classPlants[g];
+            classPlants[g] += chunk->classPlants[k];
+        }
+        chunk->firstPlant = plantCount;
+        plantCount += chunk->plantCount;
+        line += chunk->lines;
+    }
+    if (plantCount > INT_MAX)
+    {
+        fprintf(stderr, "Error: %s: Too many plants.\n", path);
+        exit(-1);
+    }
+
+    // Second pass: write the plants of every slice to the store
+    reservePlantStore((int)plantCount);
+    for (int c = 0; c < numChunks; c++)
+    {
+        pthread_create(&loaders[c], NULL, fillFleetChunk, &chunks[c]);
+    }
+    for (int c = 0; c < numChunks; c++)
+    {
+        pthread_join(loaders[c], NULL);
+    }
+    plants.count = (int)plantCount;
+
+    free(loaders);
+    free(chunks);
+    if (size > 0)
+    {
+        munmap((void *)data, size);
+    }
+}
+
+/**
+ * First pass of the fleet loader over one slice: validates every row, counts the lines and plants
+ * and records the classes in order of first appearance. Stops at the first invalid row.
+ *
+ * @param arg The FleetChunk to scan.
+ * @return Returns NULL upon completion.
+ */
+void *scanFleetChunk(void *arg)
+{
+    FleetChunk *chunk = arg;
+    chunk->errorLine = -1;
+    const char *cursor = chunk->begin;
+    while (cursor < chunk->end)
+    {
+        FleetRow row;
+        bool isData;
+        const char *error;
+        if (!parseFleetRow(&cursor, chunk->end, &row, &isData, &error))
+        {
+            chunk->errorLine = chunk->lines;
+            chunk->error = error;
+            return NULL;
+        }
+        chunk->lines++;
+        if (!isData)
+        {
+            continue;
+        }
+        int k = findFleetClass(chunk, &row);
+        if (k < 0)
+        {
+            chunk->errorLine = chunk->lines - 1;
+            chunk->error = "Too many plant classes";
+            return NULL;
+        }
+        const FleetRow *known = &chunk->classes[k];
+        if (known->capacity != row.capacity || known->minWaterLevel != row.minWaterLevel || known->maxWaterLevel != row.maxWaterLevel)
+        {
+            chunk->errorLine = chunk->lines - 1;
+            chunk->error = "Rows of the same class disagree on capacity or water levels";
+            return NULL;
+        }
+        chunk->classPlants[k] += row.count;
+        chunk->plantCount += row.count;
+    }
+    return NULL;
+}
+
+/**
+ * Second pass of the fleet loader over one slice: writes its plants to the store from the slice's first
+ * plant id, naming each plant after its class and its ordinal within the class.
+ *
+ * @param arg The FleetChunk to fill, scanned and merged.
+ * @return Returns NULL upon completion.
+ */
+void *fillFleetChunk(void *arg)
+{
+    FleetChunk *chunk = arg;
+    long ordinal[MAX_PLANT_CLASSES];
+    memcpy(ordinal, chunk->firstOrdinal, sizeof(long) * chunk->classCount);
+    int plant = (int)chunk->firstPlant;
+    const char *cursor = chunk->begin;
+    while (cursor < chunk->end)
+    {
+        FleetRow row;
+        bool isData;
+        const char *error;
+        parseFleetRow(&cursor, chunk->end, &row, &isData, &error); // Validated by the first pass
+        if (!isData)
+        {
+            continue;
+        }
+        int k = findFleetClass(chunk, &row);
+        int classId = chunk->globalClass[k];
+        float waterLevel = isnan(row.waterLevel) ? (row.minWaterLevel + row.maxWaterLevel) / 2 : row.waterLevel;
+        for (long i = 0; i < row.count; i++, plant++)
+        {
+            plants.ordinal[plant] = (int)ordinal[k]++;
+            plants.capacity[plant] = row.capacity;
+            plants.minWaterLevel[plant] = row.minWaterLevel;
+            plants.maxWaterLevel[plant] = row.maxWaterLevel;
+            plants.waterLevel[plant] = waterLevel;
+            atomic_init(&plants.isActive[plant], 0);
+            plants.rainIncrement[plant] = NO_RAIN_INCREMENT;
+            plants.rainDuration[plant] = NO_RAIN_DURATION;
+            plants.rainType[plant] = RAIN_NONE;
+            plants.classId[plant] = (unsigned char)classId;
+            plants.regionId[plant] = (unsigned char)row.region;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Parses one line of a fleet file and moves the cursor to the start of the next line.
+ *
+ * @param cursor The position of the line start, advanced past the line.
+ * @param end The end of the slice being parsed.
+ * @param row The row parsed from a data line.
+ * @param isData Set to false for blank, comment and header lines.
+ * @param error The reason the line is invalid.
+ * @return false if the line is invalid.
+ */
+bool parseFleetRow(const char **cursor, const char *end, FleetRow *row, bool *isData, const char **error)
+{
+    const char *line = *cursor;
+    const char *lineEnd = memchr(line, '\n', end - line);
+    lineEnd = lineEnd != NULL ? lineEnd : end;
+    *cursor = lineEnd < end ? lineEnd + 1 : end;
+    if (lineEnd > line && lineEnd[-1] == '\r')
+    {
+        lineEnd--;
+    }
+
+    // Class name, the first field
+    const char *field = line;
+    while (field < lineEnd && (*field == ' ' || *field == '\t'))
+    {
+        field++;
+    }
+    const char *fieldEnd = field;
+    while (fieldEnd < lineEnd && *fieldEnd != ',')
+    {
+        fieldEnd++;
+    }
+    const char *nameEnd = fieldEnd;
+    while (nameEnd > field && (nameEnd[-1] == ' ' || nameEnd[-1] == '\t'))
+    {
+        nameEnd--;
+    }
+    *isData = !(field == lineEnd || *field == '#' || (nameEnd - field == 5 && memcmp(field, "class", 5) == 0));
+    if (!*isData)
+    {
+        return true;
+    }
+    if (nameEnd == field || nameEnd - field >= PLANT_CLASS_NAME_SIZE)
+    {
+        *error = "The class name must have 1 to 31 characters";
+        return false;
+    }
+    row->className = field;
+    row->classNameLength = (int)(nameEnd - field);
+
+    // Numeric fields: capacity, minimum and maximum levels, then the optional initial level, count and region
+    double values[6];
+    int fields = 0;
+    const char *position = fieldEnd;
+    while (position < lineEnd && fields < 6)
+    {
+        position++; // Skip the comma
+        const char *start = position;
+        if (!parseFleetNumber(&position, lineEnd, &values[fields]))
+        {
+            while (start < lineEnd && (*start == ' ' || *start == '\t'))
+            {
+                start++;
+            }
+            if (fields == 3 && (start == lineEnd || *start == ','))
+            {
+                values[fields++] = NAN; // Empty initial level
+                position = start;
+                continue;
+            }
+            *error = "Expected a number";
+            return false;
+        }
+        fields++;
+        while (position < lineEnd && (*position == ' ' || *position == '\t'))
+        {
+            position++;
+        }
+        if (position < lineEnd && *position != ',')
+        {
+            *error = "Expected a comma";
+            return false;
+        }
+    }
+    if (fields < 3 || position < lineEnd)
+    {
+        *error = "Expected class,capacity,min_level,max_level[,initial_level[,count[,region]]]";
+        return false;
+    }
+    row->capacity = (float)values[0];
+    row->minWaterLevel = (float)values[1];
+    row->maxWaterLevel = (float)values[2];
+    row->waterLevel = fields > 3 ? (float)values[3] : NAN;
+    row->count = fields > 4 ? (long)values[4] : 1;
+    row->region = fields > 5 ? (int)values[5] - 1 : 0;
+
+    if (!(row->capacity > 0.0f) || !(row->minWaterLevel < row->maxWaterLevel))
+    {
+        *error = "The capacity must be positive and the minimum level below the maximum level";
+        return false;
+    }
+    if (!isnan(row->waterLevel) && (row->waterLevel < row->minWaterLevel || row->waterLevel > row->maxWaterLevel))
+    {
+        *error = "The initial level must lie between the minimum and maximum levels";
+        return false;
+    }
+    if (fields > 4 && (values[4] < 1.0 || values[4] > INT_MAX || values[4] != (double)row->count))
+    {
+        *error = "The count must be a positive whole number";
+        return false;
+    }
+    if (fields > 5 && (values[5] < 1.0 || values[5] > MAX_REGIONS || values[5] != (double)(row->region + 1)))
+    {
+        *error = "The region must be a whole number from 1 to 64";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Parses a decimal number, with optional sign, fraction and exponent, without reading past the end of
+ * the line; the mapped file is not NUL-terminated, so strtod cannot be used.
+ *
+ * @param cursor The position of the number, leading blanks allowed, advanced past it.
+ * @param end The end of the line.
+ * @param value The number parsed.
+ * @return false if there is no number at the cursor.
+ */
+bool parseFleetNumber(const char **cursor, const char *end, double *value)
+{
+    const char *p = *cursor;
+    while (p < end && (*p == ' ' || *p == '\t'))
+    {
+        p++;
+    }
+    double sign = 1.0;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        sign = *p == '-' ? -1.0 : 1.0;
+        p++;
+    }
+    double mantissa = 0.0;
+    int exponent = 0;
+    int digits = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++, digits++)
+    {
+        mantissa = mantissa * 10.0 + (*p - '0');
+    }
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++)
+        {
+            mantissa = mantissa * 10.0 + (*p - '0');
+            exponent--;
+        }
+    }
+    if (digits == 0)
+    {
+        return false;
+    }
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char *q = p + 1;
+        int exponentSign = 1;
+        if (q < end && (*q == '-' || *q == '+'))
+        {
+            exponentSign = *q == '-' ? -1 : 1;
+            q++;
+        }
+        int explicitExponent = 0;
+        const char *first = q;
+        for (; q < end && *q >= '0' && *q <= '9' && explicitExponent < 10000; q++)
+        {
+            explicitExponent = explicitExponent * 10 + (*q - '0');
+        }
+        if (q > first)
+        {
+            exponent += exponentSign * explicitExponent;
+            p = q;
+        }
+    }
+    *value = sign * mantissa * pow(10.0, exponent);
+    *cursor = p;
+    return true;
+}
+
+/**
+ * Finds the local class of a row in a slice, registering it on first sight.
+ *
+ * @param chunk The slice being parsed.
+ * @param row The row whose class is looked up; its levels and capacity define a new class.
+ * @return The local class index, or -1 if the slice already holds MAX_PLANT_CLASSES classes.
+ */
+int findFleetClass(FleetChunk *chunk, const FleetRow *row)
+{
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < row->classNameLength; i++)
+    {
+        hash = (hash ^ (unsigned char)row->className[i]) * 16777619u;
+    }
+    for (unsigned int slot = hash & (FLEET_CLASS_SLOTS - 1);; slot = (slot + 1) & (FLEET_CLASS_SLOTS - 1))
+    {
+        int k = chunk->slots[slot] - 1;
+        if (k < 0)
+        {
+            if (chunk->classCount == MAX_PLANT_CLASSES)
+            {
+                return -1;
+            }
+            k = chunk->classCount++;
+            chunk->classes[k] = *row;
+            chunk->slots[slot] = (short)(k + 1);
+            return k;
+        }
+        const FleetRow *known = &chunk->classes[k];
+        if (known->classNameLength == row->classNameLength && memcmp(known->className, row->className, row->classNameLength) == 0)
+        {
+            return k;
+        }
+    }
+}
+
+/**
+ * Reads the CPU topology of the machine from sysfs and applies the placement policy that does not
+ * depend on the fleet: the dispatch and sorting cores are set aside, every hardware thread of them
+ * included, and the worker count defaults to the CPUs left. Without sysfs every CPU is taken as its
+ * own core on node 0.
+ */
+void initPlacement()
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0)
+    {
+        CPU_SET(0, &allowed);
+    }
+    cpus = calloc(CPU_COUNT(&allowed), sizeof(CpuInfo));
+    if (cpus == NULL)
+    {
+        fprintf(stderr, "Error: Could not allocate memory for the CPU topology.\n");
+        exit(-1);
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &allowed))
+        {
+            CpuInfo *info = &cpus[numCpus++];
+            info->cpu = cpu;
+            info->package = readSysfsNumber("/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu, 0);
+            info->core = readSysfsNumber("/sys/devices/system/cpu/cpu%d/topology/core_id", cpu, cpu);
+            info->node = readCpuNode(cpu);
+            numNodes = info->node >= numNodes ? info->node + 1 : numNodes;
+            for (int other = 0; other < numCpus - 1; other++)
+            {
+                info->sibling = info->sibling || (cpus[other].package == info->package && cpus[other].core == info->core);
+            }
+        }
+    }
+    qsort(cpus, numCpus, sizeof(CpuInfo), compareCpus);
+
+    if (placementPolicy == PLACEMENT_NONE)
+    {
+        numWorkers = numWorkers > 0 ? numWorkers : numCpus;
+        return;
+    }
+
+    // The last primary threads of the first node run dispatch, then sorting; their siblings stay idle
+    int primaries = 0;
+    for (int c = 0; c < numCpus; c++)
+    {
+        primaries += !cpus[c].sibling;
+    }
+    int reserve = reservedCores >= 0 ? reservedCores : (primaries >= RESERVED_CORES_MIN_CORES ? 2 : 0);
+    for (int c = numCpus - 1; c >= 0 && reserve > 0; c--)
+    {
+        if (cpus[c].node != cpus[0].node || cpus[c].sibling || c == 0)
+        {
+            continue;
+        }
+        for (int other = 0; other < numCpus; other++)
+        {
+            cpus[other].reserved = cpus[other].reserved || (cpus[other].package == cpus[c].package && cpus[other].core == cpus[c].core);
+        }
+        sortingCpu = cpus[c].cpu;
+        dispatchCpu = dispatchCpu < 0 ? cpus[c].cpu : dispatchCpu;
+        reserve--;
+    }
+
+    int available = 0;
+    for (int c = 0; c < numCpus; c++)
+    {
+        available += !cpus[c].reserved;
+    }
+    numWorkers = numWorkers > 0 ? numWorkers : available;
+}
+
+/**
+ * Reads a number from a sysfs file of a CPU.
+ *
+ * @param format The path of the file, with a %d for the CPU.
+ * @param cpu The CPU.
+ * @param fallback The value returned if the file cannot be read.
+ * @return The number in the file, or fallback.
+ */
+int readSysfsNumber(const char *format, int cpu, int fallback)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), format, cpu);
+    FILE *file = fopen(path, "r");
+    int value = fallback;
+    if (file != NULL)
+    {
+        if (fscanf(file, "%d", &value) != 1)
+        {
+            value = fallback;
+        }
+        fclose(file);
+    }
+    return value;
+}
+
+/**
+ * Finds the NUMA node of a CPU from the nodeN link in its sysfs directory.
+ *
+ * @param cpu The CPU.
+ * @return The node of the CPU, 0 if the kernel does not report one.
+ */
+int readCpuNode(int cpu)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *directory = opendir(path);
+    int node = 0;
+    if (directory != NULL)
+    {
+        struct dirent *entry;
+        while ((entry = readdir(directory)) != NULL)
+        {
+            if (sscanf(entry->d_name, "node%d", &node) == 1)
+            {
+                break;
+            }
+            node = 0;
+        }
+        closedir(directory);
+    }
+    return node;
+}
+
+/**
+ * Orders CPUs by NUMA node, then primary hardware threads before their siblings, then CPU number,
+ * so that taking CPUs from the front fills every physical core of a node before doubling up.
+ *
+ * @param a The first CpuInfo.
+ * @param b The second CpuInfo.
+ * @return A negative number, zero or a positive number as a comes before, with or after b.
+ */
+int compareCpus(const void *a, const void *b)
+{
+    const CpuInfo *first = a, *second = b;
+    if (first->node != second->node)
+    {
+        return first->node - second->node;
+    }
+    if (first->sibling != second->sibling)
+    {
+        return first->sibling - second->sibling;
+    }
+    return first->cpu - second->cpu;
+}
+
+/**
+ * Assigns a CPU and a NUMA node to every worker. With spread placement the workers are shared out
+ * across the nodes in proportion to their CPUs, in node order, so the contiguous slices of the workers
+ * of a node form that node's shard of the fleet. With compact placement they take the CPUs in order,
+ * filling a node first. Workers beyond the CPUs available wrap around.
+ */
+void assignWorkerCpus()
+{
+    int available = 0;
+    int *order = malloc(sizeof(int) * (numCpus > 0 ? numCpus : 1)); // Indexes of the unreserved CPUs
+    if (order == NULL)
+    {
+        fprintf(stderr, "Error: Could not allocate memory for the CPU topology.\n");
+        exit(-1);
+    }
+    for (int c = 0; c < numCpus; c++)
+    {
+        if (!cpus[c].reserved)
+        {
+            order[available++] = c;
+        }
+    }
+
+    for (int w = 0; w < numWorkers; w++)
+    {
+        workers[w].cpu = -1;
+        workers[w].node = 0;
+        if (placementPolicy == PLACEMENT_NONE || available == 0)
+        {
+            continue;
+        }
+        int slot = w % available;
+        if (placementPolicy == PLACEMENT_SPREAD)
+        {
+            // Find the node whose share of the workers holds w, then w's place among that node's CPUs
+            int begin = 0;
+            while (begin < available)
+            {
+                int end = begin;
+                while (end < available && cpus[order[end]].node == cpus[order[begin]].node)
+                {
+                    end++;
+                }
+                int firstWorker = (int)((long)numWorkers * begin / available);
+                int lastWorker = (int)((long)numWorkers * end / available);
+                if (w < lastWorker)
+                {
+                    slot = begin + (w - firstWorker) % (end - begin);
+                    break;
+                }
+                begin = end;
+            }
+        }
+        workers[w].cpu = cpus[order[slot]].cpu;
+        workers[w].node = cpus[order[slot]].node;
+    }
+    free(order);
+}
+
+/**
+ * Gives the CPUs a thread of the given role may run on.
+ *
+ * @param role The ROLE_* of the thread.
+ * @param worker The index of the worker, for ROLE_WORKER.
+ * @param set Output, the CPUs of the thread.
+ * @return Whether the thread is pinned at all; false leaves it to the scheduler.
+ */
+bool placementCpus(int role, int worker, cpu_set_t *set)
+{
+    CPU_ZERO(set);
+    if (placementPolicy == PLACEMENT_NONE)
+    {
+        return false;
+    }
+    switch (role)
+    {
+    case ROLE_WORKER:
+        if (workers[worker].cpu >= 0)
+        {
+            CPU_SET(workers[worker].cpu, set);
+        }
+        break;
+    case ROLE_DISPATCH:
+        if (dispatchCpu >= 0)
+        {
+            CPU_SET(dispatchCpu, set);
+        }
+        break;
+    case ROLE_SORTING:
+        if (sortingCpu >= 0)
+        {
+            CPU_SET(sortingCpu, set);
+        }
+        break;
+    default:
+        // The service threads mostly sleep; they share the reserved cores, siblings included
+        for (int c = 0; c < numCpus; c++)
+        {
+            if (cpus[c].reserved)
+            {
+                CPU_SET(cpus[c].cpu, set);
+            }
+        }
+        break;
+    }
+    return CPU_COUNT(set) > 0;
+}
+
+/**
+ * Pins the thread about to be created with the given attributes according to its role.
+ *
+ * @param attr The attributes of the thread.
+ * @param role The ROLE_* of the thread.
+ * @param worker The index of the worker, for ROLE_WORKER.
+ */
+void placeThread(pthread_attr_t *attr, int role, int worker)
+{
+    cpu_set_t set;
+    if (placementCpus(role, worker, &set))
+    {
+        pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+    }
+}
+
+/**
+ * Moves the slice of every worker, in each plant store column and fleet snapshot, to the memory of the
+ * worker's NUMA node. The fleet is built before the workers exist, so the pages the builder already
+ * touched are migrated; pages touched later follow the same policy. Only needed with several nodes.
+ */
+void placeFleetMemory()
+{
+    if (placementPolicy == PLACEMENT_NONE || numNodes < 2)
+    {
+        return;
+    }
+    for (int w = 0; w < numWorkers; w++)
+    {
+        int first = workers[w].first, count = workers[w].last - workers[w].first, node = workers[w].node;
+        bindToNode(plants.ordinal + first, sizeof(int) * count, node);
+        bindToNode(plants.capacity + first, sizeof(float) * count, node);
+        bindToNode(plants.minWaterLevel + first, sizeof(float) * count, node);
+        bindToNode(plants.maxWaterLevel + first, sizeof(float) * count, node);
+        bindToNode(plants.waterLevel + first, sizeof(float) * count, node);
+        bindToNode(plants.isActive + first, sizeof(atomic_int) * count, node);
+        bindToNode(plants.rainIncrement + first, sizeof(float) * count, node);
+        bindToNode(plants.rainDuration + first, sizeof(int) * count, node);
+        bindToNode(plants.rainType + first, count, node);
+        bindToNode(plants.classId + first, count, node);
+        bindToNode(plants.regionId + first, count, node);
+        for (int b = 0; b < SNAPSHOT_BUFFERS; b++)
+        {
+            FleetSnapshot *snapshot = fleetSnapshots.buffers[b];
+            bindToNode(snapshot->waterLevel + first, sizeof(float) * count, node);
+            bindToNode(snapshot->isActive + first, sizeof(int) * count, node);
+            if (snapshot->rainDuration != NULL)
+            {
+                bindToNode(snapshot->rainIncrement + first, sizeof(float) * count, node);
+                bindToNode(snapshot->rainDuration + first, sizeof(int) * count, node);
+            }
+        }
+        if (scheduleMode == SCHEDULE_EVENT)
+        {
+            bindToNode(wakeTicks + first, sizeof(unsigned long) * count, node);
+            bindToNode(timerNext + first, sizeof(int) * count, node);
+            bindToNode(timerPrev + first, sizeof(int) * count, node);
+            bindToNode(timerSlot + first, sizeof(int) * count, node);
+        }
+    }
+}
+
+/**
+ * Prefers a NUMA node for the whole pages of a range of memory and migrates the pages already there.
+ * Best effort: a kernel without NUMA support or a failed migration leaves the memory where it is.
+ *
+ * @param address The start of the range.
+ * @param bytes The size of the range; partial pages at either end are left alone.
+ * @param node The NUMA node.
+ */
+void bindToNode(void *address, size_t bytes, int node)
+{
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t begin = ((uintptr_t)address + page - 1) / page * page;
+    uintptr_t end = ((uintptr_t)address + bytes) / page * page;
+    unsigned long nodes[4] = {0}; // Up to 256 nodes
+    if (end <= begin || node >= (int)(sizeof(nodes) * CHAR_BIT))
+    {
+        return;
+    }
+    nodes[node / (sizeof(unsigned long) * CHAR_BIT)] |= 1UL << (node % (sizeof(unsigned long) * CHAR_BIT));
+    syscall(SYS_mbind, begin, end - begin, MEMORY_POLICY_PREFERRED, nodes, sizeof(nodes) * CHAR_BIT, MEMORY_POLICY_MOVE);
+}
+
+/**
+ * Starts the simulation engine: a fixed pool of worker threads, each owning a contiguous slice of the
+ * fleet, and a clock thread that drives the shared global tick. Workers are pinned by the placement
+ * policy and their slices moved to the memory of their NUMA node, so the thread count depends on the
+ * machine and not on the fleet size. With event scheduling the schedule of every slice is built from
+ * the current plant states, so a restored fleet needs none stored in its checkpoint.
+ */
+void startEngine()
+{
+    if (numWorkers > plants.count && plants.count > 0)
+    {
+        numWorkers = plants.count; // Never keep idle workers around
+    }
+
+    workers = calloc(numWorkers, sizeof(EngineWorker));
+    if (workers == NULL)
+    {
+        fprintf(stderr, "Error: Could not allocate memory for the engine workers.\n");
+        exit(-1);
+    }
+
+    // The clock thread (or the main thread with the virtual clock) takes part in both barriers alongside the workers
+    pthread_barrier_init(&tickStartBarrier, NULL, numWorkers + 1);
+    pthread_barrier_init(&tickEndBarrier, NULL, numWorkers + 1);
+
+    assignWorkerCpus();
+    for (int w = 0; w < numWorkers; w++)
+    {
+        // Slice boundaries fall on batch boundaries so workers never share a cache line of a column
+        int batches = (plants.count + PLANT_BATCH_SIZE - 1) / PLANT_BATCH_SIZE;
+        int first = (int)((long)batches * w / numWorkers) * PLANT_BATCH_SIZE;
+        int last = (int)((long)batches * (w + 1) / numWorkers) * PLANT_BATCH_SIZE;
+        workers[w].first = first < plants.count ? first : plants.count;
+        workers[w].last = last < plants.count ? last : plants.count;
+        workers[w].deactivated = malloc(sizeof(int) * (workers[w].last - workers[w].first + 1));
+        if (workers[w].deactivated == NULL)
+        {
+            fprintf(stderr, "Error: Could not allocate memory for the engine workers.\n");
+            exit(-1);
+        }
+    }
+    if (scheduleMode == SCHEDULE_EVENT)
+    {
+        wakeTicks = allocateColumn(plants.count, sizeof(unsigned long));
+        timerNext = allocateColumn(plants.count, sizeof(int));
+        timerPrev = allocateColumn(plants.count, sizeof(int));
+        timerSlot = allocateColumn(plants.count, sizeof(int));
+    }
+    placeFleetMemory(); // Before the workers start on their slices
+    if (scheduleMode == SCHEDULE_EVENT)
+    {
+        for (int w = 0; w < numWorkers; w++)
+        {
+            initEventSchedule(&workers[w]);
+        }
+    }
+
+    // A lone worker on the virtual clock would only hand the tick back and forth with the main thread
+    inlineWorker = clockMode == CLOCK_VIRTUAL && numWorkers == 1;
+    pthread_attr_t attr;
+    for (int w = 0; w < numWorkers && !inlineWorker; w++)
+    {
+        pthread_attr_init(&attr);
+        placeThread(&attr, ROLE_WORKER, w);
+        pthread_create(&workers[w].thread, &attr, engineWorkerRoutine, &workers[w]);
+        pthread_attr_destroy(&attr); // Clean thread attributes after use
+    }
+
+    pthread_attr_init(&attr);
+    placeThread(&attr, ROLE_SERVICE, 0);
+    if (weatherTrace != NULL)
+    {
+        pthread_create(&weatherPrefetchThread, &attr, weatherPrefetchRoutine, NULL);
+    }
+
+    engineStartedAt = monotonicNanos();
+    engineStartTick = currentTick;
+    activationsAtStart = activations;
+    churnPairsAtStart = churnPairs;
+    adjustmentPassesAtStart = adjustmentPasses;
+    advancedPlantTicksAtStart = advancedPlantTicks;
+    if (clockMode == CLOCK_WALL)
+    {
+        pthread_create(&clockThread, &attr, engineClockRoutine, NULL);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+/**
+ * Waits for the engine to wind down after a shutdown request and releases its resources.
+ * The clock thread, or this thread with the virtual clock, releases the workers one last time so they
+ * can observe the stop flag.
+ */
+void stopEngine()
+{
+    if (clockMode == CLOCK_WALL)
+    {
+        pthread_join(clockThread, NULL);
+    }
+    else if (!inlineWorker)
+    {
+        engineStopping = true;
+        pthread_barrier_wait(&tickStartBarrier);
+    }
+    for (int w = 0; w < numWorkers; w++)
+    {
+        if (!inlineWorker)
+        {
+            pthread_join(workers[w].thread, NULL);
+        }
+        free(workers[w].deactivated);
+        if (scheduleMode == SCHEDULE_EVENT)
+        {
+            free(workers[w].busy);
+            free(workers[w].woken);
+            pthread_mutex_destroy(&workers[w].wakeMutex);
+        }
+    }
+    pthread_barrier_destroy(&tickStartBarrier);
+    pthread_barrier_destroy(&tickEndBarrier);
+    free(workers);
+    workers = NULL;
+    if (scheduleMode == SCHEDULE_EVENT)
+    {
+        free(wakeTicks);
+        free(timerNext);
+        free(timerPrev);
+        free(timerSlot);
+        timerSlot = NULL;
+    }
+}
+
+/**
+ * Runs one global tick: samples the outcome of the previous tick, whose dispatch passes have run by now,
+ * applies the changes queued on the control socket, opens the tick, lets the workers advance their slices of
+ * the fleet and waits for all of them, then publishes the fleet snapshot they filled, the recorded weather row
+ * and the telemetry row. Stops the simulation once the --ticks horizon or the end of the weather trace is reached.
+ */
+void runEngineTick()
+{
+    if (currentTick > sampledTick)
+    {
+        sampleTick();
+    }
+    if (controlPath != NULL)
+    {
+        applyControlChanges();
+    }
+    currentTick++;
+    if (weatherTrace != NULL)
+    {
+        // Wake the prefetch thread every half window so the rows stay ahead of the tick
+        unsigned long row = currentTick - 1 - (unsigned long)weatherTrace->firstTick;
+        weatherStalls += row >= atomic_load(&weatherPrefetched);
+        if (row % (weatherWindowTicks / 2) == 0)
+        {
+            sem_post(&weatherSemaphore);
+        }
+    }
+    buildingFleetSnapshot = reserveSnapshot(&fleetSnapshots); // -1 if every spare buffer is still pinned
+    if (telemetryFile != NULL)
+    {
+        beginTelemetryTick();
+    }
+    if (inlineWorker)
+    {
+        advanceWorkerSlice(&workers[0]);
+    }
+    else
+    {
+        pthread_barrier_wait(&tickStartBarrier); // Open the tick
+        pthread_barrier_wait(&tickEndBarrier);   // Wait for every worker to finish its slice
+    }
+    if (buildingFleetSnapshot >= 0)
+    {
+        publishSnapshot(&fleetSnapshots, buildingFleetSnapshot, currentTick);
+    }
+    if (weatherRecordFile != NULL)
+    {
+        fwrite(weatherRecordRow, sizeof(float), plants.count, weatherRecordFile);
+        weatherRecordHeader.ticks++;
+    }
+    if (telemetryFile != NULL)
+    {
+        endTelemetryTick();
+    }
+    if (statsDumpRequested)
+    {
+        statsDumpRequested = 0;
+        dumpStats("signal");
+    }
+    if (checkpointPath != NULL && (checkpointRequested || (checkpointEvery > 0 && currentTick % checkpointEvery == 0)))
+    {
+        checkpointRequested = 0;
+        writeCheckpoint(checkpointPath); // The workers are parked at the start barrier, the dispatchers are held off
+    }
+    if ((tickLimit > 0 && currentTick >= tickLimit) ||
+        (weatherTrace != NULL && currentTick >= weatherTrace->firstTick + weatherTrace->ticks))
+    {
+        shutdownRequested = 1; // The --ticks horizon or the end of the weather trace
+    }
+}
+
+/**
+ * Main loop of the virtual clock. Ticks run back to back on the calling thread, and each coalescing
+ * window, or recovery attempt falling due, is followed by the dispatch passes of its regions, in region
+ * order, and their order refreshes before the next tick starts. Nothing depends on thread scheduling,
+ * so a given seed and worker count always give the same results.
+ */
+void runVirtualClock()
+{
+    while (!shutdownRequested)
+    {
+        runEngineTick();
+        for (int r = 0; r < numRegions; r++)
+        {
+            if (adjustmentDue(&regions[r], currentTick % coalesceTicks == 0) && !shutdownRequested)
+            {
+                handleAdjustment(&regions[r]);
+            }
+        }
+    }
+}
+
+/**
+ * Asks for the plant order to be refreshed after a full dispatch pass. The sorting thread does it
+ * with the wall clock; with the virtual clock it is done right away so the next pass sees it.
+ */
+void requestOrderRefresh()
+{
+    if (clockMode == CLOCK_VIRTUAL)
+    {
+        refreshPlantOrder();
+        for (int r = 0; r < numRegions && incrementalDispatch; r++)
+        {
+            refillStandbyPool(&regions[r]);
+        }
+    }
+    else
+    {
+        atomic_store(&orderRequestedAt, monotonicNanos());
+        sem_post(&sortingSemaphore);
+    }
+}
+
+/**
+ * Computes an FNV-1a digest of the water levels, activation flags and rain events of the fleet,
+ * so that two runs can be compared at a glance.
+ *
+ * @return The 64-bit digest of the fleet state.
+ */
+unsigned long long fleetDigest()
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    for (int plant = 0; plant < plants.count; plant++)
+    {
+        unsigned int fields[3];
+        memcpy(&fields[0], &plants.waterLevel[plant], sizeof(float));
+        fields[1] = (unsigned int)atomic_load_explicit(&plants.isActive[plant], memory_order_relaxed);
+        fields[2] = (unsigned int)plants.rainDuration[plant] << 8 | plants.rainType[plant];
+        const unsigned char *bytes = (const unsigned char *)fields;
+        for (size_t i = 0; i < sizeof(fields); i++)
+        {
+            hash = (hash ^ bytes[i]) * 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+/**
+ * The routine for the engine clock thread. Every second it opens a new global tick, lets the workers
+ * advance their slices of the fleet and waits for all of them before pacing the next tick.
+ * On shutdown it releases the workers and the dispatch loops so every thread can exit.
+ *
+ * @return Returns NULL upon completion.
+ */
+void *engineClockRoutine()
+{
+    while (!shutdownRequested)
+    {
+        runEngineTick();
+        flushAdjustments(currentTick % coalesceTicks == 0); // One dispatch pass for every deactivation of the window
+        // Wait one second before next tick, resuming the wait if a stats dump signal cut it short
+        struct timespec pause = {1, 0};
+        while (nanosleep(&pause, &pause) != 0 && errno == EINTR && !shutdownRequested)
+        {
+        }
+    }
+
+    engineStopping = true;
+    pthread_barrier_wait(&tickStartBarrier); // Let the workers observe the stop flag
+    for (int r = 0; r < numRegions; r++)
+    {
+        sem_post(&regions[r].adjustmentSemaphore); // Release the dispatch loops waiting for work
+    }
+
+    pthread_exit(NULL); // Clean up and orderly exit the thread
+    return NULL;
+}
+
+/**
+ * The routine for each engine worker thread. On every global tick it advances its slice of the fleet
+ * in batches of PLANT_BATCH_SIZE plants, or only its busy plants with event scheduling, then waits at
+ * the barrier for the next tick.
+ *
+ * @param arg A pointer to the EngineWorker describing the slice.
+ * @return Returns NULL upon completion.
+ */
+void *engineWorkerRoutine(void *arg)
+{
+    EngineWorker *worker = (EngineWorker *)arg;
+
+    while (true)
+    {
+        pthread_barrier_wait(&tickStartBarrier);
+        if (engineStopping)
+        {
+            break;
+        }
+        advanceWorkerSlice(worker);
+        pthread_barrier_wait(&tickEndBarrier);
+    }
+
+    pthread_exit(NULL); // Clean up and orderly exit the thread
+    return NULL;
+}
+
+/**
+ * Advances the slice of a worker by one tick, publishes the deactivations it produced and copies the
+ * slice into the telemetry row of the tick.
+ *
+ * @param worker The worker whose slice is advanced.
+ */
+void advanceWorkerSlice(EngineWorker *worker)
+{
+    if (scheduleMode == SCHEDULE_EVENT)
+    {
+        advanceEventSlice(worker);
+    }
+    else
+    {
+        for (int batch = worker->first; batch < worker->last; batch += PLANT_BATCH_SIZE)
+        {
+            advanceBatch(worker, batch, batch + PLANT_BATCH_SIZE < worker->last ? batch + PLANT_BATCH_SIZE : worker->last);
+        }
+        atomic_fetch_add_explicit(&advancedPlantTicks, worker->last - worker->first, memory_order_relaxed);
+    }
+    publishDeactivations(worker);
+    if (telemetryLevelRow != NULL)
+    {
+        recordTelemetrySlice(worker->first, worker->last);
+    }
+}
+
+/**
+ * Advances a batch of hydroelectric plants by one tick. The water-level kernel applies the rain,
+ * generation and overflow rules to the whole batch at once; the plants it flags are then handled one
+ * by one: a new rain event is drawn, out-of-bounds plants are deactivated and generation is reported.
+ * With a weather trace the rain of the tick is loaded from the trace instead of drawn. A batch that
+ * straddles regions is run through the kernel one region at a time, as recovery pauses them separately.
+ * Deactivated plants are recorded by the worker and published once its whole slice is done, and the
+ * batch is copied into the fleet snapshot being built for this tick; with event scheduling the worker
+ * copies its whole slice instead, idle plants included.
+ *
+ * @param worker The worker advancing the batch.
+ * @param first The id of the first plant of the batch.
+ * @param last One past the id of the last plant of the batch, at most PLANT_BATCH_SIZE plants after first.
+ */
+void advanceBatch(EngineWorker *worker, int first, int last)
+{
+    unsigned char events[PLANT_BATCH_SIZE];
+    float draws[PLANT_BATCH_SIZE];
+    int active[PLANT_BATCH_SIZE] = {0};
+
+    // Dispatch may switch plants on at any time; the batch is advanced with the flags seen here
+    for (int plant = first; plant < last; plant++)
+    {
+        active[plant - first] = atomic_load_explicit(&plants.isActive[plant], memory_order_relaxed);
+    }
+    if (weatherTrace != NULL)
+    {
+        replayWeather(first, last, currentTick); // One-tick rain events, so the kernel never asks for a draw
+    }
+    if (weatherRecordFile != NULL)
+    {
+        for (int plant = first; plant < last; plant++)
+        {
+            weatherRecordRow[plant] = plants.rainDuration[plant] > 0 ? plants.rainIncrement[plant] : 0.0f;
+        }
+    }
+    for (int segment = first; segment < last;)
+    {
+        const Region *region = &regions[plants.regionId[segment]];
+        int end = region->last < last ? region->last : last;
+        waterLevelKernel(segment, end, atomic_load_explicit(&region->waitingForRecover, memory_order_relaxed), active + (segment - first),
+                         events + (segment - first));
+        segment = end;
+    }
+    if (weatherTrace == NULL)
+    {
+        fillWeatherDraws(first, last, currentTick, draws);
+    }
+
+    for (int plant = first; plant < last; plant++)
+    {
+        unsigned char event = events[plant - first];
+        if (event & PLANT_EVENT_DRAW_WEATHER)
+        {
+            drawWeather(plant, draws[plant - first]);
+        }
+        if (event & PLANT_EVENT_OUT_OF_BOUNDS)
+        {
+            if (deactivatePlant(plant))
+            {
+                if (currentTick - activationTicks[plant] <= CHURN_WINDOW_TICKS)
+                {
+                    churnPairs++;
+                }
+                worker->deactivated[worker->deactivatedCount++] = plant;
+                logEvent(LOG_EVENT_PLANT_DEACTIVATED, plant, 0, 0.0f, 0.0f);
+            }
+            active[plant - first] = 0;
+        }
+        else if (event & PLANT_EVENT_GENERATED)
+        {
+            float water_flow = plants.rainIncrement[plant] - 5; // Calculate net water flow
+            logEvent(LOG_EVENT_PLANT_GENERATED, plant, plants.rainType[plant], plants.waterLevel[plant], water_flow);
+        }
+    }
+
+    // Copy the batch into the fleet snapshot the engine publishes at the end of the tick
+    if (buildingFleetSnapshot >= 0 && scheduleMode == SCHEDULE_TICK)
+    {
+        FleetSnapshot *snapshot = fleetSnapshots.buffers[buildingFleetSnapshot];
+        memcpy(snapshot->waterLevel + first, plants.waterLevel + first, sizeof(float) * (last - first));
+        memcpy(snapshot->isActive + first, active, sizeof(int) * (last - first));
+        if (snapshot->rainDuration != NULL)
+        {
+            memcpy(snapshot->rainIncrement + first, plants.rainIncrement + first, sizeof(float) * (last - first));
+            memcpy(snapshot->rainDuration + first, plants.rainDuration + first, sizeof(int) * (last - first));
+        }
+    }
+}
+
+/**
+ * Adds the plants a worker deactivated during the tick to the dirty sets of their regions, taking the
+ * lock of a region once per worker and tick rather than once per deactivation. The plants were recorded
+ * in id order, so those of a region follow each other.
+ *
+ * @param worker The worker that finished its slice.
+ */
+void publishDeactivations(EngineWorker *worker)
+{
+    if (worker->deactivatedCount == 0)
+    {
+        return;
+    }
+    unsigned long long now = monotonicNanos();
+    for (int i = 0, run; i < worker->deactivatedCount; i += run)
+    {
+        Region *region = &regions[plants.regionId[worker->deactivated[i]]];
+        for (run = 1; i + run < worker->deactivatedCount && worker->deactivated[i + run] < region->last; run++)
+        {
+        }
+        lockMutex(&region->dirtyMutex);
+        memcpy(region->dirtyPlants + region->dirtyCount, worker->deactivated + i, sizeof(int) * run);
+        for (int k = 0; k < run; k++)
+        {
+            region->dirtyTimes[region->dirtyCount + k] = now;
+        }
+        region->dirtyCount += run;
+        pthread_mutex_unlock(&region->dirtyMutex);
+    }
+    adjustmentEvents += worker->deactivatedCount;
+    worker->deactivatedCount = 0;
+}
+
+/**
+ * Builds the event schedule of a worker's slice when the engine starts: idle plants go on the timer
+ * wheel until the tick their weather stream next draws rain, every other plant is busy and advanced on
+ * every tick.
+ *
+ * @param worker The worker owning the slice.
+ */
+void initEventSchedule(EngineWorker *worker)
+{
+    int count = worker->last - worker->first;
+    worker->busy = calloc((count + 63) / 64 + 1, sizeof(unsigned long long));
+    worker->woken = malloc(sizeof(int) * (count + 1));
+    if (worker->busy == NULL || worker->woken == NULL)
+    {
+        fprintf(stderr, "Error: Could not allocate memory for the event schedule.\n");
+        exit(-1);
+    }
+    memset(worker->wheel, -1, sizeof(worker->wheel));
+    atomic_init(&worker->wokenCount, 0);
+    pthread_mutex_init(&worker->wakeMutex, NULL);
+
+    for (int plant = worker->first; plant < worker->last; plant++)
+    {
+        timerSlot[plant] = -1;
+        if (isIdlePlant(plant))
+        {
+            wakeTicks[plant] = nextRainTick(plant, currentTick + 1);
+            insertTimer(worker, plant, currentTick);
+        }
+        else
+        {
+            setBusyPlant(worker, plant, true);
+        }
+    }
+}
+
+/**
+ * Advances the slice of a worker by one tick with event scheduling. The plants dispatch switched on and
+ * those whose rain is due leave the timer wheel; the busy plants are then advanced in runs of nearby
+ * ids through advanceBatch, as the batches of tick scheduling, and those left idle go back on the wheel.
+ * An idle plant stays as it is on a tick without rain, so skipping it, or advancing it within a run,
+ * changes nothing.
+ *
+ * @param worker The worker advancing its slice.
+ */
+void advanceEventSlice(EngineWorker *worker)
+{
+    if (atomic_load_explicit(&worker->wokenCount, memory_order_acquire) > 0)
+    {
+        pthread_mutex_lock(&worker->wakeMutex);
+        for (int i = 0; i < atomic_load_explicit(&worker->wokenCount, memory_order_relaxed); i++)
+        {
+            int plant = worker->woken[i];
+            if (timerSlot[plant] >= 0)
+            {
+                removeTimer(worker, plant);
+                setBusyPlant(worker, plant, true);
+            }
+        }
+        atomic_store_explicit(&worker->wokenCount, 0, memory_order_relaxed);
+        pthread_mutex_unlock(&worker->wakeMutex);
+    }
+    advanceTimerWheel(worker, currentTick);
+    if (weatherRecordFile != NULL)
+    {
+        memset(weatherRecordRow + worker->first, 0, sizeof(float) * (worker->last - worker->first));
+    }
+
+    unsigned long advanced = 0;
+    for (int first = nextBusyPlant(worker, worker->first); first < worker->last; first = nextBusyPlant(worker, first))
+    {
+        int last = first + 1;
+        for (int next = nextBusyPlant(worker, last); next < worker->last && next - last < EVENT_RUN_GAP && next - first < PLANT_BATCH_SIZE;
+             next = nextBusyPlant(worker, last))
+        {
+            last = next + 1;
+        }
+        advanceBatch(worker, first, last);
+        advanced += last - first;
+        for (int plant = first; plant < last; plant++)
+        {
+            if (isBusyPlant(worker, plant) && isIdlePlant(plant))
+            {
+                setBusyPlant(worker, plant, false);
+                wakeTicks[plant] = nextRainTick(plant, currentTick + 1);
+                insertTimer(worker, plant, currentTick);
+            }
+        }
+        first = last;
+    }
+    atomic_fetch_add_explicit(&advancedPlantTicks, advanced, memory_order_relaxed);
+
+    // Copy the whole slice into the fleet snapshot the engine publishes at the end of the tick
+    if (buildingFleetSnapshot >= 0)
+    {
+        FleetSnapshot *snapshot = fleetSnapshots.buffers[buildingFleetSnapshot];
+        memcpy(snapshot->waterLevel + worker->first, plants.waterLevel + worker->first, sizeof(float) * (worker->last - worker->first));
+        for (int plant = worker->first; plant < worker->last; plant++)
+        {
+            snapshot->isActive[plant] = atomic_load_explicit(&plants.isActive[plant], memory_order_relaxed);
+        }
+        if (snapshot->rainDuration != NULL)
+        {
+            memcpy(snapshot->rainIncrement + worker->first, plants.rainIncrement + worker->first, sizeof(float) * (worker->last - worker->first));
+            memcpy(snapshot->rainDuration + worker->first, plants.rainDuration + worker->first, sizeof(int) * (worker->last - worker->first));
+        }
+    }
+}
+
+/**
+ * Finds the next busy plant of a worker's slice.
+ *
+ * @param worker The worker owning the slice.
+ * @param plant The id to start the search from.
+ * @return The id of the first busy plant from plant on, or the end of the slice if there is none.
+ */
+int nextBusyPlant(const EngineWorker *worker, int plant)
+{
+    if (plant >= worker->last)
+    {
+        return worker->last;
+    }
+    int word = (plant - worker->first) / 64;
+    int words = (worker->last - worker->first + 63) / 64;
+    unsigned long long bits = worker->busy[word] & (~0ULL << ((plant - worker->first) % 64));
+    while (bits == 0)
+    {
+        if (++word == words)
+        {
+            return worker->last;
+        }
+        bits = worker->busy[word];
+    }
+    plant = worker->first + word * 64 + __builtin_ctzll(bits);
+    return plant < worker->last ? plant : worker->last;
+}
+
+/**
+ * Checks whether a plant of a worker's slice is busy, off the timer wheel.
+ *
+ * @param worker The worker owning the slice.
+ * @param plant The id of the plant.
+ * @return true if the plant is advanced on every tick.
+ */
+bool isBusyPlant(const EngineWorker *worker, int plant)
+{
+    return worker->busy[(plant - worker->first) / 64] >> ((plant - worker->first) % 64) & 1;
+}
+
+/**
+ * Marks a plant of a worker's slice as busy or idle.
+ *
+ * @param worker The worker owning the slice.
+ * @param plant The id of the plant.
+ * @param busy Whether the plant is advanced on every tick.
+ */
+void setBusyPlant(EngineWorker *worker, int plant, bool busy)
+{
+    unsigned long long bit = 1ULL << ((plant - worker->first) % 64);
+    if (busy)
+    {
+        worker->busy[(plant - worker->first) / 64] |= bit;
+    }
+    else
+    {
+        worker->busy[(plant - worker->first) / 64] &= ~bit;
+    }
+}
+
+/**
+ * Checks whether a plant is idle: switched off, with no rain event going on and at most at its maximum
+ * level, so a tick without rain leaves it exactly as it is.
+ *
+ * @param plant The id of the plant in the plant store.
+ * @return true if the plant can wait on the timer wheel.
+ */
+bool isIdlePlant(int plant)
+{
+    return !atomic_load_explicit(&plants.isActive[plant], memory_order_relaxed) && plants.rainDuration[plant] == 0 &&
+           plants.rainType[plant] == RAIN_NONE && plants.rainIncrement[plant] == NO_RAIN_INCREMENT &&
+           plants.waterLevel[plant] <= plants.maxWaterLevel[plant];
+}
+
+/**
+ * Scans the weather stream of a plant for the next tick that draws rain. The draws are those of
+ * weatherDraw, with the plant's stream key computed once.
+ *
+ * @param plant The id of the plant in the plant store.
+ * @param from The first tick to look at.
+ * @return The first tick from on that draws rain, or from + WEATHER_SCAN_TICKS if none does before;
+ *         the plant is then simply advanced on that tick and scanned again.
+ */
+unsigned long nextRainTick(int plant, unsigned long from)
+{
+    // A draw is x / 2^24 with x a 24-bit integer, and the scaling is exact, so it is below probA exactly when x is below this
+    float scaled = ceilf(probA * 16777216.0f);
+    unsigned long long threshold = scaled > 0.0f ? (unsigned long long)scaled : 0;
+    unsigned long long stream = weatherStream(plant);
+    for (unsigned long tick = from; tick < from + WEATHER_SCAN_TICKS; tick += 8)
+    {
+        // Eight independent draws per step keep the multipliers busy; the block is only searched once it holds rain
+        unsigned long long draws[8];
+        bool rain = false;
+        for (int k = 0; k < 8; k++)
+        {
+            draws[k] = mixBits(stream + (unsigned long long)(tick + k) * 0x9E3779B97F4A7C15ULL) >> 40;
+            rain |= draws[k] >= threshold;
+        }
+        if (rain)
+        {
+            int k = 0;
+            while (draws[k] < threshold)
+            {
+                k++;
+            }
+            return tick + k;
+        }
+    }
+    return from + WEATHER_SCAN_TICKS;
+}
+
+/**
+ * Puts an idle plant on the timer wheel of a worker, on the lowest level whose slots still tell its
+ * wake-up tick apart from the current one.
+ *
+ * @param worker The worker owning the plant.
+ * @param plant The id of the plant, with its wakeTicks entry set.
+ * @param now The current tick, before the wake-up tick.
+ */
+void insertTimer(EngineWorker *worker, int plant, unsigned long now)
+{
+    unsigned long delta = wakeTicks[plant] - now;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= 1UL << (TIMER_WHEEL_BITS * (level + 1)))
+    {
+        level++;
+    }
+    int slot = (int)(wakeTicks[plant] >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+    int head = worker->wheel[level][slot];
+    timerNext[plant] = head;
+    timerPrev[plant] = -1;
+    if (head >= 0)
+    {
+        timerPrev[head] = plant;
+    }
+    worker->wheel[level][slot] = plant;
+    timerSlot[plant] = level * TIMER_WHEEL_SLOTS + slot;
+}
+
+/**
+ * Takes a plant off the timer wheel of a worker.
+ *
+ * @param worker The worker owning the plant.
+ * @param plant The id of the plant, on the wheel.
+ */
+void removeTimer(EngineWorker *worker, int plant)
+{
+    if (timerPrev[plant] >= 0)
+    {
+        timerNext[timerPrev[plant]] = timerNext[plant];
+    }
+    else
+    {
+        worker->wheel[timerSlot[plant] / TIMER_WHEEL_SLOTS][timerSlot[plant] % TIMER_WHEEL_SLOTS] = timerNext[plant];
+    }
+    if (timerNext[plant] >= 0)
+    {
+        timerPrev[timerNext[plant]] = timerPrev[plant];
+    }
+    timerSlot[plant] = -1;
+}
+
+/**
+ * Moves the timer wheel of a worker to a new tick. At the start of each block of ticks covered by a
+ * slot of a higher level, the plants of that slot are spread over the lower levels; the plants of the
+ * tick's slot on the lowest level are due and become busy.
+ *
+ * @param worker The worker owning the wheel.
+ * @param tick The tick about to be advanced.
+ */
+void advanceTimerWheel(EngineWorker *worker, unsigned long tick)
+{
+    for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; level--)
+    {
+        if ((tick & ((1UL << (TIMER_WHEEL_BITS * level)) - 1)) != 0)
+        {
+            continue;
+        }
+        int slot = (int)(tick >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+        int plant = worker->wheel[level][slot];
+        worker->wheel[level][slot] = -1;
+        while (plant >= 0)
+        {
+            int next = timerNext[plant];
+            insertTimer(worker, plant, tick);
+            plant = next;
+        }
+    }
+
+    int slot = (int)tick & (TIMER_WHEEL_SLOTS - 1);
+    int plant = worker->wheel[0][slot];
+    worker->wheel[0][slot] = -1;
+    while (plant >= 0)
+    {
+        timerSlot[plant] = -1;
+        setBusyPlant(worker, plant, true);
+        plant = timerNext[plant];
+    }
+}
+
+/**
+ * Hands a plant dispatch just switched on to the worker owning it, which takes it off the timer wheel
+ * at the start of the next tick.
+ *
+ * @param plant The id of the plant in the plant store.
+ */
+void wakePlant(int plant)
+{
+    // The owner is the last worker whose slice starts at or before the plant; empty slices come first
+    int low = 0, high = numWorkers - 1;
+    while (low < high)
+    {
+        int middle = (low + high + 1) / 2;
+        if (workers[middle].first <= plant)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+    EngineWorker *worker = &workers[low];
+    pthread_mutex_lock(&worker->wakeMutex);
+    int count = atomic_load_explicit(&worker->wokenCount, memory_order_relaxed);
+    worker->woken[count] = plant;
+    atomic_store_explicit(&worker->wokenCount, count + 1, memory_order_release);
+    pthread_mutex_unlock(&worker->wakeMutex);
+}
+
+/**
+ * Tells whether a region needs a dispatch pass at the end of the current tick: at the end of a coalescing
+ * window with deactivations, or right away after a band change. A recovering region keeps gathering its
+ * deactivations until its next recovery attempt is due, then handles them all in that attempt.
+ *
+ * @param region The region.
+ * @param windowClosed Whether the tick closes a coalescing window.
+ * @return true if the dispatcher of the region should run a pass.
+ */
+bool adjustmentDue(const Region *region, bool windowClosed)
+{
+    if (atomic_load(&region->waitingForRecover))
+    {
+        return currentTick >= atomic_load(&region->retryTick);
+    }
+    return (windowClosed && region->dirtyCount > 0) || atomic_load(&region->bandChanged);
+}
+
+/**
+ * Samples the outcome of the current tick once its dispatch passes have run, so that deactivations the
+ * passes made up for are not counted as blackouts: whether a region was left below its minimum generation,
+ * the generation summed for the ensemble mean and the recovery clocks. With the virtual clock the passes
+ * run right after the tick; with the wall clock the dispatchers have had the whole pause between ticks.
+ */
+void sampleTick()
+{
+    bool belowMinimum = false;
+    for (int r = 0; r < numRegions; r++)
+    {
+        belowMinimum = belowMinimum || regionGeneration(&regions[r]) < regions[r].minGeneration;
+    }
+    ticksBelowMinimum += belowMinimum;
+    generationSum += currentGeneration();
+    updateRecoveryClocks();
+    sampledTick = currentTick;
+}
+
+/**
+ * Keeps the recovery clocks of every region once a tick is over: blackout-seconds are the ticks left
+ * below the minimum generation by their dispatch passes, recovering or not, and with the ticks refill rule one recovery
+ * attempt comes back after every recoveryRefillTicks consecutive ticks at or above the minimum.
+ */
+void updateRecoveryClocks()
+{
+    for (int r = 0; r < numRegions; r++)
+    {
+        Region *region = &regions[r];
+        if (regionGeneration(region) < region->minGeneration)
+        {
+            region->blackoutTicks++;
+            region->recoveringTicks += atomic_load(&region->waitingForRecover);
+            region->inBandTicks = 0;
+            continue;
+        }
+        region->inBandTicks++;
+        if (recoveryRefill == REFILL_TICKS && region->inBandTicks % recoveryRefillTicks == 0 &&
+            atomic_load(&region->lastShots) < recoveryBudget)
+        {
+            atomic_fetch_add(&region->lastShots, 1);
+        }
+    }
+}
+
+/**
+ * Hands the regions due for a dispatch pass to their dispatchers at the end of a tick: when a coalescing
+ * window closes, every region with deactivated plants whose dispatcher has not been asked for an
+ * adjustment yet gets its adjustmentSemaphore posted once for all of them; a region whose band changed
+ * gets it at the end of the tick, and a recovering region only once its next recovery attempt is due.
+ *
+ * @param windowClosed Whether the tick closes a coalescing window.
+ */
+void flushAdjustments(bool windowClosed)
+{
+    for (int r = 0; r < numRegions; r++)
+    {
+        Region *region = &regions[r];
+        if (!windowClosed && !atomic_load(&region->waitingForRecover) && !atomic_load(&region->bandChanged))
+        {
+            continue;
+        }
+        lockMutex(&region->dirtyMutex);
+        bool post = adjustmentDue(region, windowClosed) && !region->adjustmentPending;
+        region->adjustmentPending = region->adjustmentPending || post;
+        pthread_mutex_unlock(&region->dirtyMutex);
+        if (post)
+        {
+            sem_post(&region->adjustmentSemaphore);
+        }
+    }
+}
+
+/**
+ * Water-level kernel: applies one tick of the plant rules to a block of the plant store.
+ * An ongoing rain event adds its increment; an active plant outside recovery draws 5.0 for generation
+ * unless that would take it out of its bounds, in which case it is flagged for deactivation instead;
+ * an inactive plant above its maximum spills 5.0. The loop is branch-free over contiguous columns so
+ * the compiler can vectorize it.
+ *
+ * @param first The id of the first plant of the block.
+ * @param last One past the id of the last plant of the block.
+ * @param recovering Whether the dispatcher of the block's region is waiting for a recovery, which pauses generation.
+ * @param active The activation flag of each plant of the block.
+ * @param events Output, one PLANT_EVENT_* mask per plant of the block.
+ */
+void waterLevelKernel(int first, int last, bool recovering, const int *restrict active, unsigned char *restrict events)
+{
+    float *restrict level = plants.waterLevel;
+    const float *restrict minLevel = plants.minWaterLevel;
+    const float *restrict maxLevel = plants.maxWaterLevel;
+    const float *restrict increment = plants.rainIncrement;
+    int *restrict duration = plants.rainDuration;
+    int generating = !recovering;
+
+    for (int i = first; i < last; i++)
+    {
+        // Handle ongoing rain event, otherwise a new one is drawn afterwards
+        int raining = duration[i] > 0;
+        float current = level[i] + (float)raining * increment[i];
+        duration[i] -= raining;
+
+        // Generation draw and overflow spill both take 5.0 out of the reservoir
+        float drawn = current - 5.0f;
+        int isActive = active[i - first] != 0;
+        int outOfBounds = isActive & generating & ((drawn < minLevel[i]) | (drawn > maxLevel[i]));
+        int generated = isActive & generating & (outOfBounds ^ 1);
+        int spilled = (isActive ^ 1) & (current > maxLevel[i]);
+        level[i] = current - (float)(generated | spilled) * 5.0f;
+
+        events[i - first] = (unsigned char)((raining ^ 1) * PLANT_EVENT_DRAW_WEATHER |
+                                            generated * PLANT_EVENT_GENERATED |
+                                            outOfBounds * PLANT_EVENT_OUT_OF_BOUNDS);
+    }
+}
+
+/**
+ * SplitMix64 finalizer: scrambles 64 bits so that nearby inputs give unrelated outputs.
+ *
+ * @param bits The value to scramble.
+ * @return The scrambled value.
+ */
+unsigned long long mixBits(unsigned long long bits)
+{
+    bits = (bits ^ (bits >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    bits = (bits ^ (bits >> 27)) * 0x94D049BB133111EBULL;
+    return bits ^ (bits >> 31);
+}
+
+/**
+ * Counter-based weather random stream. Every plant has its own stream keyed by the seed and its id (weatherStream),
+ * and the draw of a tick is a pure function of (seed, plant, tick): no shared state, no lock, the same
+ * results whatever the number of workers, and any tick can be drawn directly without replaying the
+ * ticks before it.
+ *
+ * @param plant The id of the plant in the plant store.
+ * @param tick The tick of the draw.
+ * @return A uniform number in [0, 1).
+ */
+float weatherDraw(int plant, unsigned long tick)
+{
+    unsigned long long stream = weatherStream(plant);
+    unsigned long long bits = mixBits(stream + (unsigned long long)tick * 0x9E3779B97F4A7C15ULL);
+    return (float)(int)(bits >> 40) * (1.0f / 16777216.0f); // 24 random bits, exact in a float
+}
+
+/**
+ * Batch form of weatherDraw: fills the draws of a whole block of plants for one tick in a single
+ * branch-free loop the compiler can vectorize. Streams keyed by class and ordinal get a loop of their own.
+ *
+ * @param first The id of the first plant of the block.
+ * @param last One past the id of the last plant of the block.
+ * @param tick The tick of the draws.
+ * @param draws Output, one uniform number in [0, 1) per plant of the block.
+ */
+void fillWeatherDraws(int first, int last, unsigned long tick, float *restrict draws)
+{
+    unsigned long long counter = (unsigned long long)tick * 0x9E3779B97F4A7C15ULL;
+    if (weatherByClassOrdinal)
+    {
+        for (int plant = first; plant < last; plant++)
+        {
+            unsigned long long bits = mixBits(weatherStream(plant) + counter);
+            draws[plant - first] = (float)(int)(bits >> 40) * (1.0f / 16777216.0f);
+        }
+        return;
+    }
+    for (int plant = first; plant < last; plant++)
+    {
+        unsigned long long stream = mixBits(randomSeed + (unsigned long long)plant * 0xD1B54A32D192ED03ULL);
+        unsigned long long bits = mixBits(stream + counter);
+        draws[plant - first] = (float)(int)(bits >> 40) * (1.0f / 16777216.0f);
+    }
+}
+
+/**
+ * Key of the weather random stream of a plant. Streams are keyed by the seed and the plant id, or with
+ * weatherByClassOrdinal by the class and ordinal of the plant, so the n-th plant of a class draws the same
+ * weather whatever the number of plants of the other classes.
+ *
+ * @param plant The id of the plant in the plant store.
+ * @return The stream key, mixed into the counter of every draw of the plant.
+ */
+unsigned long long weatherStream(int plant)
+{
+    unsigned long long key = weatherByClassOrdinal ? (unsigned long long)plants.ordinal[plant] * MAX_PLANT_CLASSES + plants.classId[plant]
+                                                   : (unsigned long long)plant;
+    return mixBits(randomSeed + key * 0xD1B54A32D192ED03ULL);
+}
+
+/**
+ * Simulates a new rain event for a plant whose previous event has ended.
+ *
+ * @param plant The id of the plant in the plant store.
+ * @param prob A uniform draw in [0, 1) from the plant's weather stream.
+ */
+void drawWeather(int plant, float prob)
+{
+    if (prob < probA) // No rain
+    {
+        plants.rainIncrement[plant] = NO_RAIN_INCREMENT;
+        plants.rainDuration[plant] = NO_RAIN_DURATION;
+        plants.rainType[plant] = RAIN_NONE;
+    }
+    else if (prob < probA + probB) // Light rain
+    {
+        plants.rainIncrement[plant] = AGUACERO_INCREMENT;
+        plants.rainDuration[plant] = AGUACERO_DURATION;
+        plants.rainType[plant] = RAIN_AGUACERO;
+    }
+    else // Heavy rain
+    {
+        plants.rainIncrement[plant] = DILUVIO_INCREMENT;
+        plants.rainDuration[plant] = DILUVIO_DURATION;
+        plants.rainType[plant] = RAIN_DILUVIO;
+    }
+}
+
+/**
+ * The routine for the sorting thread. This function keeps the plant priority heap in line with the
+ * current water levels. It waits for a signal before refreshing the order.
+ * The refresh is executed until a shutdown request is received.
+ *
+ * @return Returns NULL upon completion.
+ */
+void *sortingThreadRoutine()
+{
+    while (!shutdownRequested)
+    {
+        // Notify about sorting operation execution
+        // printf("%sExecuting sorting thread.%s\n", c_magenta, c_end);
+        // Reorder the plants whose water level changed since the last refresh
+        refreshPlantOrder();
+        for (int r = 0; r < numRegions && incrementalDispatch; r++)
+        {
+            refillStandbyPool(&regions[r]);
+        }
+        // Wait for a signal to start the sorting
+        while (sem_wait(&sortingSemaphore) != 0 && errno == EINTR)
+        {
+        }
+        unsigned long long requestedAt = atomic_exchange(&orderRequestedAt, 0);
+        if (requestedAt != 0)
+        {
+            recordLatency(LATENCY_SORTING_WAIT, monotonicNanos() - requestedAt);
+        }
+    }
+
+    // Clean up and orderly exit the thread
+    pthread_exit(NULL);
+    return NULL;
+}
+
+/**
+ * Deactivates a given hydroelectric plant.
+ * This function switches the active status of the plant from true (1) to false (0) with a
+ * compare-and-swap and, if it did, updates the lock-free generation totals of its region and the fleet.
+ *
+ * @param plant The id of the plant to be deactivated in the plant store.
+ * @return true if the plant was active and is now deactivated.
+ */
+bool deactivatePlant(int plant)
+{
+    int expected = 1;
+    if (!atomic_compare_exchange_strong(&plants.isActive[plant], &expected, 0))
+    {
+        return false;
+    }
+    long long kilowatts = capacityKilowatts(plant);
+    atomic_fetch_sub(&regions[plants.regionId[plant]].generatedKilowatts, kilowatts);
+    atomic_fetch_sub(&generatedKilowatts, kilowatts); // Update the total energy generation
+    return true;
+}
+
+/**
+ * Activates a given hydroelectric plant.
+ * This function switches the active status of the plant from false (0) to true (1) with a
+ * compare-and-swap and, if it did, updates the lock-free generation totals of its region and the fleet.
+ *
+ * @param plant The id of the plant to be activated in the plant store.
+ * @return true if the plant was inactive and is now activated.
+ */
+bool activatePlant(int plant)
+{
+    int expected = 0;
+    if (!atomic_compare_exchange_strong(&plants.isActive[plant], &expected, 1))
+    {
+        return false;
+    }
+    long long kilowatts = capacityKilowatts(plant);
+    atomic_fetch_add(&regions[plants.regionId[plant]].generatedKilowatts, kilowatts);
+    atomic_fetch_add(&generatedKilowatts, kilowatts); // Update the total energy generation
+    activationTicks[plant] = currentTick;
+    activations++;
+    if (timerSlot != NULL)
+    {
+        wakePlant(plant); // An idle plant must be advanced again from the next tick
+    }
+    return true;
+}
+
+/**
+ * Returns the current generation total of the active plants of the whole fleet.
+ *
+ * @return The generation in MW/s.
+ */
+float currentGeneration()
+{
+    return (float)atomic_load(&generatedKilowatts) / 1000.0f;
+}
+
+/**
+ * Returns the capacity of a plant in whole kW, the unit of the generation accumulator.
+ *
+ * @param plant The id of the plant in the plant store.
+ * @return The capacity in kW.
+ */
+long long capacityKilowatts(int plant)
+{
+    return llroundf(plants.capacity[plant] * 1000.0f);
+}
+
+/**
+ * Allocates the snapshot rings and publishes the initial fleet state and plant order,
+ * so that readers always find a published snapshot.
+ */
+void initSnapshots()
+{
+    for (int b = 0; b < SNAPSHOT_BUFFERS; b++)
+    {
+        FleetSnapshot *fleet = malloc(sizeof(FleetSnapshot));
+        PlantHeap *order = malloc(sizeof(PlantHeap));
+        if (fleet == NULL || order == NULL)
+        {
+            fprintf(stderr, "Error: Could not allocate memory for the snapshots.\n");
+            exit(-1);
+        }
+        fleet->waterLevel = allocateColumn(plants.count, sizeof(float));
+        fleet->isActive = allocateColumn(plants.count, sizeof(int));
+        fleet->rainIncrement = lookaheadHorizon > 0 ? allocateColumn(plants.count, sizeof(float)) : NULL;
+        fleet->rainDuration = lookaheadHorizon > 0 ? allocateColumn(plants.count, sizeof(int)) : NULL;
+        order->size = 0;
+        order->slots = allocateColumn(plants.count, sizeof(int));
+        order->position = NULL; // Published orders are only walked, never re-keyed
+        order->key = allocateColumn(plants.count, sizeof(float));
+        fleetSnapshots.buffers[b] = fleet;
+        orderSnapshots.buffers[b] = order;
+        atomic_init(&fleetSnapshots.readers[b], 0);
+        atomic_init(&orderSnapshots.readers[b], 0);
+        if (dispatchMode == DISPATCH_EXACT)
+        {
+            PlantHeap *classes = malloc(sizeof(PlantHeap));
+            if (classes == NULL)
+            {
+                fprintf(stderr, "Error: Could not allocate memory for the snapshots.\n");
+                exit(-1);
+            }
+            classes->size = 0;
+            classes->slots = allocateColumn(plants.count, sizeof(int));
+            classes->position = NULL;
+            classes->key = allocateColumn(plants.count, sizeof(float));
+            classOrderSnapshots.buffers[b] = classes;
+            atomic_init(&classOrderSnapshots.readers[b], 0);
+        }
+    }
+
+    FleetSnapshot *fleet = fleetSnapshots.buffers[0];
+    memcpy(fleet->waterLevel, plants.waterLevel, sizeof(float) * plants.count);
+    for (int plant = 0; plant < plants.count; plant++)
+    {
+        fleet->isActive[plant] = atomic_load(&plants.isActive[plant]);
+    }
+    if (fleet->rainDuration != NULL)
+    {
+        memcpy(fleet->rainIncrement, plants.rainIncrement, sizeof(float) * plants.count);
+        memcpy(fleet->rainDuration, plants.rainDuration, sizeof(int) * plants.count);
+    }
+    atomic_init(&fleetSnapshots.published, 0);
+    atomic_init(&orderSnapshots.published, 0);
+    atomic_init(&classOrderSnapshots.published, 0);
+    publishPlantOrder(0);
+}
+
+/**
+ * Releases the snapshot rings.
+ */
+void freeSnapshots()
+{
+    for (int b = 0; b < SNAPSHOT_BUFFERS; b++)
+    {
+        FleetSnapshot *fleet = fleetSnapshots.buffers[b];
+        PlantHeap *order = orderSnapshots.buffers[b];
+        free(fleet->waterLevel);
+        free(fleet->isActive);
+        free(fleet->rainIncrement);
+        free(fleet->rainDuration);
+        free(fleet);
+        free(order->slots);
+        free(order->key);
+        free(order);
+        PlantHeap *classes = classOrderSnapshots.buffers[b];
+        if (classes != NULL)
+        {
+            free(classes->slots);
+            free(classes->key);
+            free(classes);
+            classOrderSnapshots.buffers[b] = NULL;
+        }
+    }
+}
+
+/**
+ * Pins the published buffer of a snapshot ring. The buffer stays untouched until it is released,
+ * even if newer snapshots are published meanwhile. Never blocks.
+ *
+ * @param ring The snapshot ring to read.
+ * @return The index of the pinned buffer.
+ */
+int acquireSnapshot(SnapshotRing *ring)
+{
+    while (true)
+    {
+        int buffer = atomic_load(&ring->published);
+        atomic_fetch_add(&ring->readers[buffer], 1);
+        if (atomic_load(&ring->published) == buffer)
+        {
+            return buffer; // Still published after pinning, so the writer cannot pick it any more
+        }
+        atomic_fetch_sub(&ring->readers[buffer], 1);
+    }
+}
+
+/**
+ * Unpins a buffer obtained from acquireSnapshot.
+ *
+ * @param ring The snapshot ring.
+ * @param buffer The index of the pinned buffer.
+ */
+void releaseSnapshot(SnapshotRing *ring, int buffer)
+{
+    atomic_fetch_sub(&ring->readers[buffer], 1);
+}
+
+/**
+ * Picks a buffer the writer can fill: neither published nor pinned by a reader.
+ * Only one thread may write to a ring.
+ *
+ * @param ring The snapshot ring to write.
+ * @return The index of the buffer, or -1 if every spare buffer is pinned.
+ */
+int reserveSnapshot(SnapshotRing *ring)
+{
+    int published = atomic_load(&ring->published);
+    for (int b = 0; b < SNAPSHOT_BUFFERS; b++)
+    {
+        if (b != published && atomic_load(&ring->readers[b]) == 0)
+        {
+            return b;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Publishes a filled buffer, making it the one new readers pin.
+ *
+ * @param ring The snapshot ring.
+ * @param buffer The index of the buffer returned by reserveSnapshot.
+ * @param epoch The tick the snapshot was taken at.
+ */
+void publishSnapshot(SnapshotRing *ring, int buffer, unsigned long epoch)
+{
+    ring->epoch[buffer] = epoch;
+    atomic_store(&ring->published, buffer);
+}
+
+/**
+ * Publishes a copy of the working plant heap for dispatch, and of the class order with exact dispatch.
+ * If every spare buffer is pinned, the previous order stays published until the next refresh.
+ *
+ * @param epoch The tick of the fleet snapshot the order was computed from.
+ */
+void publishPlantOrder(unsigned long epoch)
+{
+    int buffer = reserveSnapshot(&orderSnapshots);
+    if (buffer < 0)
+    {
+        return;
+    }
+    PlantHeap *order = orderSnapshots.buffers[buffer];
+    order->size = plantOrder.size;
+    memcpy(order->slots, plantOrder.slots, sizeof(int) * plantOrder.size);
+    memcpy(order->key, plantOrder.key, sizeof(float) * plants.count);
+    publishSnapshot(&orderSnapshots, buffer, epoch);
+
+    if (classOrder.size > 0 && (buffer = reserveSnapshot(&classOrderSnapshots)) >= 0)
+    {
+        PlantHeap *classes = classOrderSnapshots.buffers[buffer];
+        classes->size = classOrder.size;
+        memcpy(classes->slots, classOrder.slots, sizeof(int) * classOrder.size);
+        memcpy(classes->key, classOrder.key, sizeof(float) * plants.count);
+        publishSnapshot(&classOrderSnapshots, buffer, epoch);
+    }
+}
+
+/**
+ * Pins the latest fleet snapshot and plant order for a dispatch pass over a region.
+ *
+ * @param view The view to open.
+ * @param region The region being dispatched.
+ */
+void openDispatchView(DispatchView *view, const Region *region)
+{
+    view->fleetBuffer = acquireSnapshot(&fleetSnapshots);
+    view->orderBuffer = acquireSnapshot(&orderSnapshots);
+    view->fleet = fleetSnapshots.buffers[view->fleetBuffer];
+    view->waterLevel = view->fleet->waterLevel;
+    view->order = regionHeap(region, orderSnapshots.buffers[view->orderBuffer]);
+    view->classOrderBuffer = classOrder.size > 0 ? acquireSnapshot(&classOrderSnapshots) : -1;
+    view->classOrder = view->classOrderBuffer >= 0 ? classOrderSnapshots.buffers[view->classOrderBuffer] : NULL;
+}
+
+/**
+ * Unpins the snapshots of a dispatch view.
+ *
+ * @param view The view to close.
+ */
+void closeDispatchView(DispatchView *view)
+{
+    releaseSnapshot(&fleetSnapshots, view->fleetBuffer);
+    releaseSnapshot(&orderSnapshots, view->orderBuffer);
+    if (view->classOrderBuffer >= 0)
+    {
+        releaseSnapshot(&classOrderSnapshots, view->classOrderBuffer);
+    }
+}
+
+/**
+ * Computes the water level of a plant relative to its minimum and maximum limits.
+ *
+ * @param plant The id of the plant in the plant store.
+ * @param waterLevel The water level of the plant.
+ * @return 0.0 at the minimum water level, 1.0 at the maximum water level.
+ */
+float relativeWaterLevel(int plant, float waterLevel)
+{
+    return (waterLevel - plants.minWaterLevel[plant]) / (plants.maxWaterLevel[plant] - plants.minWaterLevel[plant]);
+}
+
+/**
+ * Compares two hydroelectric plants based on their relative water levels and capacity.
+ * The comparison is primarily based on the water levels relative to their minimum and maximum limits,
+ * as cached in a plant priority heap, and secondarily on the capacity of the plants.
+ *
+ * @param heap The heap holding the cached keys.
+ * @param a The id of the first plant to compare.
+ * @param b The id of the second plant to compare.
+ * @return An integer greater than 0 if 'a' has higher priority than 'b', less than 0 if 'b' has higher priority, or 0 if they are equal.
+ */
+int comparePlants(const PlantHeap *heap, int a, int b)
+{
+    // First compare based on relative water level
+    if (heap->key[a] != heap->key[b])
+    {
+        return (heap->key[a] > heap->key[b]) ? 1 : -1;
+    }
+    // Then compare based on capacity
+    if (plants.capacity[a] != plants.capacity[b])
+    {
+        return (plants.capacity[a] > plants.capacity[b]) ? 1 : -1;
+    }
+    return 0;
+}
+
+/**
+ * Total order used by the plant priority heap: comparePlants, with ties broken by the lower plant id
+ * so that equal plants keep the order in which they were created.
+ *
+ * @param heap The heap holding the cached keys.
+ * @param a The id of the first plant to compare.
+ * @param b The id of the second plant to compare.
+ * @return true if 'a' must come before 'b'.
+ */
+bool hasPriorityOver(const PlantHeap *heap, int a, int b)
+{
+    int comparison = comparePlants(heap, a, b);
+    return comparison > 0 || (comparison == 0 && a < b);
+}
+
+/**
+ * Builds the plant priority heap over the whole plant store in O(n) with a bottom-up heapify of the
+ * range of every region. With exact dispatch the class order is built too: the slots of every region
+ * are grouped by class, and each group is heapified on its own.
+ *
+ * @param keys The relative water level to order each plant by, or NULL to use the current water levels.
+ */
+void buildPlantOrder(const float *keys)
+{
+    plantOrder.size = plants.count;
+    plantOrder.slots = allocateColumn(plants.count, sizeof(int));
+    plantOrder.position = allocateColumn(plants.count, sizeof(int));
+    plantOrder.key = allocateColumn(plants.count, sizeof(float));
+
+    for (int r = 0; r < numRegions; r++)
+    {
+        PlantHeap heap = regionHeap(&regions[r], &plantOrder);
+        for (int plant = regions[r].first; plant < regions[r].last; plant++)
+        {
+            plantOrder.slots[plant] = plant;
+            plantOrder.position[plant] = plant - regions[r].first;
+            plantOrder.key[plant] = keys != NULL ? keys[plant] : relativeWaterLevel(plant, plants.waterLevel[plant]);
+        }
+        for (int position = (heap.size - 2) / PLANT_HEAP_ARITY; position >= 0; position--)
+        {
+            siftPlantDown(&heap, position);
+        }
+    }
+    if (dispatchMode != DISPATCH_EXACT)
+    {
+        return;
+    }
+
+    classOrder.size = plants.count;
+    classOrder.slots = allocateColumn(plants.count, sizeof(int));
+    classOrder.position = allocateColumn(plants.count, sizeof(int));
+    classOrder.key = allocateColumn(plants.count, sizeof(float));
+    memcpy(classOrder.key, plantOrder.key, sizeof(float) * plants.count);
+    for (int r = 0; r < numRegions; r++)
+    {
+        Region *region = &regions[r];
+        int next[MAX_PLANT_CLASSES] = {0};
+        for (int plant = region->first; plant < region->last; plant++)
+        {
+            next[plants.classId[plant]]++;
+        }
+        region->classFirst[0] = region->first;
+        for (int c = 0; c < numPlantClasses; c++)
+        {
+            region->classFirst[c + 1] = region->classFirst[c] + next[c];
+            next[c] = region->classFirst[c];
+        }
+        for (int plant = region->first; plant < region->last; plant++)
+        {
+            int c = plants.classId[plant];
+            classOrder.slots[next[c]] = plant;
+            classOrder.position[plant] = next[c]++ - region->classFirst[c];
+        }
+        for (int c = 0; c < numPlantClasses; c++)
+        {
+            PlantHeap heap = classHeap(region, c, &classOrder);
+            for (int position = (heap.size - 2) / PLANT_HEAP_ARITY; position >= 0; position--)
+            {
+                siftPlantDown(&heap, position);
+            }
+        }
+    }
+}
+
+/**
+ * Releases the arrays of the plant priority heap.
+ */
+void freePlantOrder()
+{
+    free(plantOrder.slots);
+    free(plantOrder.position);
+    free(plantOrder.key);
+    memset(&plantOrder, 0, sizeof(plantOrder));
+    free(classOrder.slots);
+    free(classOrder.position);
+    free(classOrder.key);
+    memset(&classOrder, 0, sizeof(classOrder));
+}
+
+/**
+ * Moves the plant at the given heap position towards the root until its parent has priority over it.
+ *
+ * @param heap The working heap, or the heap of one of its regions.
+ * @param position The heap position of the plant.
+ */
+void siftPlantUp(PlantHeap *heap, int position)
+{
+    int plant = heap->slots[position];
+    while (position > 0)
+    {
+        int parent = (position - 1) / PLANT_HEAP_ARITY;
+        if (!hasPriorityOver(heap, plant, heap->slots[parent]))
+        {
+            break;
+        }
+        heap->slots[position] = heap->slots[parent];
+        heap->position[heap->slots[position]] = position;
+        position = parent;
+    }
+    heap->slots[position] = plant;
+    heap->position[plant] = position;
+}
+
+/**
+ * Moves the plant at the given heap position towards the leaves until it has priority over all its children.
+ *
+ * @param heap The working heap, or the heap of one of its regions.
+ * @param position The heap position of the plant.
+ */
+void siftPlantDown(PlantHeap *heap, int position)
+{
+    int plant = heap->slots[position];
+    while (true)
+    {
+        int firstChild = position * PLANT_HEAP_ARITY + 1;
+        if (firstChild >= heap->size)
+        {
+            break;
+        }
+        int lastChild = firstChild + PLANT_HEAP_ARITY < heap->size ? firstChild + PLANT_HEAP_ARITY : heap->size;
+        int best = firstChild;
+        for (int child = firstChild + 1; child < lastChild; child++)
+        {
+            if (hasPriorityOver(heap, heap->slots[child], heap->slots[best]))
+            {
+                best = child;
+            }
+        }
+        if (!hasPriorityOver(heap, heap->slots[best], plant))
+        {
+            break;
+        }
+        heap->slots[position] = heap->slots[best];
+        heap->position[heap->slots[position]] = position;
+        position = best;
+    }
+    heap->slots[position] = plant;
+    heap->position[plant] = position;
+}
+
+/**
+ * Re-keys a plant and restores its place in the working heap in O(log n).
+ *
+ * @param heap The heap of the plant's region in the working heap.
+ * @param plant The id of the plant in the plant store.
+ * @param key The new relative water level of the plant.
+ */
+void updatePlantKey(PlantHeap *heap, int plant, float key)
+{
+    float previous = heap->key[plant];
+    heap->key[plant] = key;
+    if (key > previous)
+    {
+        siftPlantUp(heap, heap->position[plant]);
+    }
+    else if (key < previous)
+    {
+        siftPlantDown(heap, heap->position[plant]);
+    }
+}
+
+/**
+ * Re-keys every plant whose water level in the latest fleet snapshot changed since it was last ordered,
+ * region by region, then publishes the new order for dispatch. Costs O(n) to find the changed plants
+ * plus O(log n) per changed plant, instead of a full re-sort. The working heap is private to the caller,
+ * the sorting thread (or the main thread with the virtual clock), so no lock is taken.
+ */
+void refreshPlantOrder()
+{
+    unsigned long long start = monotonicNanos();
+    int buffer = acquireSnapshot(&fleetSnapshots);
+    const float *waterLevel = ((FleetSnapshot *)fleetSnapshots.buffers[buffer])->waterLevel;
+    for (int r = 0; r < numRegions; r++)
+    {
+        PlantHeap heap = regionHeap(&regions[r], &plantOrder);
+        for (int plant = regions[r].first; plant < regions[r].last; plant++)
+        {
+            float key = relativeWaterLevel(plant, waterLevel[plant]);
+            if (key != plantOrder.key[plant])
+            {
+                updatePlantKey(&heap, plant, key);
+                if (classOrder.size > 0)
+                {
+                    PlantHeap classes = classHeap(&regions[r], plants.classId[plant], &classOrder);
+                    updatePlantKey(&classes, plant, key);
+                }
+            }
+        }
+    }
+    publishPlantOrder(fleetSnapshots.epoch[buffer]);
+    releaseSnapshot(&fleetSnapshots, buffer);
+    recordLatency(LATENCY_SORT, monotonicNanos() - start);
+}
+
+/**
+ * Starts a best-first walk over a plant priority heap. Each call to nextPlantInOrder pops the best
+ * pending heap position from a small frontier and pushes its children, so visiting the first k plants
+ * costs O(k log k) regardless of the fleet size. The heap must not change during the walk.
+ *
+ * @param walk The walk to initialize.
+ * @param heap The heap to walk, the working heap or a published order.
+ */
+void beginPlantWalk(PlantWalk *walk, const PlantHeap *heap)
+{
+    walk->heap = heap;
+    walk->size = 0;
+    walk->capacity = 0;
+    walk->frontier = NULL;
+    if (heap->size > 0)
+    {
+        pushWalkPosition(walk, 0);
+    }
+}
+
+/**
+ * Adds a heap position to the frontier of a walk.
+ *
+ * @param walk The walk in progress.
+ * @param position The heap position to add.
+ */
+void pushWalkPosition(PlantWalk *walk, int position)
+{
+    if (walk->size == walk->capacity)
+    {
+        walk->capacity = walk->capacity > 0 ? walk->capacity * 2 : 64;
+        walk->frontier = realloc(walk->frontier, sizeof(int) * walk->capacity);
+        if (walk->frontier == NULL)
+        {
+            fprintf(stderr, "Error: Could not allocate memory for the plant walk.\n");
+            exit(-1);
+        }
+    }
+
+    int index = walk->size++;
+    while (index > 0)
+    {
+        int parent = (index - 1) / 2;
+        if (!hasPriorityOver(walk->heap, walk->heap->slots[position], walk->heap->slots[walk->frontier[parent]]))
+        {
+            break;
+        }
+        walk->frontier[index] = walk->frontier[parent];
+        index = parent;
+    }
+    walk->frontier[index] = position;
+}
+
+/**
+ * Returns the next plant of a walk in priority order.
+ *
+ * @param walk The walk in progress.
+ * @return The id of the next plant, or -1 once every plant has been visited.
+ */
+int nextPlantInOrder(PlantWalk *walk)
+{
+    if (walk->size == 0)
+    {
+        return -1;
+    }
+
+    // Pop the best pending position from the frontier
+    const PlantHeap *heap = walk->heap;
+    int position = walk->frontier[0];
+    int last = walk->frontier[--walk->size];
+    int index = 0;
+    while (true)
+    {
+        int child = index * 2 + 1;
+        if (child >= walk->size)
+        {
+            break;
+        }
+        if (child + 1 < walk->size && hasPriorityOver(heap, heap->slots[walk->frontier[child + 1]], heap->slots[walk->frontier[child]]))
+        {
+            child++;
+        }
+        if (!hasPriorityOver(heap, heap->slots[walk->frontier[child]], heap->slots[last]))
+        {
+            break;
+        }
+        walk->frontier[index] = walk->frontier[child];
+        index = child;
+    }
+    if (walk->size > 0)
+    {
+        walk->frontier[index] = last;
+    }
+
+    // Its children are the only new candidates for the next position
+    int firstChild = position * PLANT_HEAP_ARITY + 1;
+    for (int child = firstChild; child < firstChild + PLANT_HEAP_ARITY && child < heap->size; child++)
+    {
+        pushWalkPosition(walk, child);
+    }
+    return heap->slots[position];
+}
+
+/**
+ * Releases the frontier of a walk.
+ *
+ * @param walk The walk to finish.
+ */
+void endPlantWalk(PlantWalk *walk)
+{
+    free(walk->frontier);
+    walk->frontier = NULL;
+    walk->size = walk->capacity = 0;
+}
+
+/**
+ * Handles one capacity adjustment request of a region. The dirty set of the region is drained, so a
+ * single dispatch pass covers every plant deactivated there during the coalescing window, and the loans
+ * the region holds are returned so that its own plants cover its demand first. With incremental dispatch
+ * the deficit is first covered from the standby pool; only when the pool cannot cover it does a full
+ * dispatch pass run, after which the sorting thread is woken to refresh the order and refill the pools.
+ * The whole adjustment holds the dispatch mutex of the region, so a checkpoint never sees it half done.
+ *
+ * @param region The region to adjust.
+ */
+void handleAdjustment(Region *region)
+{
+    lockMutex(&region->dispatchMutex);
+    lockMutex(&region->dirtyMutex);
+    float lostCapacity = 0.0;
+    for (int i = 0; i < region->dirtyCount; i++)
+    {
+        lostCapacity += plants.capacity[region->dirtyPlants[i]];
+    }
+    memcpy(region->adjustmentTimes, region->dirtyTimes, sizeof(unsigned long long) * region->dirtyCount);
+    int deactivations = region->dirtyCount;
+    region->dirtyCount = 0;
+    region->adjustmentPending = false;
+    atomic_store(&region->bandChanged, false); // The pass below reads the new band
+    adjustmentPasses++;
+    pthread_mutex_unlock(&region->dirtyMutex);
+
+    logEvent(LOG_EVENT_ADJUSTMENT_REQUIRED, -1, deactivations, regionGeneration(region), lostCapacity);
+    releaseImports(region);
+    if (incrementalDispatch && !atomic_load(&region->waitingForRecover) && applyIncrementalDispatch(region))
+    {
+        incrementalAdjustments++;
+    }
+    else
+    {
+        fullAdjustments += incrementalDispatch;
+        adjustCapacity(region);
+        requestOrderRefresh();
+    }
+    logEvent(LOG_EVENT_ADJUSTED, -1, 0, regionGeneration(region), 0.0f);
+
+    // Every deactivation of the window waited this long for the generation to be restored
+    if (regionGeneration(region) >= region->minGeneration)
+    {
+        unsigned long long now = monotonicNanos();
+        for (int i = 0; i < deactivations; i++)
+        {
+            recordLatency(LATENCY_REDISPATCH, now - region->adjustmentTimes[i]);
+        }
+    }
+    pthread_mutex_unlock(&region->dispatchMutex);
+}
+
+/**
+ * Covers the current generation deficit of a region with plants from its standby pool, in the order
+ * the pool was filled. Plants that stopped being ready since the pool was filled are skipped. The cost
+ * depends on the pool size, not on the fleet size.
+ *
+ * @param region The region to adjust.
+ * @return true if the generation of the region is at least its minimum generation afterwards.
+ */
+bool applyIncrementalDispatch(Region *region)
+{
+    int buffer = acquireSnapshot(&fleetSnapshots);
+    const FleetSnapshot *fleet = fleetSnapshots.buffers[buffer];
+    lockMutex(&region->standbyMutex);
+    while (regionGeneration(region) < region->minGeneration && region->standbyNext < region->standbyCount)
+    {
+        int plant = region->standbyPool[region->standbyNext++];
+        if (isReadyStandby(plant, fleet) && regionGeneration(region) + plants.capacity[plant] <= region->maxGeneration &&
+            activatePlant(plant))
+        {
+            logEvent(LOG_EVENT_STANDBY_ACTIVATED, plant, 0, 0.0f, 0.0f);
+        }
+    }
+    pthread_mutex_unlock(&region->standbyMutex);
+    releaseSnapshot(&fleetSnapshots, buffer);
+    return regionGeneration(region) >= region->minGeneration;
+}
+
+/**
+ * Tells whether a plant can take over generation right away: it is inactive, above its minimum
+ * water level like any dispatch candidate, can afford the next 5.0 generation draw within bounds and,
+ * with lookahead dispatch, can keep generating over the whole horizon.
+ *
+ * @param plant The id of the plant in the plant store.
+ * @param fleet The fleet snapshot.
+ * @return true if the plant is a ready standby plant.
+ */
+bool isReadyStandby(int plant, const FleetSnapshot *fleet)
+{
+    float waterLevel = fleet->waterLevel[plant];
+    float drawn = waterLevel - 5.0f;
+    return !atomic_load_explicit(&plants.isActive[plant], memory_order_relaxed) && waterLevel > plants.minWaterLevel[plant] &&
+           drawn >= plants.minWaterLevel[plant] && drawn <= plants.maxWaterLevel[plant] && sustainsHorizon(plant, fleet);
+}
+
+/**
+ * Projects the water level of a plant over the lookahead horizon as if it were generating from the
+ * next tick on, with the same arithmetic as the water-level kernel. The ongoing rain event is known
+ * from the snapshot; no rain is assumed once it ends, as the next event has not been drawn yet.
+ *
+ * @param plant The id of the plant in the plant store.
+ * @param fleet The fleet snapshot, holding the rain columns when the horizon is not 0.
+ * @return true if every generation draw of the horizon stays within the plant's bounds, or if there is no horizon.
+ */
+bool sustainsHorizon(int plant, const FleetSnapshot *fleet)
+{
+    float level = fleet->waterLevel[plant];
+    int duration = fleet->rainDuration != NULL ? fleet->rainDuration[plant] : 0;
+    for (int tick = 0; tick < lookaheadHorizon; tick++)
+    {
+        int raining = duration > 0;
+        level = level + (float)raining * fleet->rainIncrement[plant] - 5.0f;
+        duration -= raining;
+        if (level < plants.minWaterLevel[plant] || level > plants.maxWaterLevel[plant])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Refills the standby pool of a region with its first STANDBY_POOL_SIZE ready standby plants in
+ * priority order. Runs on the sorting thread right after the order is refreshed, off the dispatch path,
+ * so it walks the working heap directly.
+ *
+ * @param region The region whose pool is refilled.
+ */
+void refillStandbyPool(Region *region)
+{
+    int pool[STANDBY_POOL_SIZE];
+    int count = 0;
+    PlantWalk walk;
+    int plant;
+
+    int buffer = acquireSnapshot(&fleetSnapshots);
+    const FleetSnapshot *fleet = fleetSnapshots.buffers[buffer];
+    PlantHeap heap = regionHeap(region, &plantOrder);
+    beginPlantWalk(&walk, &heap);
+    while (count < STANDBY_POOL_SIZE && (plant = nextPlantInOrder(&walk)) != -1)
+    {
+        if (isReadyStandby(plant, fleet))
+        {
+            pool[count++] = plant;
+        }
+    }
+    endPlantWalk(&walk);
+    releaseSnapshot(&fleetSnapshots, buffer);
+
+    lockMutex(&region->standbyMutex);
+    memcpy(region->standbyPool, pool, sizeof(int) * count);
+    region->standbyCount = count;
+    region->standbyNext = 0;
+    pthread_mutex_unlock(&region->standbyMutex);
+}
+
+/**
+ * Restores the generation of a region to at least its minimum generation with the selected dispatch
+ * algorithm, then with loans from the other regions if transfers are enabled.
+ * If the minimum capacity isn't reached, the region starts recovering: generation is paused in it and
+ * a recovery attempt, one more pass like this one, is scheduled recoveryInterval ticks later, spending
+ * one of the attempts left. Nothing waits here, the clock runs the attempt when it falls due, and the
+ * dispatcher is free for the other regions meanwhile. If the recovery attempts run out, it triggers
+ * a shutdown sequence.
+ *
+ * @param region The region to adjust.
+ * @return A boolean indicating whether a satisfactory generation level was achieved (true) or not (false).
+ */
+bool adjustCapacity(Region *region)
+{
+    bool recovering = atomic_load(&region->waitingForRecover);
+    if (recovering)
+    {
+        recordLatency(LATENCY_RECOVERY_WAIT, monotonicNanos() - region->retryScheduledAt);
+    }
+    unsigned long long start = monotonicNanos();
+    bool reached = dispatchMode == DISPATCH_EXACT ? applyExactDispatch(region) : applyGreedyAlgorithm(region);
+    recordLatency(LATENCY_DISPATCH, monotonicNanos() - start);
+    dispatchPasses++;
+    if (!reached && transferLimit > 0.0f && numRegions > 1)
+    {
+        reached = borrowGeneration(region);
+    }
+
+    if (reached)
+    {
+        if (recovering)
+        {
+            atomic_store(&region->waitingForRecover, false);
+            recoveries++;
+            if (recoveryRefill == REFILL_SUCCESS)
+            {
+                atomic_store(&region->lastShots, recoveryBudget);
+            }
+            logEvent(LOG_EVENT_RECOVERED, -1, atomic_load(&region->lastShots), regionGeneration(region), 0.0f);
+        }
+        return true;
+    }
+    if (atomic_load(&region->lastShots) > 0)
+    {
+        int shotsLeft = atomic_fetch_sub(&region->lastShots, 1) - 1;
+        unsigned long none = NO_TICK;
+        atomic_compare_exchange_strong(&firstRecoveryTick, &none, currentTick);
+        region->retryScheduledAt = monotonicNanos();
+        atomic_store(&region->retryTick, currentTick + recoveryInterval); // Due before the region reads as recovering
+        atomic_store(&region->waitingForRecover, true);
+        logEvent(LOG_EVENT_RECOVERY_ATTEMPT, -1, shotsLeft, 0.0f, 0.0f);
+        recoveryAttempts++;
+    }
+    else
+    {
+        shutdownPlantsAndPrintFinalStatus();
+    }
+    return false;
+}
+
+/**
+ * Applies a greedy algorithm to activate the hydroelectric plants of a region optimally.
+ * The algorithm walks the plants in priority order and activates them if doing so doesn't exceed
+ * the maximum generation of the region and if the plant's water level is above its minimum.
+ * It aims to reach at least the minimum generation of the region. With lookahead dispatch a first
+ * walk only takes the plants that sustain generation over the horizon, and a second walk with the
+ * plain rule runs only if the first one falls short of the minimum.
+ *
+ * @param region The region to dispatch.
+ * @return A boolean indicating whether the minimum generation capacity was reached (true) or not (false).
+ */
+bool applyGreedyAlgorithm(Region *region)
+{
+    logEvent(LOG_EVENT_GREEDY_PASS, -1, 0, 0.0f, 0.0f);
+
+    float generation = regionGeneration(region);
+    bool reached = false;
+    PlantWalk walk;
+    int plant;
+
+    // Activate plants optimally, those that sustain the horizon first
+    DispatchView view;
+    openDispatchView(&view, region);
+    for (int pass = lookaheadHorizon > 0 ? 0 : 1; pass < 2 && !reached; pass++)
+    {
+        lookaheadFallbacks += pass == 1 && lookaheadHorizon > 0;
+        beginPlantWalk(&walk, &view.order);
+        while ((plant = nextPlantInOrder(&walk)) != -1)
+        {
+            if (!atomic_load(&plants.isActive[plant]) && view.waterLevel[plant] > plants.minWaterLevel[plant] &&
+                generation + plants.capacity[plant] <= region->maxGeneration)
+            {
+                if (pass == 0 && !sustainsHorizon(plant, view.fleet))
+                {
+                    lookaheadSkips++;
+                }
+                else if (activatePlant(plant))
+                {
+                    logEvent(LOG_EVENT_PLANT_ACTIVATED, plant, 0, 0.0f, 0.0f);
+                    generation += plants.capacity[plant];
+                }
+            }
+            if (generation >= region->minGeneration)
+            {
+                reached = true;
+                break; // Stop if minimum generation is reached
+            }
+        }
+        endPlantWalk(&walk);
+    }
+    closeDispatchView(&view);
+    return reached;
+}
+
+/**
+ * Exact dispatch over plant classes. The eligible plants (inactive, above their minimum water level)
+ * are collected per class in priority order, walking the heap of each class of the region in the class
+ * order, and never more per class than can fit in the band, so the search does not depend on the fleet
+ * size. A bounded knapsack over the class counts, solved by dynamic programming on capacities in
+ * 1/DISPATCH_UNITS_PER_MW MW units, finds the smallest added capacity that brings the generation of the
+ * region within its band, using the fewest plants on ties.
+ * The plants with the highest water level of each class are then activated. With lookahead dispatch
+ * the plants that sustain generation over the horizon come first in each class, and the others only
+ * make up the classes that run short of them.
+ *
+ * @param region The region to dispatch.
+ * @return A boolean indicating whether the minimum generation capacity was reached (true) or not (false).
+ */
+bool applyExactDispatch(Region *region)
+{
+    logEvent(LOG_EVENT_EXACT_PASS, -1, 0, 0.0f, 0.0f);
+
+    float generation = regionGeneration(region);
+    if (generation >= region->minGeneration)
+    {
+        return true;
+    }
+
+    int units[MAX_PLANT_CLASSES], limit[MAX_PLANT_CLASSES], found[MAX_PLANT_CLASSES], sustaining[MAX_PLANT_CLASSES], spares[MAX_PLANT_CLASSES];
+    int seen[MAX_PLANT_CLASSES];
+    int largest = 0;
+    for (int c = 0; c < numPlantClasses; c++)
+    {
+        units[c] = (int)lroundf(plantClasses[c].capacity * DISPATCH_UNITS_PER_MW);
+        largest = units[c] > largest ? units[c] : largest;
+    }
+
+    // Band still to fill, in capacity units. Adding plants one at a time, the first sum that reaches low
+    // is below low + largest, so no larger sum can be the smallest one within the band.
+    float lowUnits = ceilf((region->minGeneration - generation) * DISPATCH_UNITS_PER_MW - 1e-3f);
+    float highUnits = floorf((region->maxGeneration - generation) * DISPATCH_UNITS_PER_MW + 1e-3f);
+    if (!(highUnits >= lowUnits) || lowUnits > (float)(INT_MAX / 2) || largest == 0)
+    {
+        greedyShortfalls++;
+        return false;
+    }
+    int low = (int)lowUnits;
+    int high = highUnits < (float)(low + largest - 1) ? (int)highUnits : low + largest - 1;
+
+    // Collect the eligible plants of each class in priority order, up to the most the band can hold
+    int *candidates[MAX_PLANT_CLASSES];
+    int *spare[MAX_PLANT_CLASSES];    // Eligible plants that cannot sustain the horizon, in priority order
+    int *eligible[MAX_PLANT_CLASSES]; // The first eligible plants, in priority order, for the greedy outcome
+    PlantWalk walk;
+    int plant;
+    DispatchView view;
+    openDispatchView(&view, region);
+    for (int c = 0; c < numPlantClasses; c++)
+    {
+        PlantHeap heap = classHeap(region, c, view.classOrder);
+        limit[c] = units[c] > 0 ? high / units[c] : 0;
+        limit[c] = limit[c] < heap.size ? limit[c] : heap.size;
+        found[c] = 0;
+        spares[c] = 0;
+        seen[c] = 0;
+        int slot = region->classFirst[c] - region->first; // The class has heap.size >= limit[c] slots from here
+        candidates[c] = region->exactCandidates + slot;
+        spare[c] = region->exactSpares != NULL ? region->exactSpares + slot : NULL;
+        eligible[c] = region->exactEligible + slot;
+        if (limit[c] == 0)
+        {
+            continue;
+        }
+
+        beginPlantWalk(&walk, &heap);
+        while (found[c] < limit[c] && (plant = nextPlantInOrder(&walk)) != -1)
+        {
+            if (atomic_load(&plants.isActive[plant]) || view.waterLevel[plant] <= plants.minWaterLevel[plant])
+            {
+                continue;
+            }
+            if (seen[c] < limit[c])
+            {
+                eligible[c][seen[c]++] = plant;
+            }
+            if (sustainsHorizon(plant, view.fleet))
+            {
+                candidates[c][found[c]++] = plant;
+            }
+            else if (spares[c] < limit[c])
+            {
+                spare[c][spares[c]++] = plant;
+            }
+        }
+        endPlantWalk(&walk);
+    }
+
+    // Greedy walks the same plants merged in priority order. It adds a prefix of each class, as a plant
+    // that does not fit means none after it of the same capacity does, and never more than the limit,
+    // as it stops below low + largest, so the plants collected decide whether it reaches the minimum.
+    bool greedyReached = false;
+    float greedyGeneration = generation;
+    int next[MAX_PLANT_CLASSES] = {0};
+    while (!greedyReached)
+    {
+        int first = -1;
+        for (int c = 0; c < numPlantClasses; c++)
+        {
+            if (next[c] < seen[c] && (first < 0 || hasPriorityOver(view.classOrder, eligible[c][next[c]], eligible[first][next[first]])))
+            {
+                first = c;
+            }
+        }
+        if (first < 0)
+        {
+            break;
+        }
+        plant = eligible[first][next[first]++];
+        if (greedyGeneration + plants.capacity[plant] <= region->maxGeneration)
+        {
+            greedyGeneration += plants.capacity[plant];
+        }
+        greedyReached = greedyGeneration >= region->minGeneration;
+    }
+    closeDispatchView(&view);
+
+    // The classes short of plants that sustain the horizon are made up with the others
+    long long available = 0;
+    for (int c = 0; c < numPlantClasses; c++)
+    {
+        sustaining[c] = found[c];
+        for (int k = 0; k < spares[c] && found[c] < limit[c]; k++)
+        {
+            candidates[c][found[c]++] = spare[c][k];
+        }
+        available += (long long)found[c] * units[c];
+    }
+    high = available < high ? (int)available : high;
+
+    // Split each class count into 1, 2, 4, ... items so the bounded knapsack becomes a 0/1 knapsack
+    int itemClass[MAX_PLANT_CLASSES * 32], itemCount[MAX_PLANT_CLASSES * 32];
+    int numItems = 0;
+    for (int c = 0; c < numPlantClasses; c++)
+    {
+        for (int chunk = 1, left = found[c]; left > 0; left -= chunk, chunk *= 2)
+        {
+            itemClass[numItems] = c;
+            itemCount[numItems] = chunk < left ? chunk : left;
+            numItems++;
+        }
+    }
+
+    // fewest[s]: fewest plants adding exactly s units; taken[i][s]: whether item i was used to get there
+    int *fewest = malloc(sizeof(int) * (high + 1));
+    unsigned char *taken = calloc((size_t)(numItems > 0 ? numItems : 1) * (high + 1), 1);
+    if (fewest == NULL || taken == NULL)
+    {
+        fprintf(stderr, "Error: Could not allocate memory for the exact dispatch.\n");
+        exit(-1);
+    }
+    fewest[0] = 0;
+    for (int sum = 1; sum <= high; sum++)
+    {
+        fewest[sum] = INT_MAX;
+    }
+    for (int i = 0; i < numItems; i++)
+    {
+        int weight = itemCount[i] * units[itemClass[i]];
+        for (int sum = high; sum >= weight; sum--)
+        {
+            if (fewest[sum - weight] != INT_MAX && fewest[sum - weight] + itemCount[i] < fewest[sum])
+            {
+                fewest[sum] = fewest[sum - weight] + itemCount[i];
+                taken[(size_t)i * (high + 1) + sum] = 1;
+            }
+        }
+    }
+
+    int best = -1;
+    for (int sum = low > 0 ? low : 0; sum <= high && best < 0; sum++)
+    {
+        if (fewest[sum] != INT_MAX)
+        {
+            best = sum;
+        }
+    }
+
+    // Activate the chosen number of plants of each class, best water level first
+    if (best >= 0)
+    {
+        int use[MAX_PLANT_CLASSES] = {0};
+        for (int i = numItems - 1, sum = best; i >= 0; i--)
+        {
+            if (taken[(size_t)i * (high + 1) + sum])
+            {
+                use[itemClass[i]] += itemCount[i];
+                sum -= itemCount[i] * units[itemClass[i]];
+            }
+        }
+        bool fellBack = false;
+        for (int c = 0; c < numPlantClasses; c++)
+        {
+            int sparesUsed = use[c] > sustaining[c] ? use[c] - sustaining[c] : 0;
+            lookaheadSkips += spares[c] - sparesUsed;
+            fellBack = fellBack || sparesUsed > 0;
+            for (int k = 0; k < use[c]; k++)
+            {
+                if (activatePlant(candidates[c][k]))
+                {
+                    logEvent(LOG_EVENT_PLANT_ACTIVATED, candidates[c][k], 0, 0.0f, 0.0f);
+                }
+            }
+        }
+        lookaheadFallbacks += fellBack;
+    }
+
+    greedyShortfalls += !greedyReached;
+    exactRescues += !greedyReached && best >= 0;
+
+    free(fewest);
+    free(taken);
+    return best >= 0;
+}
+
+/**
+ * Shuts down all hydroelectric plants and prints their final status. This function is called when no
+ * combination of plant activations can maintain the required energy generation levels of a region.
+ * It iterates through all the plants, region by region, printing their final water level and
+ * activation status before signaling the program to shut down.
+ */
+void shutdownPlantsAndPrintFinalStatus()
+{
+    logEvent(LOG_EVENT_FLEET_SHUTDOWN, -1, 0, 0.0f, 0.0f);
+    unsigned long none = NO_TICK;
+    atomic_compare_exchange_strong(&fleetShutdownTick, &none, currentTick);
+    PlantWalk walk;
+    int plant;
+
+    for (int r = 0; r < numRegions; r++)
+    {
+        DispatchView view;
+        openDispatchView(&view, &regions[r]);
+        beginPlantWalk(&walk, &view.order);
+        while ((plant = nextPlantInOrder(&walk)) != -1)
+        {
+            logEvent(LOG_EVENT_PLANT_FINAL_STATE, plant, atomic_load(&plants.isActive[plant]), view.waterLevel[plant], 0.0f);
+        }
+        endPlantWalk(&walk);
+        closeDispatchView(&view);
+    }
+    shutdownRequested = 1;
+}
+/**
+ * Opens the log output and starts the writer thread. Text output keeps the ANSI colors only when it
+ * goes to a terminal. A binary log starts with a LogFileHeader.
+ */
+void startLogger()
+{
+    logOutput = logPath != NULL ? fopen(logPath, logFormat == LOG_FORMAT_BINARY ? "wb" : "w") : stdout;
+    if (logOutput == NULL)
+    {
+        fprintf(stderr, "Error: Could not open the log file %s.\n", logPath);
+        exit(-1);
+    }
+    if (logFormat == LOG_FORMAT_BINARY)
+    {
+        LogFileHeader header = {{'B', 'L', 'A', 'C', 'K', 'L', 'O', 'G'}, 1, sizeof(LogRecord)};
+        fwrite(&header, sizeof(header), 1, logOutput);
+    }
+    else if (!isatty(fileno(logOutput)))
+    {
+        c_red = c_green = c_blue = c_magenta = c_white = c_yellow = c_cian = c_end = c_orange = c_pink = "";
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    placeThread(&attr, ROLE_SERVICE, 0);
+    pthread_create(&logWriterThread, &attr, logWriterRoutine, NULL);
+    pthread_attr_destroy(&attr);
+}
+
+/**
+ * Stops the writer thread once it has drained every ring, then releases the rings and closes the output.
+ * Must be called after every thread that logs has stopped.
+ */
+void stopLogger()
+{
+    atomic_store(&logStopping, true);
+    pthread_join(logWriterThread, NULL);
+
+    LogRing *ring = atomic_load(&logRings);
+    while (ring != NULL)
+    {
+        LogRing *next = ring->next;
+        logDropped += atomic_load(&ring->dropped);
+        free(ring);
+        ring = next;
+    }
+    atomic_store(&logRings, NULL);
+    threadLogRing = NULL;
+
+    fflush(logOutput);
+    if (logOutput != stdout)
+    {
+        fclose(logOutput);
+    }
+}
+
+/**
+ * Records an event in the log ring of the calling thread. Events below the selected log level cost a
+ * single comparison. Nothing is formatted here and the call never blocks: if the ring is full, the
+ * record is dropped and counted.
+ *
+ * @param event The LOG_EVENT_* being recorded.
+ * @param plant The id of the plant in the plant store, or -1 if the event is not about a plant.
+ * @param count The integer field of the event.
+ * @param first The first value field of the event.
+ * @param second The second value field of the event.
+ */
+void logEvent(int event, int plant, int count, float first, float second)
+{
+    if (logEventLevels[event] > logLevel)
+    {
+        return;
+    }
+    LogRing *ring = threadLogRing != NULL ? threadLogRing : attachLogRing();
+    unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) == LOG_RING_SIZE)
+    {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    LogRecord *record = &ring->records[tail & (LOG_RING_SIZE - 1)];
+    record->time = monotonicNanos();
+    record->tick = currentTick;
+    record->plant = plant;
+    record->count = count;
+    record->value[0] = first;
+    record->value[1] = second;
+    record->event = (unsigned char)event;
+    record->level = logEventLevels[event];
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release); // Hand the record to the writer
+}
+
+/**
+ * Gives the calling thread its own log ring and links it where the writer thread finds it.
+ * Runs once per thread, on its first logged event.
+ *
+ * @return The log ring of the calling thread.
+ */
+LogRing *attachLogRing()
+{
+    LogRing *ring = aligned_alloc(COLUMN_ALIGNMENT, sizeof(LogRing));
+    if (ring == NULL)
+    {
+        fprintf(stderr, "Error: Could not allocate memory for the log ring.\n");
+        exit(-1);
+    }
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->dropped, 0);
+    ring->limit = 0;
+    memset(ring->records, 0, sizeof(ring->records));
+
+    ring->next = atomic_load(&logRings);
+    while (!atomic_compare_exchange_weak(&logRings, &ring->next, ring))
+    {
+    }
+    threadLogRing = ring;
+    return ring;
+}
+
+/**
+ * The routine for the log writer thread. Drains the rings whenever records are waiting and sleeps for a
+ * millisecond otherwise. On shutdown it drains until every ring is empty before exiting.
+ *
+ * @return Returns NULL upon completion.
+ */
+void *logWriterRoutine()
+{
+    while (true)
+    {
+        bool stopping = atomic_load(&logStopping); // Read first so the last pass sees every record
+        unsigned long written = drainLogRings();
+        fflush(logOutput);
+        if (written == 0)
+        {
+            if (stopping)
+            {
+                break;
+            }
+            usleep(1000);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Writes the records waiting in every ring, merged in timestamp order, and frees their slots.
+ * Records published while the pass runs are left for the next pass.
+ *
+ * @return The number of records written.
+ */
+unsigned long drainLogRings()
+{
+    LogRing *first = atomic_load(&logRings);
+    for (LogRing *ring = first; ring != NULL; ring = ring->next)
+    {
+        ring->limit = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    }
+
+    unsigned long written = 0;
+    while (true)
+    {
+        // Pick the oldest record at the head of the rings
+        LogRing *oldest = NULL;
+        const LogRecord *record = NULL;
+        for (LogRing *ring = first; ring != NULL; ring = ring->next)
+        {
+            unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+            if (head != ring->limit)
+            {
+                const LogRecord *candidate = &ring->records[head & (LOG_RING_SIZE - 1)];
+                if (record == NULL || candidate->time < record->time)
+                {
+                    oldest = ring;
+                    record = candidate;
+                }
+            }
+        }
+        if (oldest == NULL)
+        {
+            break;
+        }
+        writeLogRecord(record);
+        atomic_fetch_add_explicit(&oldest->head, 1, memory_order_release); // Give the slot back to the producer
+        written++;
+    }
+    logWritten += written;
+    return written;
+}
+
+/**
+ * Writes one log record to the log output, as is in the binary format or as a line of text.
+ *
+ * @param record The record to write.
+ */
+void writeLogRecord(const LogRecord *record)
+{
+    if (logFormat == LOG_FORMAT_BINARY)
+    {
+        fwrite(record, sizeof(LogRecord), 1, logOutput);
+        return;
+    }
+
+    char name[PLANT_NAME_SIZE];
+    int plant = record->plant;
+    switch (record->event)
+    {
+    case LOG_EVENT_PLANT_GENERATED:
+        fprintf(logOutput, "%s %s %s Central %s - water_level: %.2f - water_flow: %.2f m/s.\n", c_cian, rainTypeCodes[record->count], c_end,
+                plantName(plant, name), record->value[0], record->value[1]);
+        break;
+    case LOG_EVENT_PLANT_DEACTIVATED:
+        fprintf(logOutput, "%sDeactivating plant %s.%s\n", c_red, plantName(plant, name), c_end);
+        break;
+    case LOG_EVENT_PLANT_ACTIVATED:
+        fprintf(logOutput, "%sActivated Plant %s%s\n", c_blue, plantName(plant, name), c_end);
+        break;
+    case LOG_EVENT_STANDBY_ACTIVATED:
+        fprintf(logOutput, "%sActivated standby Plant %s%s\n", c_blue, plantName(plant, name), c_end);
+        break;
+    case LOG_EVENT_ADJUSTMENT_REQUIRED:
+        fprintf(logOutput, "%sCapacity adjustment required: %f MW/s after %d deactivations (%f MW/s lost)%s\n", c_yellow,
+                record->value[0], record->count, record->value[1], c_end);
+        break;
+    case LOG_EVENT_ADJUSTED:
+        fprintf(logOutput, "%sAdjusted capacity: %f MW/s%s\n", c_green, record->value[0], c_end);
+        break;
+    case LOG_EVENT_GREEDY_PASS:
+        fprintf(logOutput, "Applying greedy algorithm.\n");
+        break;
+    case LOG_EVENT_EXACT_PASS:
+        fprintf(logOutput, "Applying exact dispatch.\n");
+        break;
+    case LOG_EVENT_RECOVERY_ATTEMPT:
+        fprintf(logOutput, "%sALERT: starting recovery attempts before immediate shutdown - %i.%s\n", c_red, record->count, c_end);
+        break;
+    case LOG_EVENT_FLEET_SHUTDOWN:
+        fprintf(logOutput, "%sNo combination can maintain the plants operational. Proceeding to shut down everything.%s\n", c_red, c_end);
+        fprintf(logOutput, "%sBelow is the final state of each plant.%s\n", c_red, c_end);
+        break;
+    case LOG_EVENT_PLANT_FINAL_STATE:
+        fprintf(logOutput, "Plant: %s, Min Water Level: %.2f, Max Water Level: %.2f, Current Water Level: %.2f, Status: %s\n",
+                plantName(plant, name),
+                plants.minWaterLevel[plant],
+                plants.maxWaterLevel[plant],
+                record->value[0],
+                record->count ? "Activated" : "Deactivated");
+        break;
+    case LOG_EVENT_TRANSFER:
+        fprintf(logOutput, "%sRegion %d lends %f MW/s to region %d, now at %f MW/s%s\n", c_yellow, record->count / MAX_REGIONS + 1,
+                record->value[0], record->count % MAX_REGIONS + 1, record->value[1], c_end);
+        break;
+    case LOG_EVENT_RECOVERED:
+        fprintf(logOutput, "%sRecovered: generation back to %f MW/s, %i recovery attempts left.%s\n", c_green, record->value[0], record->count, c_end);
+        break;
+    case LOG_EVENT_WEATHER_CHANGED:
+        fprintf(logOutput, "%sWeather probabilities changed to %f, %f, %f.%s\n", c_magenta, record->value[0], record->value[1],
+                1.0f - record->value[0] - record->value[1], c_end);
+        break;
+    case LOG_EVENT_BAND_CHANGED:
+        fprintf(logOutput, "%sDemand band of region %d changed to %.1f-%.1f MW/s.%s\n", c_magenta, record->count + 1, record->value[0],
+                record->value[1], c_end);
+        break;
+    }
+}
+
+/**
+ * Reads the monotonic clock used for timestamps and latencies.
+ *
+ * @return The current CLOCK_MONOTONIC time in nanoseconds.
+ */
+unsigned long long monotonicNanos()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * Locks a mutex and records how long the caller waited for it. An uncontended lock is taken with a
+ * single trylock and recorded as a zero wait, so the histogram also tells how often there is contention.
+ *
+ * @param mutex The mutex to lock.
+ */
+void lockMutex(pthread_mutex_t *mutex)
+{
+    if (pthread_mutex_trylock(mutex) == 0)
+    {
+        recordLatency(LATENCY_LOCK_WAIT, 0);
+        return;
+    }
+    unsigned long long start = monotonicNanos();
+    pthread_mutex_lock(mutex);
+    recordLatency(LATENCY_LOCK_WAIT, monotonicNanos() - start);
+}
+
+/**
+ * Maps a latency to its histogram bucket. Values below 2^HISTOGRAM_SUB_BITS get a bucket each; above
+ * that, every power of two is split into 2^(HISTOGRAM_SUB_BITS - 1) equal buckets.
+ *
+ * @param nanos The latency in nanoseconds.
+ * @return The index of the bucket.
+ */
+int latencyBucket(unsigned long long nanos)
+{
+    if (nanos < (1ULL << HISTOGRAM_SUB_BITS))
+    {
+        return (int)nanos;
+    }
+    int shift = 63 - __builtin_clzll(nanos) - HISTOGRAM_SUB_BITS + 1; // Leaves HISTOGRAM_SUB_BITS significant bits
+    return (shift << (HISTOGRAM_SUB_BITS - 1)) + (int)(nanos >> shift);
+}
+
+/**
+ * Returns the smallest latency that falls into a histogram bucket.
+ *
+ * @param bucket The index of the bucket.
+ * @return The lower bound of the bucket in nanoseconds.
+ */
+unsigned long long latencyBucketStart(int bucket)
+{
+    if (bucket < (1 << HISTOGRAM_SUB_BITS))
+    {
+        return (unsigned long long)bucket;
+    }
+    int shift = (bucket >> (HISTOGRAM_SUB_BITS - 1)) - 1;
+    return (unsigned long long)(bucket - (shift << (HISTOGRAM_SUB_BITS - 1))) << shift;
+}
+
+/**
+ * Adds a latency to one of the instrumentation histograms. Safe to call from any thread.
+ *
+ * @param histogram The LATENCY_* histogram.
+ * @param nanos The latency in nanoseconds.
+ */
+void recordLatency(int histogram, unsigned long long nanos)
+{
+    LatencyHistogram *h = &latencies[histogram];
+    atomic_fetch_add_explicit(&h->counts[latencyBucket(nanos)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->total, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, nanos, memory_order_relaxed);
+}
+
+/**
+ * Writes a histogram to the stats output as a JSON object: count, mean, min, percentiles and max,
+ * then the non-empty buckets as [lower bound, count] pairs. Percentiles report the upper bound of the
+ * bucket they fall into, so they never understate a latency.
+ *
+ * @param histogram The histogram to write.
+ */
+void writeHistogramJson(const LatencyHistogram *histogram)
+{
+    unsigned long counts[HISTOGRAM_BUCKETS];
+    unsigned long total = 0;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++)
+    {
+        counts[b] = atomic_load_explicit(&histogram->counts[b], memory_order_relaxed);
+        total += counts[b];
+    }
+    unsigned long long sum = atomic_load_explicit(&histogram->sum, memory_order_relaxed);
+
+    const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    const char *quantileNames[] = {"p50", "p90", "p99", "p999"};
+    unsigned long long values[4] = {0};
+    unsigned long long min = 0, max = 0;
+    unsigned long seen = 0;
+    int q = 0;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++)
+    {
+        if (counts[b] == 0)
+        {
+            continue;
+        }
+        unsigned long long end = latencyBucketStart(b + 1) - 1;
+        min = seen == 0 ? latencyBucketStart(b) : min;
+        max = end;
+        seen += counts[b];
+        while (q < 4 && (double)seen >= quantiles[q] * total)
+        {
+            values[q++] = end;
+        }
+    }
+
+    fprintf(statsOutput, "{\"count\":%lu,\"mean\":%.1f,\"min\":%llu", total, total > 0 ? (double)sum / total : 0.0, min);
+    for (q = 0; q < 4; q++)
+    {
+        fprintf(statsOutput, ",\"%s\":%llu", quantileNames[q], values[q]);
+    }
+    fprintf(statsOutput, ",\"max\":%llu,\"buckets\":[", max);
+    bool first = true;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++)
+    {
+        if (counts[b] > 0)
+        {
+            fprintf(statsOutput, "%s[%llu,%lu]", first ? "" : ",", latencyBucketStart(b), counts[b]);
+            first = false;
+        }
+    }
+    fprintf(statsOutput, "]}");
+}
+
+/**
+ * Writes the instrumentation as one JSON line: fleet size, startup times, tick throughput, peak resident
+ * memory, generation, ticks below the minimum generation, recovery attempts, the generation of every
+ * region and every latency histogram. Times are in nanoseconds.
+ *
+ * @param reason What triggered the dump, "signal" or "shutdown".
+ */
+void dumpStats(const char *reason)
+{
+    unsigned long long running = engineStartedAt > 0 ? monotonicNanos() - engineStartedAt : 0;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(statsOutput, "{\"reason\":\"%s\",\"plants\":%d,\"workers\":%d,\"tick\":%lu,\"fleetCreation\":%llu,\"orderBuild\":%llu,"
+                         "\"running\":%llu,\"plantTicksPerSecond\":%.0f,\"peakRssKiB\":%ld,",
+            reason, plants.count, numWorkers, currentTick, fleetCreationNanos, orderBuildNanos, running,
+            running > 0 ? (double)plants.count * (currentTick - engineStartTick) * 1e9 / running : 0.0, usage.ru_maxrss);
+    fprintf(statsOutput, "\"schedule\":\"%s\",\"advancedPlantTicks\":%llu,", scheduleNames[scheduleMode], advancedPlantTicks);
+    fprintf(statsOutput, "\"horizon\":%d,\"activations\":%lu,\"churnPairs\":%lu,\"lookaheadSkips\":%lu,\"lookaheadFallbacks\":%lu,",
+            lookaheadHorizon, activations, churnPairs, lookaheadSkips, lookaheadFallbacks);
+    fprintf(statsOutput, "\"generation\":%f,\"ticksBelowMinimum\":%lu,\"recoveryAttempts\":%lu,\"recoveries\":%lu,\"transfers\":%lu,\"regions\":[",
+            currentGeneration(), ticksBelowMinimum, recoveryAttempts, recoveries, transfers);
+    for (int r = 0; r < numRegions; r++)
+    {
+        const Region *region = &regions[r];
+        fprintf(statsOutput, "%s{\"plants\":%d,\"generation\":%f,\"imported\":%f,\"exported\":%f,\"recoveryShotsLeft\":%d,"
+                             "\"recovering\":%s,\"blackoutSeconds\":%lu,\"recoveringSeconds\":%lu}",
+                r > 0 ? "," : "", region->last - region->first, regionGeneration(region),
+                (float)atomic_load(&region->importedKilowatts) / 1000.0f, (float)atomic_load(&region->exportedKilowatts) / 1000.0f,
+                atomic_load(&region->lastShots), atomic_load(&region->waitingForRecover) ? "true" : "false", region->blackoutTicks,
+                region->recoveringTicks);
+    }
+    fprintf(statsOutput, "],\"unit\":\"ns\",\"latencies\":{");
+    for (int h = 0; h < LATENCY_HISTOGRAMS; h++)
+    {
+        fprintf(statsOutput, "%s\"%s\":", h > 0 ? "," : "", latencyNames[h]);
+        writeHistogramJson(&latencies[h]);
+    }
+    fprintf(statsOutput, "}}\n");
+    fflush(statsOutput);
+}
+
+/**
+ * Writes a checkpoint of the simulation: the plant store arena as is (water levels, activation flags,
+ * rain events, regions), the plant classes, the band, recovery state, standby pool and waiting plants
+ * of every region, the loans between regions, the plant order dispatch works with and the tick and seed
+ * that position the weather streams. The file is written next to the target and renamed over it, so a
+ * checkpoint is never torn. The workers are parked between ticks, and the dispatch mutex of every region
+ * is held until the plant store is written, so no dispatcher switches plants on during the copy; with
+ * the wall clock, a dispatch pass under way finishes first.
+ *
+ * @param path The path of the checkpoint file.
+ */
+void writeCheckpoint(const char *path)
+{
+    char temporary[PATH_MAX];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+    FILE *file = fopen(temporary, "wb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Error: Could not write the checkpoint %s.\n", path);
+        return;
+    }
+
+    CheckpointHeader header = {.version = CHECKPOINT_VERSION, .headerSize = sizeof(CheckpointHeader)};
+    memcpy(header.magic, "BLACKCKP", sizeof(header.magic));
+    header.tick = currentTick;
+    header.seed = randomSeed;
+    header.plantCount = plants.count;
+    header.numPlantClasses = numPlantClasses;
+    header.numRegions = numRegions;
+    header.coalesceTicks = coalesceTicks;
+    header.arenaSize = plants.arenaSize;
+    unsigned long long counters[CHECKPOINT_COUNTERS] = {
+        dispatchPasses, greedyShortfalls, exactRescues, adjustmentEvents, adjustmentPasses, incrementalAdjustments,
+        fullAdjustments, ticksBelowMinimum, recoveryAttempts, recoveries, transfers, lookaheadSkips, lookaheadFallbacks,
+        activations, churnPairs, advancedPlantTicks, weatherStalls, controlQueries, controlChangesApplied};
+    memcpy(header.counters, counters, sizeof(counters));
+
+    // The dispatchers are held off, and the dirty sets stay locked, in region order, until they are written
+    for (int r = 0; r < numRegions; r++)
+    {
+        lockMutex(&regions[r].dispatchMutex);
+    }
+    CheckpointRegion records[MAX_REGIONS];
+    int dirtyCount = 0;
+    for (int r = 0; r < numRegions; r++)
+    {
+        Region *region = &regions[r];
+        CheckpointRegion *record = &records[r];
+        memset(record, 0, sizeof(*record));
+        record->minGeneration = region->minGeneration;
+        record->maxGeneration = region->maxGeneration;
+        record->lastShots = atomic_load(&region->lastShots);
+        record->waitingForRecover = atomic_load(&region->waitingForRecover);
+        record->retryTick = atomic_load(&region->retryTick);
+        record->inBandTicks = region->inBandTicks;
+        record->blackoutTicks = region->blackoutTicks;
+        record->recoveringTicks = region->recoveringTicks;
+        lockMutex(&region->standbyMutex);
+        record->standbyCount = region->standbyCount;
+        record->standbyNext = region->standbyNext;
+        memcpy(record->standbyPool, region->standbyPool, sizeof(int) * region->standbyCount);
+        pthread_mutex_unlock(&region->standbyMutex);
+        lockMutex(&region->dirtyMutex);
+        record->dirtyCount = region->dirtyCount;
+        dirtyCount += region->dirtyCount;
+    }
+    long long loans[MAX_REGIONS * MAX_REGIONS];
+    lockMutex(&transferMutex);
+    for (int lender = 0; lender < numRegions; lender++)
+    {
+        memcpy(loans + lender * numRegions, transferKilowatts[lender], sizeof(long long) * numRegions);
+    }
+    pthread_mutex_unlock(&transferMutex);
+
+    // Sections after the header, the arena and the keys at page boundaries
+    header.classesOffset = sizeof(CheckpointHeader);
+    header.regionsOffset = header.classesOffset + sizeof(PlantClass) * numPlantClasses;
+    header.transfersOffset = header.regionsOffset + sizeof(CheckpointRegion) * numRegions;
+    header.dirtyOffset = header.transfersOffset + sizeof(long long) * numRegions * numRegions;
+    header.arenaOffset = (header.dirtyOffset + sizeof(int) * dirtyCount + CHECKPOINT_ALIGNMENT - 1) / CHECKPOINT_ALIGNMENT * CHECKPOINT_ALIGNMENT;
+    header.keysOffset = (header.arenaOffset + header.arenaSize + CHECKPOINT_ALIGNMENT - 1) / CHECKPOINT_ALIGNMENT * CHECKPOINT_ALIGNMENT;
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(plantClasses, sizeof(PlantClass), numPlantClasses, file);
+    fwrite(records, sizeof(CheckpointRegion), numRegions, file);
+    fwrite(loans, sizeof(long long), (size_t)numRegions * numRegions, file);
+    for (int r = 0; r < numRegions; r++)
+    {
+        fwrite(regions[r].dirtyPlants, sizeof(int), records[r].dirtyCount, file);
+        pthread_mutex_unlock(&regions[r].dirtyMutex);
+    }
+
+    fseek(file, (long)header.arenaOffset, SEEK_SET);
+    fwrite(plants.arena, 1, plants.arenaSize, file);
+    fseek(file, (long)header.keysOffset, SEEK_SET);
+    int buffer = acquireSnapshot(&orderSnapshots);
+    const PlantHeap *order = orderSnapshots.buffers[buffer];
+    fwrite(order->key, sizeof(float), plants.count, file);
+    releaseSnapshot(&orderSnapshots, buffer);
+    for (int r = 0; r < numRegions; r++)
+    {
+        pthread_mutex_unlock(&regions[r].dispatchMutex);
+    }
+
+    bool written = !ferror(file);
+    written = fclose(file) == 0 && written;
+    if (!written || rename(temporary, path) != 0)
+    {
+        fprintf(stderr, "Error: Could not write the checkpoint %s.\n", path);
+        remove(temporary);
+    }
+}
+
+/**
+ * Restores the simulation from a checkpoint. The file is mapped copy-on-write and the plant store is
+ * carved straight out of the mapping, so restoring costs a few page faults rather than a read of the
+ * whole fleet. The regions are set up from the checkpoint by initRegions, which also recomputes the
+ * generation totals from the activation flags. Exits the program if the file is not a checkpoint of
+ * this version or is damaged.
+ *
+ * @param path The path of the checkpoint file.
+ */
+void restoreCheckpoint(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+        fprintf(stderr, "Error: Could not open the checkpoint %s.\n", path);
+        exit(-1);
+    }
+    size_t size = (size_t)info.st_size;
+    void *mapping = size >= sizeof(CheckpointHeader) ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    const CheckpointHeader *header = mapping;
+    if (mapping == MAP_FAILED || memcmp(header->magic, "BLACKCKP", 8) != 0 || header->version != CHECKPOINT_VERSION ||
+        header->headerSize != sizeof(CheckpointHeader) || header->plantCount < 0 ||
+        header->numPlantClasses < 1 || header->numPlantClasses > MAX_PLANT_CLASSES || header->numRegions < 1 ||
+        header->numRegions > MAX_REGIONS || header->arenaSize != plantStoreSize(header->plantCount))
+    {
+        fprintf(stderr, "Error: %s is not a version %d checkpoint.\n", path, CHECKPOINT_VERSION);
+        exit(-1);
+    }
+    if (tickLimit > 0 && header->tick >= tickLimit)
+    {
+        fprintf(stderr, "Error: The checkpoint %s was taken at tick %llu, already at or past --ticks %lu.\n", path, header->tick,
+                tickLimit);
+        exit(-1);
+    }
+
+    // Every section must lie within the file, and every plant id, count and index within its bounds
+    const CheckpointRegion *records = (const CheckpointRegion *)((const char *)mapping + header->regionsOffset);
+    bool valid = checkpointSectionFits(header->classesOffset, sizeof(PlantClass) * header->numPlantClasses, size) &&
+                 checkpointSectionFits(header->regionsOffset, sizeof(CheckpointRegion) * header->numRegions, size) &&
+                 checkpointSectionFits(header->transfersOffset, sizeof(long long) * header->numRegions * header->numRegions, size) &&
+                 header->arenaOffset % CHECKPOINT_ALIGNMENT == 0 && checkpointSectionFits(header->arenaOffset, header->arenaSize, size) &&
+                 checkpointSectionFits(header->keysOffset, sizeof(float) * header->plantCount, size);
+    unsigned long long dirtyCount = 0;
+    for (int r = 0; valid && r < header->numRegions; r++)
+    {
+        const CheckpointRegion *record = &records[r];
+        valid = record->dirtyCount >= 0 && record->dirtyCount <= header->plantCount && record->standbyCount >= 0 &&
+                record->standbyCount <= STANDBY_POOL_SIZE && record->standbyNext >= 0 && record->standbyNext <= record->standbyCount;
+        for (int i = 0; valid && i < record->standbyCount; i++)
+        {
+            valid = record->standbyPool[i] >= 0 && record->standbyPool[i] < header->plantCount;
+        }
+        dirtyCount += valid ? record->dirtyCount : 0;
+    }
+    valid = valid && checkpointSectionFits(header->dirtyOffset, sizeof(int) * dirtyCount, size);
+    const int *pending = (const int *)((const char *)mapping + header->dirtyOffset);
+    for (unsigned long long i = 0; valid && i < dirtyCount; i++)
+    {
+        valid = pending[i] >= 0 && pending[i] < header->plantCount;
+    }
+    if (!valid)
+    {
+        fprintf(stderr, "Error: The checkpoint %s is damaged.\n", path);
+        exit(-1);
+    }
+
+    plants.count = plants.reserved = header->plantCount;
+    plants.arena = (char *)mapping + header->arenaOffset;
+    plants.arenaSize = header->arenaSize;
+    plants.mapping = mapping;
+    plants.mappingSize = size;
+    carvePlantStore(plants.arena, plants.count);
+    for (int plant = 0; plant < plants.count; plant++)
+    {
+        if (plants.classId[plant] >= header->numPlantClasses || plants.regionId[plant] >= header->numRegions)
+        {
+            fprintf(stderr, "Error: The checkpoint %s is damaged: plant %d has an unknown class or region.\n", path, plant);
+            exit(-1);
+        }
+    }
+    numPlantClasses = header->numPlantClasses;
+    memcpy(plantClasses, (const char *)mapping + header->classesOffset, sizeof(PlantClass) * numPlantClasses);
+
+    currentTick = header->tick;
+    sampledTick = currentTick > 0 ? currentTick - 1 : 0; // Its passes run again once restored, then it is sampled
+    randomSeed = header->seed;
+    dispatchPasses = header->counters[0];
+    greedyShortfalls = header->counters[1];
+    exactRescues = header->counters[2];
+    adjustmentEvents = header->counters[3];
+    adjustmentPasses = header->counters[4];
+    incrementalAdjustments = header->counters[5];
+    fullAdjustments = header->counters[6];
+    ticksBelowMinimum = header->counters[7];
+    recoveryAttempts = header->counters[8];
+    recoveries = header->counters[9];
+    transfers = header->counters[10];
+    lookaheadSkips = header->counters[11];
+    lookaheadFallbacks = header->counters[12];
+    activations = header->counters[13];
+    churnPairs = header->counters[14];
+    advancedPlantTicks = header->counters[15];
+    weatherStalls = header->counters[16];
+    controlQueries = header->counters[17];
+    controlChangesApplied = header->counters[18];
+    restoredCheckpoint = header;
+}
+
+/**
+ * Tells whether a section of a checkpoint lies within the file, without overflowing on corrupt offsets.
+ *
+ * @param offset The offset of the section in the file.
+ * @param length The length of the section in bytes.
+ * @param size The size of the file.
+ * @return true if the section fits in the file.
+ */
+bool checkpointSectionFits(unsigned long long offset, unsigned long long length, size_t size)
+{
+    return offset <= size && length <= size - offset;
+}
+
+/**
+ * Hands the plants that were waiting for an adjustment when the checkpoint was taken back to the
+ * dirty sets of their regions, once the engine is running. With the virtual clock, if the checkpoint
+ * was taken at the end of a coalescing window their dispatch passes run right away, in region order, as
+ * they would have without the restart; with the wall clock the dispatch loops are posted for them.
+ */
+void resumePendingAdjustments()
+{
+    const CheckpointRegion *records = (const CheckpointRegion *)((const char *)restoredCheckpoint + restoredCheckpoint->regionsOffset);
+    const int *pending = (const int *)((const char *)restoredCheckpoint + restoredCheckpoint->dirtyOffset);
+    unsigned long long now = monotonicNanos();
+    for (int r = 0; r < numRegions; r++)
+    {
+        Region *region = &regions[r];
+        lockMutex(&region->dirtyMutex);
+        memcpy(region->dirtyPlants, pending, sizeof(int) * records[r].dirtyCount);
+        for (int i = 0; i < records[r].dirtyCount; i++)
+        {
+            region->dirtyTimes[i] = now;
+        }
+        region->dirtyCount = records[r].dirtyCount;
+        region->adjustmentPending = false;
+        pthread_mutex_unlock(&region->dirtyMutex);
+        pending += records[r].dirtyCount;
+    }
+    if (clockMode != CLOCK_VIRTUAL)
+    {
+        flushAdjustments(true);
+        return;
+    }
+    for (int r = 0; r < numRegions; r++)
+    {
+        if (adjustmentDue(&regions[r], currentTick % coalesceTicks == 0) && !shutdownRequested)
+        {
+            handleAdjustment(&regions[r]);
+        }
+    }
+}
+
+/**
+ * Maps a weather trace and checks it against the fleet: a per-plant trace needs one series per plant,
+ * a per-class trace one per plant class, a per-region trace one per region, and the trace must cover
+ * the tick the simulation starts from.
+ * The prefetch window is sized so about WEATHER_PREFETCH_BYTES of rows stay resident ahead of the tick.
+ * Exits the program if the trace cannot be used.
+ *
+ * @param path The path of the weather trace file.
+ */
+void openWeatherTrace(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+        fprintf(stderr, "Error: Could not open the weather trace %s.\n", path);
+        exit(-1);
+    }
+    size_t size = (size_t)info.st_size;
+    void *mapping = size >= sizeof(WeatherTraceHeader) ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    const WeatherTraceHeader *header = mapping;
+    if (mapping == MAP_FAILED || memcmp(header->magic, "BLACKWTR", 8) != 0 || header->version != WEATHER_TRACE_VERSION ||
+        header->headerSize != sizeof(WeatherTraceHeader) || header->series <= 0 || header->rowsOffset % CHECKPOINT_ALIGNMENT != 0 ||
+        header->layout < WEATHER_SERIES_PLANT || header->layout > WEATHER_SERIES_REGION ||
+        header->rowsOffset + header->ticks * header->series * sizeof(float) > size)
+    {
+        fprintf(stderr, "Error: %s is not a version %d weather trace.\n", path, WEATHER_TRACE_VERSION);
+        exit(-1);
+    }
+    int expected = header->layout == WEATHER_SERIES_CLASS ? numPlantClasses : header->layout == WEATHER_SERIES_REGION ? numRegions : plants.count;
+    if (header->series != expected)
+    {
+        fprintf(stderr, "Error: The weather trace %s has %d series per %s, the fleet needs %d.\n", path, header->series,
+                weatherSeriesNames[header->layout], expected);
+        exit(-1);
+    }
+    if (currentTick < header->firstTick || currentTick >= header->firstTick + header->ticks)
+    {
+        fprintf(stderr, "Error: The weather trace %s covers ticks %llu to %llu, the simulation starts at tick %lu.\n", path,
+                header->firstTick + 1, header->firstTick + header->ticks, currentTick + 1);
+        exit(-1);
+    }
+
+    weatherTrace = header;
+    weatherTraceSize = size;
+    weatherRows = (const float *)((const char *)mapping + header->rowsOffset);
+    weatherWindowTicks = WEATHER_PREFETCH_BYTES / (sizeof(float) * header->series);
+    weatherWindowTicks = weatherWindowTicks >= 2 ? weatherWindowTicks : 2;
+    atomic_store(&weatherPrefetched, currentTick - (unsigned long)header->firstTick);
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    sem_init(&weatherSemaphore, 0, 0);
+    prefetchWeatherRows(currentTick - (unsigned long)header->firstTick); // The first window before the engine starts
+}
+
+/**
+ * Unmaps the weather trace, if one was replayed.
+ */
+void closeWeatherTrace()
+{
+    if (weatherTrace != NULL)
+    {
+        sem_destroy(&weatherSemaphore);
+        munmap((void *)weatherTrace, weatherTraceSize);
+        weatherTrace = NULL;
+        weatherRows = NULL;
+    }
+}
+
+/**
+ * Makes the rows of the weatherWindowTicks ticks from a given row on resident, so the workers read them
+ * from memory: readahead is requested for the whole range, then every page is touched so it is not
+ * just requested but mapped.
+ *
+ * @param row The first row the engine is about to replay.
+ */
+void prefetchWeatherRows(unsigned long row)
+{
+    size_t rowBytes = sizeof(float) * weatherTrace->series;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    const char *rows = (const char *)weatherRows;
+    unsigned long next = atomic_load(&weatherPrefetched);
+    unsigned long target = row + weatherWindowTicks < weatherTrace->ticks ? row + weatherWindowTicks : weatherTrace->ticks;
+    if (next >= target)
+    {
+        return;
+    }
+    size_t begin = next * rowBytes / page * page;
+    size_t end = target * rowBytes;
+    madvise((void *)(rows + begin), end - begin, MADV_WILLNEED);
+    unsigned char sum = 0;
+    for (size_t offset = begin; offset < end; offset += page)
+    {
+        sum += *(volatile const unsigned char *)(rows + offset);
+    }
+    (void)sum;
+    atomic_store(&weatherPrefetched, target);
+}
+
+/**
+ * The routine for the weather prefetch thread. Each time the engine wakes it, it prefetches the rows
+ * of the coming ticks and drops the rows already replayed, so a long trace does not accumulate in the
+ * memory of the process.
+ *
+ * @return Returns NULL upon completion.
+ */
+void *weatherPrefetchRoutine()
+{
+    size_t rowBytes = sizeof(float) * weatherTrace->series;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    const char *rows = (const char *)weatherRows;
+    unsigned long released = 0; // Rows before this one were dropped
+    while (!weatherStopping)
+    {
+        unsigned long row = currentTick - (unsigned long)weatherTrace->firstTick; // Row of the next tick
+        prefetchWeatherRows(row);
+        if (row > released + 1)
+        {
+            // The workers may still read the row of the current tick, everything before it is done
+            size_t end = (row - 1) * rowBytes / page * page;
+            size_t begin = released * rowBytes / page * page;
+            if (end > begin)
+            {
+                madvise((void *)(rows + begin), end - begin, MADV_DONTNEED);
+            }
+            released = row - 1;
+        }
+        while (sem_wait(&weatherSemaphore) != 0 && errno == EINTR)
+        {
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Loads the rain of one tick from the weather trace into a block of the plant store, as one-tick rain
+ * events: the kernel applies the increment and the event is over by the next tick, so no weather is
+ * drawn. The rain type only labels the increment for the log.
+ *
+ * @param first The id of the first plant of the block.
+ * @param last One past the id of the last plant of the block.
+ * @param tick The tick being advanced.
+ */
+void replayWeather(int first, int last, unsigned long tick)
+{
+    const float *row = weatherRows + (tick - 1 - weatherTrace->firstTick) * weatherTrace->series;
+    float *restrict increment = plants.rainIncrement;
+    if (weatherTrace->layout == WEATHER_SERIES_PLANT)
+    {
+        memcpy(increment + first, row + first, sizeof(float) * (last - first));
+    }
+    else
+    {
+        const unsigned char *series = weatherTrace->layout == WEATHER_SERIES_CLASS ? plants.classId : plants.regionId;
+        for (int plant = first; plant < last; plant++)
+        {
+            increment[plant] = row[series[plant]];
+        }
+    }
+    for (int plant = first; plant < last; plant++)
+    {
+        plants.rainDuration[plant] = 1;
+        plants.rainType[plant] = (unsigned char)((increment[plant] > NO_RAIN_INCREMENT) + (increment[plant] > AGUACERO_INCREMENT));
+    }
+}
+
+/**
+ * Starts recording the weather: every tick, the rain increment each plant receives is appended to a
+ * per-plant weather trace that --weather can replay. Exits the program if the file cannot be created.
+ *
+ * @param path The path of the weather trace file.
+ */
+void startWeatherRecording(const char *path)
+{
+    weatherRecordFile = fopen(path, "wb");
+    weatherRecordRow = calloc(plants.count > 0 ? plants.count : 1, sizeof(float));
+    if (weatherRecordFile == NULL || weatherRecordRow == NULL)
+    {
+        fprintf(stderr, "Error: Could not create the weather trace %s.\n", path);
+        exit(-1);
+    }
+    memset(&weatherRecordHeader, 0, sizeof(weatherRecordHeader));
+    memcpy(weatherRecordHeader.magic, "BLACKWTR", sizeof(weatherRecordHeader.magic));
+    weatherRecordHeader.version = WEATHER_TRACE_VERSION;
+    weatherRecordHeader.headerSize = sizeof(WeatherTraceHeader);
+    weatherRecordHeader.firstTick = currentTick;
+    weatherRecordHeader.series = plants.count;
+    weatherRecordHeader.layout = WEATHER_SERIES_PLANT;
+    weatherRecordHeader.rowsOffset = CHECKPOINT_ALIGNMENT;
+    fwrite(&weatherRecordHeader, sizeof(weatherRecordHeader), 1, weatherRecordFile);
+    fseek(weatherRecordFile, CHECKPOINT_ALIGNMENT, SEEK_SET);
+}
+
+/**
+ * Stops recording the weather and writes the number of recorded ticks into the trace header.
+ */
+void stopWeatherRecording()
+{
+    fseek(weatherRecordFile, 0, SEEK_SET);
+    fwrite(&weatherRecordHeader, sizeof(weatherRecordHeader), 1, weatherRecordFile);
+    if (fclose(weatherRecordFile) != 0)
+    {
+        fprintf(stderr, "Error: Could not write the weather trace %s.\n", weatherRecordPath);
+    }
+    weatherRecordFile = NULL;
+    free(weatherRecordRow);
+    weatherRecordRow = NULL;
+}
+
+/**
+ * Starts recording telemetry: allocates the staging buffers, writes a provisional header and starts the
+ * writer thread. Exits the program if the file cannot be created or the buffers allocated.
+ *
+ * @param path The path of the telemetry file.
+ */
+void startTelemetry(const char *path)
+{
+    int blocks = (plants.count + TELEMETRY_BLOCK_PLANTS - 1) / TELEMETRY_BLOCK_PLANTS;
+    size_t cells = (size_t)TELEMETRY_CHUNK_TICKS * (plants.count > 0 ? plants.count : 1);
+    // Worst case of a chunk: 5 bytes per first level, 5 per level change and 1 per state, plus the headers
+    size_t chunkBound = sizeof(TelemetryChunkHeader) + 9 * TELEMETRY_CHUNK_TICKS + sizeof(unsigned int) * (blocks + 1) +
+                        (sizeof(TelemetryBlockHeader) + 3) * blocks + (size_t)plants.count * (5 + 6 * TELEMETRY_CHUNK_TICKS);
+    telemetryFile = fopen(path, "wb");
+    telemetryChunk = malloc(chunkBound);
+    telemetryValues = malloc(sizeof(int) * TELEMETRY_CHUNK_TICKS * TELEMETRY_BLOCK_PLANTS);
+    bool allocated = telemetryChunk != NULL && telemetryValues != NULL;
+    for (int b = 0; b < TELEMETRY_BUFFERS; b++)
+    {
+        TelemetryBuffer *buffer = &telemetryBuffers[b];
+        atomic_init(&buffer->state, TELEMETRY_FREE);
+        buffer->waterLevel = malloc(sizeof(float) * cells);
+        buffer->states = malloc(cells);
+        allocated = allocated && buffer->waterLevel != NULL && buffer->states != NULL;
+    }
+    if (telemetryFile == NULL || !allocated)
+    {
+        fprintf(stderr, "Error: Could not create the telemetry file %s.\n", path);
+        exit(-1);
+    }
+
+    memset(&telemetryHeader, 0, sizeof(telemetryHeader));
+    memcpy(telemetryHeader.magic, "BLACKTLM", sizeof(telemetryHeader.magic));
+    telemetryHeader.version = TELEMETRY_VERSION;
+    telemetryHeader.headerSize = sizeof(TelemetryHeader);
+    telemetryHeader.plantCount = plants.count;
+    telemetryHeader.chunkTicks = TELEMETRY_CHUNK_TICKS;
+    telemetryHeader.blockPlants = TELEMETRY_BLOCK_PLANTS;
+    telemetryHeader.firstTick = currentTick + 1;
+    fwrite(&telemetryHeader, sizeof(telemetryHeader), 1, telemetryFile);
+
+    sem_init(&telemetrySemaphore, 0, 0);
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    placeThread(&attr, ROLE_SERVICE, 0);
+    pthread_create(&telemetryWriterThread, &attr, telemetryWriterRoutine, NULL);
+    pthread_attr_destroy(&attr);
+}
+
+/**
+ * Stops recording telemetry once the engine has stopped: hands the last, partly filled buffer to the
+ * writer, waits for it to write every chunk, then appends the chunk index and completes the header.
+ */
+void stopTelemetry()
+{
+    if (telemetryFilling != NULL)
+    {
+        atomic_store(&telemetryFilling->state, telemetryFilling->ticks > 0 ? TELEMETRY_FULL : TELEMETRY_FREE);
+        telemetryFilling = NULL;
+    }
+    atomic_store(&telemetryStopping, true);
+    sem_post(&telemetrySemaphore);
+    pthread_join(telemetryWriterThread, NULL);
+    sem_destroy(&telemetrySemaphore);
+
+    telemetryHeader.indexOffset = (unsigned long long)ftell(telemetryFile);
+    fwrite(telemetryIndex, sizeof(TelemetryChunkEntry), telemetryHeader.chunks, telemetryFile);
+    telemetryBytes = (unsigned long long)ftell(telemetryFile);
+    fseek(telemetryFile, 0, SEEK_SET);
+    fwrite(&telemetryHeader, sizeof(telemetryHeader), 1, telemetryFile);
+    if (fclose(telemetryFile) != 0)
+    {
+        fprintf(stderr, "Error: Could not write the telemetry file %s.\n", telemetryPath);
+    }
+    telemetryFile = NULL;
+    for (int b = 0; b < TELEMETRY_BUFFERS; b++)
+    {
+        free(telemetryBuffers[b].waterLevel);
+        free(telemetryBuffers[b].states);
+    }
+    free(telemetryIndex);
+    free(telemetryChunk);
+    free(telemetryValues);
+}
+
+/**
+ * Points the workers at the telemetry row of the tick being opened, taking a free buffer if the last one
+ * was handed to the writer. If the writer still holds every buffer, the wall clock drops the tick rather
+ * than delay it, and counts it in the header; the chunk index keeps the ticks of every chunk, so the gap
+ * shows. The virtual clock has no pace to keep and yields to the writer until a buffer is free.
+ */
+void beginTelemetryTick()
+{
+    bool waited = false;
+    while (telemetryFilling == NULL)
+    {
+        for (int b = 0; b < TELEMETRY_BUFFERS && telemetryFilling == NULL; b++)
+        {
+            if (atomic_load(&telemetryBuffers[b].state) == TELEMETRY_FREE)
+            {
+                telemetryFilling = &telemetryBuffers[b];
+                atomic_store(&telemetryFilling->state, TELEMETRY_FILLING);
+                telemetryFilling->firstTick = currentTick;
+                telemetryFilling->ticks = 0;
+            }
+        }
+        if (telemetryFilling == NULL && clockMode == CLOCK_WALL)
+        {
+            telemetryHeader.droppedTicks++;
+            return;
+        }
+        if (telemetryFilling == NULL)
+        {
+            waited = true;
+            sched_yield();
+        }
+    }
+    telemetryStalls += waited;
+    size_t row = (size_t)telemetryFilling->ticks * plants.count;
+    telemetryLevelRow = telemetryFilling->waterLevel + row;
+    telemetryStateRow = telemetryFilling->states + row;
+}
+
+/**
+ * Completes the telemetry row of the tick with the fleet generation and hands the buffer to the writer
+ * once it holds TELEMETRY_CHUNK_TICKS ticks.
+ */
+void endTelemetryTick()
+{
+    if (telemetryLevelRow == NULL)
+    {
+        return;
+    }
+    telemetryLevelRow = NULL;
+    telemetryStateRow = NULL;
+    telemetryFilling->generatedKilowatts[telemetryFilling->ticks++] = atomic_load(&generatedKilowatts);
+    if (telemetryFilling->ticks == TELEMETRY_CHUNK_TICKS)
+    {
+        atomic_store(&telemetryFilling->state, TELEMETRY_FULL); // Publishes the rows to the writer
+        telemetryFilling = NULL;
+        sem_post(&telemetrySemaphore);
+    }
+}
+
+/**
+ * Copies the state of a slice of the fleet into the telemetry row of the current tick.
+ *
+ * @param first The id of the first plant of the slice.
+ * @param last One past the id of the last plant of the slice.
+ */
+void recordTelemetrySlice(int first, int last)
+{
+    memcpy(telemetryLevelRow + first, plants.waterLevel + first, sizeof(float) * (last - first));
+    for (int plant = first; plant < last; plant++)
+    {
+        int active = atomic_load_explicit(&plants.isActive[plant], memory_order_relaxed);
+        telemetryStateRow[plant] = (unsigned char)(active | plants.rainType[plant] << 1);
+    }
+}
+
+/**
+ * The routine for the telemetry writer thread. Encodes and writes the full buffers, oldest first, and
+ * gives them back to the engine; sleeps on the semaphore otherwise. On shutdown it writes the buffers
+ * still waiting before exiting.
+ *
+ * @return Returns NULL upon completion.
+ */
+void *telemetryWriterRoutine()
+{
+    while (true)
+    {
+        bool stopping = atomic_load(&telemetryStopping); // Read first so the last pass sees every buffer
+        TelemetryBuffer *next = NULL;
+        for (int b = 0; b < TELEMETRY_BUFFERS; b++)
+        {
+            TelemetryBuffer *buffer = &telemetryBuffers[b];
+            if (atomic_load(&buffer->state) == TELEMETRY_FULL && (next == NULL || buffer->firstTick < next->firstTick))
+            {
+                next = buffer;
+            }
+        }
+        if (next != NULL)
+        {
+            writeTelemetryChunk(next);
+            atomic_store(&next->state, TELEMETRY_FREE);
+        }
+        else if (stopping)
+        {
+            break;
+        }
+        else
+        {
+            while (sem_wait(&telemetrySemaphore) != 0 && errno == EINTR)
+            {
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Encodes a full staging buffer as one chunk, appends it to the telemetry file and records it in the
+ * chunk index.
+ *
+ * @param buffer The buffer to write.
+ */
+void writeTelemetryChunk(const TelemetryBuffer *buffer)
+{
+    int blocks = (plants.count + TELEMETRY_BLOCK_PLANTS - 1) / TELEMETRY_BLOCK_PLANTS;
+    TelemetryChunkHeader header = {buffer->firstTick, buffer->ticks, blocks, buffer->generatedKilowatts[0], 0, 0};
+    unsigned long long widest = 0;
+    for (int t = 1; t < buffer->ticks; t++)
+    {
+        unsigned long long change = zigzag(buffer->generatedKilowatts[t] - buffer->generatedKilowatts[t - 1]);
+        widest = change > widest ? change : widest;
+    }
+    header.generationBits = bitWidth(widest);
+
+    BitWriter writer = {telemetryChunk, sizeof(header), 0, 0};
+    for (int t = 1; t < buffer->ticks; t++)
+    {
+        putBits(&writer, zigzag(buffer->generatedKilowatts[t] - buffer->generatedKilowatts[t - 1]), header.generationBits);
+    }
+    alignBits(&writer);
+
+    // Block offsets, filled in as the blocks are encoded after them
+    unsigned int *offsets = (unsigned int *)(telemetryChunk + writer.bytes);
+    writer.bytes += sizeof(unsigned int) * (blocks + 1);
+    for (int b = 0; b < blocks; b++)
+    {
+        unsigned int offset = (unsigned int)writer.bytes;
+        memcpy(&offsets[b], &offset, sizeof(offset));
+        int first = b * TELEMETRY_BLOCK_PLANTS;
+        encodeTelemetryBlock(&writer, buffer, first, first + TELEMETRY_BLOCK_PLANTS < plants.count ? first + TELEMETRY_BLOCK_PLANTS : plants.count);
+    }
+    unsigned int end = (unsigned int)writer.bytes;
+    memcpy(&offsets[blocks], &end, sizeof(end));
+    memcpy(telemetryChunk, &header, sizeof(header));
+
+    if (telemetryHeader.chunks == telemetryIndexCapacity)
+    {
+        telemetryIndexCapacity = telemetryIndexCapacity > 0 ? 2 * telemetryIndexCapacity : 64;
+        telemetryIndex = realloc(telemetryIndex, sizeof(TelemetryChunkEntry) * telemetryIndexCapacity);
+        if (telemetryIndex == NULL)
+        {
+            fprintf(stderr, "Error: Could not allocate memory for the telemetry index.\n");
+            exit(-1);
+        }
+    }
+    TelemetryChunkEntry *entry = &telemetryIndex[telemetryHeader.chunks++];
+    entry->firstTick = buffer->firstTick;
+    entry->offset = (unsigned long long)ftell(telemetryFile);
+    entry->ticks = (unsigned int)buffer->ticks;
+    entry->size = end;
+    fwrite(telemetryChunk, 1, end, telemetryFile);
+    telemetryHeader.ticks += buffer->ticks;
+}
+
+/**
+ * Encodes the plants [first, last) of a staging buffer as one block: the water levels as integers, fixed-point
+ * in the coarsest unit they all allow, with the first tick framed by the lowest level and the others as zigzag changes, then
+ * the states, each run bit-packed on the width of its largest value.
+ *
+ * @param writer The chunk being written, at the start of the block.
+ * @param buffer The buffer being written.
+ * @param first The id of the first plant of the block.
+ * @param last One past the id of the last plant of the block.
+ */
+void encodeTelemetryBlock(BitWriter *writer, const TelemetryBuffer *buffer, int first, int last)
+{
+    int ticks = buffer->ticks;
+    int count = last - first;
+    // The coarsest power-of-two unit that holds every level; a finer one keeps the levels of a coarser one whole
+    TelemetryBlockHeader header = {TELEMETRY_LEVEL_FIXED, 0, 0, 0, 0};
+    for (int t = 0; t < ticks && header.levelMode == TELEMETRY_LEVEL_FIXED; t++)
+    {
+        const float *row = buffer->waterLevel + (size_t)t * plants.count;
+        for (int plant = first; plant < last; plant++)
+        {
+            while (header.scaleBits <= TELEMETRY_MAX_SCALE_BITS && ldexpf(row[plant], header.scaleBits) != rintf(ldexpf(row[plant], header.scaleBits)))
+            {
+                header.scaleBits++;
+            }
+            if (header.scaleBits > TELEMETRY_MAX_SCALE_BITS || !(fabsf(ldexpf(row[plant], header.scaleBits)) < 1073741824.0f))
+            {
+                header.levelMode = TELEMETRY_LEVEL_FLOAT;
+                header.scaleBits = 0;
+                break;
+            }
+        }
+    }
+
+    // Integer levels, plant by plant, with the frame of the first tick and the widest change
+    long long lowest = LLONG_MAX, highest = LLONG_MIN;
+    unsigned long long widest = 0;
+    for (int plant = first; plant < last; plant++)
+    {
+        int *series = telemetryValues + (size_t)(plant - first) * ticks;
+        for (int t = 0; t < ticks; t++)
+        {
+            float level = buffer->waterLevel[(size_t)t * plants.count + plant];
+            if (header.levelMode == TELEMETRY_LEVEL_FIXED)
+            {
+                series[t] = (int)ldexpf(level, header.scaleBits);
+            }
+            else
+            {
+                memcpy(&series[t], &level, sizeof(int));
+            }
+            if (t > 0)
+            {
+                unsigned long long change = zigzag((long long)series[t] - series[t - 1]);
+                widest = change > widest ? change : widest;
+            }
+        }
+        lowest = series[0] < lowest ? series[0] : lowest;
+        highest = series[0] > highest ? series[0] : highest;
+    }
+    header.firstBase = (int)lowest;
+    header.firstBits = bitWidth((unsigned long long)(highest - lowest));
+    header.deltaBits = bitWidth(widest);
+    memcpy(writer->data + writer->bytes, &header, sizeof(header));
+    writer->bytes += sizeof(header);
+
+    for (int p = 0; p < count; p++)
+    {
+        putBits(writer, (unsigned long long)((long long)telemetryValues[(size_t)p * ticks] - lowest), header.firstBits);
+    }
+    alignBits(writer);
+    for (int p = 0; p < count; p++)
+    {
+        const int *series = telemetryValues + (size_t)p * ticks;
+        for (int t = 1; t < ticks; t++)
+        {
+            putBits(writer, zigzag((long long)series[t] - series[t - 1]), header.deltaBits);
+        }
+    }
+    alignBits(writer);
+    for (int plant = first; plant < last; plant++)
+    {
+        for (int t = 0; t < ticks; t++)
+        {
+            putBits(writer, buffer->states[(size_t)t * plants.count + plant], TELEMETRY_STATE_BITS);
+        }
+    }
+    alignBits(writer);
+}
+
+/**
+ * Appends the low bits of a value to a bit-packed run.
+ *
+ * @param writer The run.
+ * @param value The value; only its low count bits are written.
+ * @param count The number of bits, up to 64.
+ */
+void putBits(BitWriter *writer, unsigned long long value, unsigned int count)
+{
+    while (count > 0)
+    {
+        unsigned int take = count < 32 ? count : 32;
+        writer->pending |= (value & ((1ULL << take) - 1)) << writer->pendingBits;
+        writer->pendingBits += take;
+        value >>= take;
+        count -= take;
+        while (writer->pendingBits >= 8)
+        {
+            writer->data[writer->bytes++] = (unsigned char)writer->pending;
+            writer->pending >>= 8;
+            writer->pendingBits -= 8;
+        }
+    }
+}
+
+/**
+ * Ends a bit-packed run on a byte boundary, storing its last bits.
+ *
+ * @param writer The run.
+ */
+void alignBits(BitWriter *writer)
+{
+    if (writer->pendingBits > 0)
+    {
+        writer->data[writer->bytes++] = (unsigned char)writer->pending;
+    }
+    writer->pending = 0;
+    writer->pendingBits = 0;
+}
+
+/**
+ * Returns the number of bits needed to write a value.
+ *
+ * @param value The value.
+ * @return The position of its highest set bit plus one, 0 for 0.
+ */
+unsigned int bitWidth(unsigned long long value)
+{
+    return value == 0 ? 0 : 64 - (unsigned int)__builtin_clzll(value);
+}
+
+/**
+ * Maps a signed change to an unsigned one, small in magnitude either way: 0, -1, 1, -2, 2... become 0, 1, 2, 3, 4...
+ *
+ * @param value The signed change.
+ * @return The zigzag-encoded change.
+ */
+unsigned long long zigzag(long long value)
+{
+    return ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63);
+}
+
+/**
+ * Runs the simulation as an ensemble of ensembleReplicas independent replicas and reports the blackout
+ * probability, the time to the first recovery attempt and the mean generation over them. Replica i
+ * draws its weather with seed randomSeed + i, so the results do not depend on the number of jobs.
+ * The coordinating process and the runners exit here; the function only returns in a replica.
+ */
+void runEnsemble()
+{
+    int jobs = ensembleJobCount(ensembleReplicas);
+    openEnsemble(ensembleReplicas);
+    unsigned long long start = monotonicNanos();
+    if (runEnsembleRound(ensembleReplicas, jobs))
+    {
+        randomSeed += (unsigned long long)ensembleReplica;
+        return;
+    }
+
+    reportEnsemble(jobs, monotonicNanos() - start);
+    munmap(ensemble, ensembleSize);
+    exit(0);
+}
+
+/**
+ * Sizes the runner pool of an ensemble: --jobs, or one runner per CPU the process may run on, and never
+ * more runners than replicas. Records the allowed CPUs for runEnsembleRound to pin the runners to.
+ *
+ * @param replicas The most replicas a round of the ensemble runs.
+ * @return The number of runners.
+ */
+int ensembleJobCount(int replicas)
+{
+    CPU_ZERO(&ensembleCpus);
+    ensembleCpuCount = sched_getaffinity(0, sizeof(ensembleCpus), &ensembleCpus) == 0 ? CPU_COUNT(&ensembleCpus) : 0;
+    int jobs = ensembleJobs > 0 ? ensembleJobs : (ensembleCpuCount > 0 ? ensembleCpuCount : 1);
+    return jobs < replicas ? jobs : replicas;
+}
+
+/**
+ * Maps the memory the processes of an ensemble share, with room for the summaries of a round.
+ * Exits the program if it cannot be mapped.
+ *
+ * @param replicas The most replicas a round of the ensemble runs.
+ */
+void openEnsemble(int replicas)
+{
+    ensembleSize = sizeof(EnsembleRun) + sizeof(ReplicaResult) * replicas;
+    ensemble = mmap(NULL, ensembleSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ensemble == MAP_FAILED)
+    {
+        fprintf(stderr, "Error: Could not allocate memory for the ensemble.\n");
+        exit(-1);
+    }
+}
+
+/**
+ * Runs one round of replicas of an ensemble. One runner process per job takes the replicas from a counter
+ * shared by all runners, so a runner whose replicas end early simply takes more and every job stays busy
+ * until the last replica is handed out. Exits the program if the runners cannot be started.
+ *
+ * @param replicas The number of replicas of the round; their summaries go to the first slots of the ensemble.
+ * @param jobs The number of runners.
+ * @return true in a replica, which goes on as a single run with ensembleReplica set to its slot;
+ *         false in the coordinating process once every replica of the round has ended.
+ */
+bool runEnsembleRound(int replicas, int jobs)
+{
+    pid_t *runners = malloc(sizeof(pid_t) * jobs);
+    if (runners == NULL)
+    {
+        fprintf(stderr, "Error: Could not allocate memory for the ensemble.\n");
+        exit(-1);
+    }
+    atomic_store(&ensemble->nextReplica, 0);
+    for (int r = 0; r < replicas; r++)
+    {
+        atomic_store(&ensemble->replicas[r].state, REPLICA_PENDING);
+    }
+
+    // With no more jobs than CPUs, every runner and its replicas keep to a CPU of their own
+    fflush(stdout);
+    for (int job = 0, cpu = -1; job < jobs; job++)
+    {
+        while (jobs <= ensembleCpuCount && !CPU_ISSET(++cpu, &ensembleCpus))
+        {
+        }
+        runners[job] = fork();
+        if (runners[job] < 0)
+        {
+            fprintf(stderr, "Error: Could not start the ensemble runners.\n");
+            exit(-1);
+        }
+        if (runners[job] == 0)
+        {
+            free(runners);
+            runEnsembleJob(jobs <= ensembleCpuCount ? cpu : -1, replicas);
+            return true;
+        }
+    }
+    for (int job = 0; job < jobs; job++)
+    {
+        waitpid(runners[job], NULL, 0);
+    }
+    free(runners);
+    return false;
+}
+
+/**
+ * Main loop of an ensemble runner: forks the next replica handed out by the shared counter and waits
+ * for it, until every replica has been handed out. A replica that exits without reporting its summary
+ * is marked as failed and stops the hand-out for every runner. The forked replica returns from here as
+ * a single silent, unpaced run.
+ *
+ * @param cpu The CPU the runner and its replicas are pinned to, -1 to leave them to the scheduler.
+ * @param replicas The number of replicas of the round.
+ */
+void runEnsembleJob(int cpu, int replicas)
+{
+    if (cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        sched_setaffinity(0, sizeof(set), &set);
+    }
+
+    int replica;
+    while ((replica = atomic_fetch_add(&ensemble->nextReplica, 1)) < replicas)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            // Only the summary of a replica is kept: no log, no stats dumps, no pinning of its own
+            ensembleReplica = replica;
+            clockMode = CLOCK_VIRTUAL;
+            logLevel = -1;
+            logFormat = LOG_FORMAT_TEXT;
+            logPath = NULL;
+            statsPath = NULL;
+            telemetryPath = NULL;
+            placementPolicy = PLACEMENT_NONE;
+            numWorkers = numWorkers > 0 ? numWorkers : 1;
+            if (freopen("/dev/null", "w", stdout) == NULL)
+            {
+                _exit(-1);
+            }
+            return;
+        }
+        int status = 0;
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            // A replica that fails, for an invalid fleet most often, would fail the same way with any seed
+            int pending = REPLICA_PENDING;
+            atomic_compare_exchange_strong(&ensemble->replicas[replica].state, &pending, REPLICA_FAILED);
+            atomic_store(&ensemble->nextReplica, replicas);
+        }
+    }
+    _exit(0);
+}
+
+/**
+ * Hands the summary of the replica run by this process to the ensemble and exits, skipping the shutdown
+ * report and the cleanup of a single run.
+ */
+void finishReplica()
+{
+    ReplicaResult *result = &ensemble->replicas[ensembleReplica];
+    result->plantCount = plants.count;
+    result->ticks = currentTick - engineStartTick;
+    result->shutdownTick = atomic_load(&fleetShutdownTick);
+    result->firstRecoveryTick = atomic_load(&firstRecoveryTick);
+    result->meanGeneration = generationSum / (double)tickLimit;
+    atomic_store(&result->state, REPLICA_DONE);
+    _exit(0);
+}
+
+/**
+ * Prints the statistics of a finished ensemble: the share of replicas whose fleet was shut down within
+ * the horizon, with its Wilson score interval, the distribution of the time to the first recovery
+ * attempt and to the shutdown, and the mean generation with its normal interval, both at 95%. The same
+ * figures go to the stats output as one JSON line. Exits the program if a replica failed.
+ *
+ * @param jobs The number of replicas run at once.
+ * @param nanos The wall-clock time the ensemble took.
+ */
+void reportEnsemble(int jobs, unsigned long long nanos)
+{
+    unsigned long *shutdownTicks = malloc(sizeof(unsigned long) * ensembleReplicas);
+    unsigned long *recoveryTicks = malloc(sizeof(unsigned long) * ensembleReplicas);
+    if (shutdownTicks == NULL || recoveryTicks == NULL)
+    {
+        fprintf(stderr, "Error: Could not allocate memory for the ensemble statistics.\n");
+        exit(-1);
+    }
+
+    // Gather the replicas, with the running mean and squared deviations of the generation (Welford)
+    int blackouts = 0;
+    int recovering = 0;
+    int failed = 0;
+    double generationMean = 0.0;
+    double generationSquares = 0.0;
+    unsigned long long plantTicks = 0;
+    for (int r = 0; r < ensembleReplicas; r++)
+    {
+        const ReplicaResult *result = &ensemble->replicas[r];
+        if (atomic_load(&result->state) != REPLICA_DONE)
+        {
+            if (atomic_load(&result->state) == REPLICA_FAILED)
+            {
+                fprintf(stderr, "Error: Replica %d (seed %llu) exited without reporting its summary.\n", r, randomSeed + (unsigned long long)r);
+            }
+            failed++;
+            continue;
+        }
+        if (result->shutdownTick != NO_TICK)
+        {
+            shutdownTicks[blackouts++] = result->shutdownTick;
+        }
+        if (result->firstRecoveryTick != NO_TICK)
+        {
+            recoveryTicks[recovering++] = result->firstRecoveryTick;
+        }
+        double delta = result->meanGeneration - generationMean;
+        generationMean += delta / (r + 1 - failed);
+        generationSquares += delta * (result->meanGeneration - generationMean);
+        plantTicks += (unsigned long long)result->plantCount * result->ticks;
+    }
+    if (failed > 0)
+    {
+        fprintf(stderr, "Error: The ensemble stopped with %d of %d replicas unfinished.\n", failed, ensembleReplicas);
+        exit(-1);
+    }
+    qsort(shutdownTicks, blackouts, sizeof(unsigned long), compareTicks);
+    qsort(recoveryTicks, recovering, sizeof(unsigned long), compareTicks);
+
+    // Wilson score interval of the blackout probability, normal interval of the mean generation
+    double n = ensembleReplicas;
+    double p = blackouts / n;
+    double low, high;
+    wilsonInterval(blackouts, ensembleReplicas, &low, &high);
+    double generationSpread = ensembleReplicas > 1 ? ENSEMBLE_CONFIDENCE_Z * sqrt(generationSquares / (n - 1.0) / n) : 0.0;
+    double seconds = (double)nanos / 1e9;
+
+    printf("Ensemble: %d replicas of %lu ticks (%.1f simulated hours), seeds %llu to %llu, %d at a time, %.2f s (%.1f replicas/s, %.0f plant-ticks/s).\n",
+           ensembleReplicas, tickLimit, tickLimit / 3600.0, randomSeed, randomSeed + (unsigned long long)ensembleReplicas - 1, jobs, seconds,
+           n / seconds, (double)plantTicks / seconds);
+    printf("Blackout probability: %.4f (%d of %d fleets shut down), 95%% CI %.4f to %.4f.\n", p, blackouts, ensembleReplicas, low, high);
+    if (blackouts > 0)
+    {
+        printf("Time to shutdown: p10 %lu s, p50 %lu s, p90 %lu s.\n", tickPercentile(shutdownTicks, blackouts, 0.1),
+               tickPercentile(shutdownTicks, blackouts, 0.5), tickPercentile(shutdownTicks, blackouts, 0.9));
+    }
+    printf("First recovery attempt: in %d of %d replicas", recovering, ensembleReplicas);
+    if (recovering > 0)
+    {
+        printf(", after p10 %lu s, p25 %lu s, p50 %lu s, p75 %lu s, p90 %lu s", tickPercentile(recoveryTicks, recovering, 0.1),
+               tickPercentile(recoveryTicks, recovering, 0.25), tickPercentile(recoveryTicks, recovering, 0.5),
+               tickPercentile(recoveryTicks, recovering, 0.75), tickPercentile(recoveryTicks, recovering, 0.9));
+    }
+    printf(".\n");
+    printf("Mean generation: %f MW/s, 95%% CI %f to %f MW/s.\n", generationMean, generationMean - generationSpread,
+           generationMean + generationSpread);
+
+    FILE *output = statsPath != NULL ? fopen(statsPath, "w") : stderr;
+    if (output == NULL)
+    {
+        fprintf(stderr, "Error: Could not open the stats file %s.\n", statsPath);
+        exit(-1);
+    }
+    fprintf(output, "{\"reason\":\"ensemble\",\"replicas\":%d,\"ticks\":%lu,\"seed\":%llu,\"jobs\":%d,\"running\":%llu,\"plantTicksPerSecond\":%.0f,",
+            ensembleReplicas, tickLimit, randomSeed, jobs, nanos, (double)plantTicks / seconds);
+    fprintf(output, "\"blackouts\":%d,\"blackoutProbability\":%f,\"blackoutLow\":%f,\"blackoutHigh\":%f,", blackouts, p, low, high);
+    fprintf(output, "\"shutdownTicks\":{\"p10\":%lu,\"p50\":%lu,\"p90\":%lu},", tickPercentile(shutdownTicks, blackouts, 0.1),
+            tickPercentile(shutdownTicks, blackouts, 0.5), tickPercentile(shutdownTicks, blackouts, 0.9));
+    fprintf(output, "\"recoveries\":%d,\"firstRecoveryTicks\":{\"p10\":%lu,\"p25\":%lu,\"p50\":%lu,\"p75\":%lu,\"p90\":%lu},", recovering,
+            tickPercentile(recoveryTicks, recovering, 0.1), tickPercentile(recoveryTicks, recovering, 0.25),
+            tickPercentile(recoveryTicks, recovering, 0.5), tickPercentile(recoveryTicks, recovering, 0.75),
+            tickPercentile(recoveryTicks, recovering, 0.9));
+    fprintf(output, "\"meanGeneration\":%f,\"meanGenerationLow\":%f,\"meanGenerationHigh\":%f}\n", generationMean,
+            generationMean - generationSpread, generationMean + generationSpread);
+    if (output != stderr)
+    {
+        fclose(output);
+    }
+    free(shutdownTicks);
+    free(recoveryTicks);
+}
+
+/**
+ * Computes the 95% Wilson score interval of a proportion, which stays inside [0, 1] and keeps a useful
+ * width when none or all of the trials succeed.
+ *
+ * @param successes The number of trials that succeeded.
+ * @param trials The number of trials, at least one.
+ * @param low Output, the lower bound of the interval.
+ * @param high Output, the upper bound of the interval.
+ */
+void wilsonInterval(int successes, int trials, double *low, double *high)
+{
+    double n = trials;
+    double z = ENSEMBLE_CONFIDENCE_Z;
+    double p = successes / n;
+    double center = (p + z * z / (2.0 * n)) / (1.0 + z * z / n);
+    double spread = z * sqrt(p * (1.0 - p) / n + z * z / (4.0 * n * n)) / (1.0 + z * z / n);
+    *low = center - spread > 0.0 ? center - spread : 0.0;
+    *high = center + spread < 1.0 ? center + spread : 1.0;
+}
+
+/**
+ * Orders ticks increasingly, for qsort.
+ *
+ * @param a The first tick.
+ * @param b The second tick.
+ * @return A negative number, zero or a positive number as the first tick is before, at or after the second.
+ */
+int compareTicks(const void *a, const void *b)
+{
+    unsigned long first = *(const unsigned long *)a;
+    unsigned long second = *(const unsigned long *)b;
+    return (first > second) - (first < second);
+}
+
+/**
+ * Reads a percentile off sorted ticks with the nearest-rank method.
+ *
+ * @param sorted The ticks, in increasing order.
+ * @param count The number of ticks.
+ * @param fraction The percentile, between 0 and 1.
+ * @return The smallest tick at or above the given fraction of the ticks, 0 if there are none.
+ */
+unsigned long tickPercentile(const unsigned long *sorted, int count, double fraction)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    int rank = (int)ceil(fraction * count);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+/**
+ * Runs a fleet-composition sweep: every mix of H1, H2 and H3 plants within the --sweep ranges, under every
+ * weather, as an ensemble of up to --ensemble replicas. The replicas run in rounds of SWEEP_BATCH_REPLICAS
+ * per point, spread over the runners like those of an ensemble, and after every round the points that are
+ * dominated with confidence are pruned, so the rest of the replicas go to the points that can still make the
+ * Pareto frontier. Replica i of every point draws its weather with seed randomSeed + i from streams keyed by
+ * class and ordinal, so all points face the same rain and their differences come from the fleet alone.
+ * The coordinating process and the runners exit here; the function only returns in a replica.
+ */
+void runSweep()
+{
+    sweepWeathers[0][0] = probA;
+    sweepWeathers[0][1] = probB;
+    sweepWeathers[0][2] = probC;
+
+    // Lay out the grid, weather by weather, and set the infeasible mixes aside without running them. The
+    // points times the replicas of a batch must fit in an int, checked factor by factor so nothing overflows.
+    int replicasPerPoint = ensembleReplicas > 0 ? ensembleReplicas : SWEEP_DEFAULT_REPLICAS;
+    int batch = replicasPerPoint < SWEEP_BATCH_REPLICAS ? replicasPerPoint : SWEEP_BATCH_REPLICAS;
+    long long maxPoints = INT_MAX / batch / numSweepWeathers;
+    long long mixes = 1;
+    for (int c = 0; c < 3; c++)
+    {
+        long long counts = (sweepRanges[c][1] - sweepRanges[c][0]) / sweepRanges[c][2] + 1;
+        if (counts > maxPoints / mixes)
+        {
+            fprintf(stderr, "Error: The sweep has too many points.\n");
+            exit(-1);
+        }
+        mixes *= counts;
+    }
+    sweepPoints = calloc(mixes * numSweepWeathers, sizeof(SweepPoint));
+    if (sweepPoints == NULL)
+    {
+        fprintf(stderr, "Error: Could not allocate memory for the sweep.\n");
+        exit(-1);
+    }
+    int feasible = 0;
+    for (int w = 0; w < numSweepWeathers; w++)
+    {
+        for (int h1 = sweepRanges[0][0]; h1 <= sweepRanges[0][1]; h1 += sweepRanges[0][2])
+        {
+            for (int h2 = sweepRanges[1][0]; h2 <= sweepRanges[1][1]; h2 += sweepRanges[1][2])
+            {
+                for (int h3 = sweepRanges[2][0]; h3 <= sweepRanges[2][1]; h3 += sweepRanges[2][2])
+                {
+                    SweepPoint *point = &sweepPoints[numSweepPoints++];
+                    *point = (SweepPoint){h1, h2, h3, w, sweepFleetFeasible(h1, h2, h3), false, 0, 0, 0.0, 0.0, 1.0};
+                    feasible += point->feasible;
+                }
+            }
+        }
+    }
+    if (feasible == 0)
+    {
+        fprintf(stderr, "Error: No fleet mix of the sweep has the capacity to reach the minimum generation.\n");
+        exit(-1);
+    }
+
+    int jobs = ensembleJobCount(feasible * batch);
+    openEnsemble(feasible * batch);
+    sweepTasks = malloc(sizeof(SweepTask) * feasible * batch);
+    if (sweepTasks == NULL)
+    {
+        fprintf(stderr, "Error: Could not allocate memory for the sweep.\n");
+        exit(-1);
+    }
+
+    unsigned long replicasRun = 0;
+    unsigned long long start = monotonicNanos();
+    while (true)
+    {
+        // Hand the next batch of replicas of every point still in the running to the runners
+        int tasks = 0;
+        for (int p = 0; p < numSweepPoints; p++)
+        {
+            const SweepPoint *point = &sweepPoints[p];
+            for (int r = point->replicas; point->feasible && !point->pruned && r < point->replicas + batch && r < replicasPerPoint; r++)
+            {
+                sweepTasks[tasks++] = (SweepTask){p, r};
+            }
+        }
+        if (tasks == 0)
+        {
+            break;
+        }
+        if (runEnsembleRound(tasks, jobs))
+        {
+            const SweepTask *task = &sweepTasks[ensembleReplica];
+            sweepPoint = &sweepPoints[task->point];
+            probA = sweepWeathers[sweepPoint->weather][0];
+            probB = sweepWeathers[sweepPoint->weather][1];
+            probC = sweepWeathers[sweepPoint->weather][2];
+            randomSeed += (unsigned long long)task->replica;
+            weatherByClassOrdinal = true;
+            return;
+        }
+
+        // Fold the summaries of the round into their points
+        int unfinished = 0;
+        for (int t = 0; t < tasks; t++)
+        {
+            const ReplicaResult *result = &ensemble->replicas[t];
+            SweepPoint *point = &sweepPoints[sweepTasks[t].point];
+            int state = atomic_load(&result->state);
+            if (state != REPLICA_DONE)
+            {
+                if (state == REPLICA_FAILED)
+                {
+                    fprintf(stderr, "Error: Replica %d of the fleet with %d H1, %d H2 and %d H3 plants (seed %llu) exited without reporting its summary.\n",
+                            sweepTasks[t].replica, point->numH1, point->numH2, point->numH3, randomSeed + (unsigned long long)sweepTasks[t].replica);
+                }
+                unfinished++;
+                continue;
+            }
+            point->replicas++;
+            point->blackouts += result->shutdownTick != NO_TICK;
+            point->generationSum += result->meanGeneration;
+            replicasRun++;
+        }
+        if (unfinished > 0)
+        {
+            fprintf(stderr, "Error: The sweep stopped with %d replicas of the round unfinished.\n", unfinished);
+            exit(-1);
+        }
+        pruneSweepPoints();
+    }
+
+    reportSweep(jobs, monotonicNanos() - start, replicasRun);
+    munmap(ensemble, ensembleSize);
+    free(sweepTasks);
+    free(sweepPoints);
+    exit(0);
+}
+
+/**
+ * Checks a fleet mix the way main checks the fleet it creates: every region gets its share of each
+ * plant type, and must have plants and the capacity to reach its minimum generation.
+ *
+ * @param numH1 The number of H1 plants.
+ * @param numH2 The number of H2 plants.
+ * @param numH3 The number of H3 plants.
+ * @return true if a replica of the mix can run.
+ */
+bool sweepFleetFeasible(int numH1, int numH2, int numH3)
 {
-    if (sig == SIGINT)
+    for (int r = 0; r < numRegions; r++)
     {
-        shutdownRequested = 1;
-        printf("%s\nShutting down simulation - shutdown signal received***\n%s", c_red, c_end);
+        int h1 = numH1 / numRegions + (r < numH1 % numRegions);
+        int h2 = numH2 / numRegions + (r < numH2 % numRegions);
+        int h3 = numH3 / numRegions + (r < numH3 % numRegions);
+        float totalMaxCapacity = h1 * H1_CAPACITY + h2 * H2_CAPACITY + h3 * H3_CAPACITY;
+        if (h1 + h2 + h3 == 0 || totalMaxCapacity < (regionBandsGiven ? regions[r].minGeneration : MIN_GENERATION))
+        {
+            return false;
+        }
     }
+    return true;
 }
+
 /**
- * Main function of the program.
- * It initializes and manages the simulation of hydroelectric plants.
- *
- * @param argc The count of command-line arguments.
- * @param argv The command-line arguments.
- * @return int Returns 0 on successful execution, 1 on error.
+ * Updates the blackout intervals of the sweep points and prunes the points still in the running that are
+ * dominated with confidence: another point under the same weather has no more plants and a blackout
+ * interval entirely below theirs. Such a point cannot make the Pareto frontier, whatever its further
+ * replicas would show.
  */
-int main(int argc, char *argv[])
+void pruneSweepPoints()
 {
-    // Validate the correct number of input arguments
-    if (argc != 7)
+    for (int p = 0; p < numSweepPoints; p++)
     {
-        fprintf(stderr, "Usage: %s <Prob A> <Prob B> <Prob C> <Num H1> <Num H2> <Num H3>\n", argv[0]);
-        return 1;
+        SweepPoint *point = &sweepPoints[p];
+        if (point->replicas > 0)
+        {
+            wilsonInterval(point->blackouts, point->replicas, &point->blackoutLow, &point->blackoutHigh);
+        }
     }
-
-    // Parse the input arguments
-    probA = atof(argv[1]);
-    probB = atof(argv[2]);
-    probC = atof(argv[3]);
-    int numH1 = atoi(argv[4]);
-    int numH2 = atoi(argv[5]);
-    int numH3 = atoi(argv[6]);
-
-    // Ensure the sum of probabilities is equal to 1.0
-    if (probA + probB + probC != 1.0f)
+    for (int p = 0; p < numSweepPoints; p++)
     {
-        fprintf(stderr, "Error: The sum of probabilities must be 1.\n");
-        return 1;
+        SweepPoint *point = &sweepPoints[p];
+        int size = point->numH1 + point->numH2 + point->numH3;
+        for (int q = 0; q < numSweepPoints && point->feasible && !point->pruned; q++)
+        {
+            const SweepPoint *other = &sweepPoints[q];
+            point->pruned = q != p && other->replicas > 0 && other->weather == point->weather &&
+                            other->numH1 + other->numH2 + other->numH3 <= size && other->blackoutHigh < point->blackoutLow;
+        }
     }
+}
 
-    // Calculate the maximum total capacity
-    float totalMaxCapacity = numH1 * H1_CAPACITY + numH2 * H2_CAPACITY + numH3 * H3_CAPACITY;
-
-    // Validate if the total capacity is sufficient
-    if (totalMaxCapacity < MIN_GENERATION)
+/**
+ * Prints the Pareto frontier of a finished sweep for every weather: the mixes that no mix with as many
+ * plants or fewer beats on blackout probability, by increasing fleet size, and with --target the smallest
+ * mix whose 95% blackout interval stays under the target. The same figures go to the stats output as
+ * one JSON line per weather.
+ *
+ * @param jobs The number of replicas run at once.
+ * @param nanos The wall-clock time the sweep took.
+ * @param replicas The number of replicas run over all points.
+ */
+void reportSweep(int jobs, unsigned long long nanos, unsigned long replicas)
+{
+    const SweepPoint **sorted = malloc(sizeof(SweepPoint *) * numSweepPoints);
+    FILE *output = statsPath != NULL ? fopen(statsPath, "w") : stderr;
+    if (sorted == NULL || output == NULL)
     {
-        fprintf(stderr, "Error: The maximum total capacity of %f MW/s does not reach the required minimum of %f MW/s.\n", totalMaxCapacity, MIN_GENERATION);
-        return 1;
+        fprintf(stderr, "Error: Could not write the sweep statistics.\n");
+        exit(-1);
     }
 
-    // Signal handler setup
-    struct sigaction sa;
-    sa.sa_handler = &signalHandler;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = 0;
-    sigaction(SIGINT, &sa, NULL);
-
-    // Initialize mutexes and semaphores
-    pthread_mutex_init(&energyMutex, NULL);
-    sem_init(&adjustmentSemaphore, 0, 0);
-    sem_init(&sortingSemaphore, 0, 0);
-
-    // Create and add power plants to the list
-    createAndInsertPlants(numH1, "H1", H1_CAPACITY, 50.0, 200.0);
-    createAndInsertPlants(numH2, "H2", H2_CAPACITY, 25.0, 100.0);
-    createAndInsertPlants(numH3, "H3", H3_CAPACITY, 10.0, 50.0);
-
-    // Apply Greedy algorithm to determine active plants before thread creation
-    applyGreedyAlgorithm();
-
-    // Create and launch threads for power plants with CPU affinity
-    int num_cores = sysconf(_SC_NPROCESSORS_ONLN); // Get the number of CPU cores
-    HydroelectricPlantNode *current = head;
-    int core_id = 0;
-    while (current)
+    int infeasible = 0;
+    int pruned = 0;
+    for (int p = 0; p < numSweepPoints; p++)
     {
-        pthread_attr_t attr;
-        cpu_set_t cpus;
-        pthread_attr_init(&attr);
-        CPU_ZERO(&cpus);
-        CPU_SET(core_id % num_cores, &cpus); // Assign the thread to a specific core
-        pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpus);
-        pthread_create(&current->plant->thread, &attr, hydroelectricPlantRoutine, current->plant);
-        pthread_attr_destroy(&attr); // Clean thread attributes after use
-        core_id++;
-        current = current->next;
+        infeasible += !sweepPoints[p].feasible;
+        pruned += sweepPoints[p].pruned;
     }
+    double seconds = (double)nanos / 1e9;
+    printf("Sweep: %d fleet mixes under %d weathers, %d without the capacity to reach the minimum, %d pruned as dominated; "
+           "%lu replicas of %lu ticks, seeds from %llu, %d at a time, %.2f s (%.1f replicas/s).\n",
+           numSweepPoints / numSweepWeathers, numSweepWeathers, infeasible, pruned, replicas, tickLimit, randomSeed, jobs, seconds,
+           replicas / seconds);
 
-    // Create and launch the sorting thread
-    pthread_t sortingThread;
-    pthread_create(&sortingThread, NULL, sortingThreadRoutine, NULL);
-
-    // Main loop for Greedy algorithm and semaphore for Sorting thread
-    while (!shutdownRequested)
+    for (int w = 0; w < numSweepWeathers; w++)
     {
-        sem_wait(&adjustmentSemaphore);
-        printf("%sCapacity adjustment required: %f MW/s%s\n", c_yellow, totalEnergyGenerated, c_end);
-        applyGreedyAlgorithm();
+        // The evaluated points of the weather, by fleet size and then blackout probability
+        int count = 0;
+        for (int p = 0; p < numSweepPoints; p++)
+        {
+            if (sweepPoints[p].weather == w && sweepPoints[p].replicas > 0)
+            {
+                sorted[count++] = &sweepPoints[p];
+            }
+        }
+        qsort(sorted, count, sizeof(SweepPoint *), compareSweepPoints);
 
-        printf("%sAdjusted capacity: %f MW/s%s\n", c_green, totalEnergyGenerated, c_end);
-        sem_post(&sortingSemaphore);
+        printf("Weather %.3f/%.3f/%.3f, Pareto frontier of fleet size against blackout probability:\n", sweepWeathers[w][0],
+               sweepWeathers[w][1], sweepWeathers[w][2]);
+        fprintf(output, "{\"reason\":\"sweep\",\"probabilities\":[%f,%f,%f],\"ticks\":%lu,\"seed\":%llu,\"frontier\":[", sweepWeathers[w][0],
+                sweepWeathers[w][1], sweepWeathers[w][2], tickLimit, randomSeed);
+        const SweepPoint *smallest = NULL;
+        double best = 2.0;
+        for (int k = 0; k < count; k++)
+        {
+            const SweepPoint *point = sorted[k];
+            double blackoutProbability = (double)point->blackouts / point->replicas;
+            if (smallest == NULL && reliabilityTarget > 0.0 && point->blackoutHigh < reliabilityTarget)
+            {
+                smallest = point;
+            }
+            if (blackoutProbability >= best)
+            {
+                continue;
+            }
+            printf("  %d H1, %d H2, %d H3: %d plants, %.0f MW/s installed, blackout probability %.4f (95%% CI %.4f to %.4f, %d replicas), "
+                   "mean generation %f MW/s.\n",
+                   point->numH1, point->numH2, point->numH3, point->numH1 + point->numH2 + point->numH3,
+                   point->numH1 * H1_CAPACITY + point->numH2 * H2_CAPACITY + point->numH3 * H3_CAPACITY, blackoutProbability, point->blackoutLow,
+                   point->blackoutHigh, point->replicas, point->generationSum / point->replicas);
+            fprintf(output, "%s{\"h1\":%d,\"h2\":%d,\"h3\":%d,\"replicas\":%d,\"blackoutProbability\":%f,\"blackoutLow\":%f,\"blackoutHigh\":%f,\"meanGeneration\":%f}",
+                    best > 1.0 ? "" : ",", point->numH1, point->numH2, point->numH3, point->replicas, blackoutProbability, point->blackoutLow,
+                    point->blackoutHigh, point->generationSum / point->replicas);
+            best = blackoutProbability;
+        }
+        fprintf(output, "]");
+        if (reliabilityTarget > 0.0)
+        {
+            if (smallest != NULL)
+            {
+                printf("  Smallest fleet under a blackout probability of %.4f: %d H1, %d H2, %d H3 (%d plants).\n", reliabilityTarget,
+                       smallest->numH1, smallest->numH2, smallest->numH3, smallest->numH1 + smallest->numH2 + smallest->numH3);
+                fprintf(output, ",\"target\":%f,\"smallest\":{\"h1\":%d,\"h2\":%d,\"h3\":%d}", reliabilityTarget, smallest->numH1,
+                        smallest->numH2, smallest->numH3);
+            }
+            else
+            {
+                printf("  No fleet of the sweep stays under a blackout probability of %.4f with confidence.\n", reliabilityTarget);
+                fprintf(output, ",\"target\":%f,\"smallest\":null", reliabilityTarget);
+            }
+        }
+        fprintf(output, "}\n");
     }
 
-    // Wait for all threads to finish
-    current = head;
-    while (current)
+    if (output != stderr)
     {
-        pthread_join(current->plant->thread, NULL);
-        current = current->next;
+        fclose(output);
     }
-    pthread_join(sortingThread, NULL);
-
-    // Free resources
-    sem_destroy(&adjustmentSemaphore);
-    sem_destroy(&sortingSemaphore);
+    free(sorted);
+}
 
-    current = head;
-    while (current)
+/**
+ * Orders sweep points by fleet size, then by blackout probability and then by installed capacity, for qsort.
+ *
+ * @param a The first point, a pointer to a const SweepPoint pointer.
+ * @param b The second point.
+ * @return A negative number, zero or a positive number as the first point comes before, with or after the second.
+ */
+int compareSweepPoints(const void *a, const void *b)
+{
+    const SweepPoint *first = *(const SweepPoint *const *)a;
+    const SweepPoint *second = *(const SweepPoint *const *)b;
+    int firstSize = first->numH1 + first->numH2 + first->numH3;
+    int secondSize = second->numH1 + second->numH2 + second->numH3;
+    if (firstSize != secondSize)
     {
-        free(current->plant);
-        HydroelectricPlantNode *temp = current;
-        current = current->next;
-        free(temp);
+        return (firstSize > secondSize) - (firstSize < secondSize);
     }
-    return 0;
+    // Cross-multiplied, so points with different replica counts compare exactly
+    long long firstRate = (long long)first->blackouts * second->replicas;
+    long long secondRate = (long long)second->blackouts * first->replicas;
+    if (firstRate != secondRate)
+    {
+        return (firstRate > secondRate) - (firstRate < secondRate);
+    }
+    float firstCapacity = first->numH1 * H1_CAPACITY + first->numH2 * H2_CAPACITY + first->numH3 * H3_CAPACITY;
+    float secondCapacity = second->numH1 * H1_CAPACITY + second->numH2 * H2_CAPACITY + second->numH3 * H3_CAPACITY;
+    return (firstCapacity > secondCapacity) - (firstCapacity < secondCapacity);
 }
 
 /**
- * Creates and inserts a specified number of hydroelectric plants into the linked list.
- * Each plant is initialized with the given capacity, minimum and maximum water levels.
- * The plants are named according to their type and index, ensuring unique identifiers.
+ * Starts serving the control socket: listens on it, publishes a first status snapshot of the fleet, then
+ * starts the status thread, which keeps the snapshot fresh, and the control thread, which answers the
+ * clients. Exits the program if the socket cannot be set up.
  *
- * @param numPlants The number of plants to create.
- * @param plantType The type of the plant, used as a part of the plant's name.
- * @param capacity The capacity of each plant in megawatts.
- * @param minWaterLevel The minimum water level for each plant.
- * @param maxWaterLevel The maximum water level for each plant.
+ * @param path The path of the Unix-domain socket.
  */
-void createAndInsertPlants(int numPlants, const char *plantType, float capacity, float minWaterLevel, float maxWaterLevel)
+void startControl(const char *path)
 {
-    for (int i = 0; i < numPlants; ++i)
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Error: The control socket path %s is too long.\n", path);
+        exit(-1);
+    }
+    strcpy(address.sun_path, path);
+    struct stat existing;
+    if (stat(path, &existing) == 0 && S_ISSOCK(existing.st_mode))
+    {
+        unlink(path); // Left behind by a run that did not shut down cleanly
+    }
+    controlSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (controlSocket < 0 || bind(controlSocket, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(controlSocket, CONTROL_MAX_CLIENTS) != 0)
+    {
+        fprintf(stderr, "Error: Could not listen on the control socket %s.\n", path);
+        exit(-1);
+    }
+
+    controlReply = malloc(CONTROL_REPLY_SIZE);
+    bool allocated = controlReply != NULL;
+    for (int b = 0; b < SNAPSHOT_BUFFERS; b++)
+    {
+        statusSnapshots.buffers[b] = malloc(sizeof(StatusSnapshot));
+        allocated = allocated && statusSnapshots.buffers[b] != NULL;
+        atomic_init(&statusSnapshots.readers[b], 0);
+    }
+    if (!allocated)
+    {
+        fprintf(stderr, "Error: Could not allocate memory for the control socket.\n");
+        exit(-1);
+    }
+
+    controlWeather[0] = probA;
+    controlWeather[1] = probB;
+    controlWeather[2] = probC;
+    for (int r = 0; r < numRegions; r++)
     {
-        // Allocate memory for a new plant
-        HydroelectricPlant *plant = malloc(sizeof(HydroelectricPlant));
-        if (plant == NULL)
+        controlBands[r][0] = regions[r].minGeneration;
+        controlBands[r][1] = regions[r].maxGeneration;
+        controlCapacity[r] = 0.0f;
+        for (int plant = regions[r].first; plant < regions[r].last; plant++)
         {
-            fprintf(stderr, "Error: Could not allocate memory for the power plants.\n");
-            exit(-1); // Exit the program entirely if memory allocation fails
+            controlCapacity[r] += plants.capacity[plant];
         }
+    }
 
-        // Generate and assign a unique name for the plant
-        char nameBuffer[15];
-        sprintf(nameBuffer, "ID_%d_%s", i, plantType);
-        plant->name = strdup(nameBuffer);
+    int buffer = acquireSnapshot(&fleetSnapshots);
+    StatusSnapshot *status = statusSnapshots.buffers[0];
+    buildStatusSnapshot(status, fleetSnapshots.buffers[buffer], fleetSnapshots.epoch[buffer]);
+    releaseSnapshot(&fleetSnapshots, buffer);
+    readStatusCounters(status);
+    atomic_init(&statusSnapshots.published, 0);
+    publishSnapshot(&statusSnapshots, 0, status->tick);
 
-        // Initialize plant properties
-        plant->capacity = capacity;
-        plant->minWaterLevel = minWaterLevel;
-        plant->maxWaterLevel = maxWaterLevel;
-        plant->waterLevel = (minWaterLevel + maxWaterLevel) / 2;
-        plant->isActive = 0;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    placeThread(&attr, ROLE_SERVICE, 0);
+    pthread_create(&statusThread, &attr, statusThreadRoutine, NULL);
+    pthread_create(&controlThread, &attr, controlThreadRoutine, NULL);
+    pthread_attr_destroy(&attr);
+}
 
-        // Insert the plant into the sorted list
-        insertSorted(plant);
+/**
+ * Stops serving the control socket once the engine has stopped: waits for the status and control
+ * threads, removes the socket and frees the status snapshots. Changes still queued are dropped.
+ */
+void stopControl()
+{
+    atomic_store(&controlStopping, true);
+    pthread_join(controlThread, NULL);
+    pthread_join(statusThread, NULL);
+    close(controlSocket);
+    controlSocket = -1;
+    unlink(controlPath);
+    for (int b = 0; b < SNAPSHOT_BUFFERS; b++)
+    {
+        free(statusSnapshots.buffers[b]);
     }
+    free(controlReply);
 }
 
 /**
- * The routine for each hydroelectric plant thread. It simulates the operation of a hydroelectric plant,
- * including changes in water levels due to rain events and energy generation. The routine also handles
- * the activation and deactivation of the plant based on water levels.
+ * The routine for the status thread. Every STATUS_REFRESH_MS it fills a spare buffer of the status ring
+ * and publishes it: the plant figures are taken from the published fleet snapshot, or copied from the
+ * previous status if no tick ended since, and the generation and recovery figures are read from their
+ * atomics. The fleet scan runs here, never on the engine, dispatch or control threads.
  *
- * @param arg A pointer to a HydroelectricPlant structure.
  * @return Returns NULL upon completion.
  */
-void *hydroelectricPlantRoutine(void *arg)
+void *statusThreadRoutine()
 {
-    HydroelectricPlant *plant = (HydroelectricPlant *)arg;
-    int rainDuration = 0;
-    float rainIncrement = 0.0;
-    char *rain_type = "NL"; // No Rain
-
-    while (!shutdownRequested)
+    while (!atomic_load(&controlStopping))
     {
-        // Handle ongoing rain event
-        if (rainDuration > 0)
+        struct timespec pause = {0, STATUS_REFRESH_MS * 1000000L};
+        while (nanosleep(&pause, &pause) != 0 && errno == EINTR)
+        {
+        }
+        int target = reserveSnapshot(&statusSnapshots);
+        if (target < 0)
         {
-            plant->waterLevel += rainIncrement;
-            rainDuration--;
+            continue; // Every spare buffer is pinned by a query, the published status stays
+        }
+        StatusSnapshot *status = statusSnapshots.buffers[target];
+        int buffer = acquireSnapshot(&fleetSnapshots);
+        unsigned long tick = fleetSnapshots.epoch[buffer];
+        int published = acquireSnapshot(&statusSnapshots);
+        const StatusSnapshot *previous = statusSnapshots.buffers[published];
+        if (previous->tick == tick)
+        {
+            memcpy(status, previous, sizeof(StatusSnapshot));
         }
         else
         {
-            // Simulate a new rain event
-            float prob = (float)rand() / RAND_MAX;
-            if (prob < probA) // No rain
-            {
-                rainIncrement = NO_RAIN_INCREMENT;
-                rainDuration = NO_RAIN_DURATION;
-                rain_type = "NL";
-            }
-            else if (prob < probA + probB) // Light rain
-            {
-                rainIncrement = AGUACERO_INCREMENT;
-                rainDuration = AGUACERO_DURATION;
-                rain_type = "AG";
-            }
-            else // Heavy rain
-            {
-                rainIncrement = DILUVIO_INCREMENT;
-                rainDuration = DILUVIO_DURATION;
-                rain_type = "DI";
-            }
+            buildStatusSnapshot(status, fleetSnapshots.buffers[buffer], tick);
         }
+        releaseSnapshot(&statusSnapshots, published);
+        releaseSnapshot(&fleetSnapshots, buffer);
+        readStatusCounters(status);
+        publishSnapshot(&statusSnapshots, target, tick);
+    }
+    return NULL;
+}
 
-        // Simulate plant operation if active and not in recovery mode
-        if (plant->isActive && !waitingForRecover)
+/**
+ * Takes the plant figures of a status snapshot from a fleet snapshot in one pass: the plants and active
+ * plants of every class, and the STATUS_TOP_PLANTS plants with the highest relative water level, kept in
+ * a min-heap whose root is the one to beat, then sorted best first. The top plants are formatted as JSON
+ * here, so a top query only copies the first ones.
+ *
+ * @param status The status snapshot to fill.
+ * @param fleet The pinned fleet snapshot.
+ * @param tick The tick the fleet snapshot was taken at.
+ */
+void buildStatusSnapshot(StatusSnapshot *status, const FleetSnapshot *fleet, unsigned long tick)
+{
+    status->tick = tick;
+    memset(status->classPlants, 0, sizeof(status->classPlants));
+    memset(status->classActive, 0, sizeof(status->classActive));
+    int count = 0;
+    for (int plant = 0; plant < plants.count; plant++)
+    {
+        int plantClass = plants.classId[plant];
+        status->classPlants[plantClass]++;
+        status->classActive[plantClass] += fleet->isActive[plant] != 0;
+        float level = relativeWaterLevel(plant, fleet->waterLevel[plant]);
+        if (count < STATUS_TOP_PLANTS)
         {
-            // Deactivate plant if water level is out of bounds
-            if (plant->waterLevel - 5.0 < plant->minWaterLevel || plant->waterLevel - 5.0 > plant->maxWaterLevel)
+            status->topPlants[count] = plant;
+            status->topLevels[count] = level;
+            count++;
+            for (int position = count / 2 - 1; count == STATUS_TOP_PLANTS && position >= 0; position--)
             {
-                deactivatePlant(plant);
-                sem_post(&adjustmentSemaphore);
-                printf("%sDeactivating plant %s.%s\n", c_red, plant->name, c_end);
-                sleep(1);
-                continue;
+                siftStatusPlant(status, position, count);
             }
-            plant->waterLevel -= 5.0;             // Reduce water level due to energy generation
-            float water_flow = rainIncrement - 5; // Calculate net water flow
-            printf("%s %s %s Central %s - water_level: %.2f - water_flow: %.2f m/s.\n", c_cian, rain_type, c_end, plant->name, plant->waterLevel, water_flow);
         }
-
-        // Handle excess water if plant is inactive
-        if (!plant->isActive && plant->waterLevel > plant->maxWaterLevel)
+        else if (level > status->topLevels[0]) // On a tie the lower plant id, seen first, stays
         {
-            plant->waterLevel -= 5.0;
+            status->topPlants[0] = plant;
+            status->topLevels[0] = level;
+            siftStatusPlant(status, 0, count);
         }
-
-        sleep(1); // Wait one second before next iteration
+    }
+    for (int position = count / 2 - 1; count < STATUS_TOP_PLANTS && position >= 0; position--)
+    {
+        siftStatusPlant(status, position, count);
     }
 
-    pthread_exit(NULL); // Clean up and orderly exit the thread
-    return NULL;
+    // Moving the root of the min-heap to the end, size after size, leaves the best plant first
+    for (int size = count - 1; size > 0; size--)
+    {
+        int plant = status->topPlants[0];
+        float level = status->topLevels[0];
+        status->topPlants[0] = status->topPlants[size];
+        status->topLevels[0] = status->topLevels[size];
+        status->topPlants[size] = plant;
+        status->topLevels[size] = level;
+        siftStatusPlant(status, 0, size);
+    }
+    status->topCount = count;
+    size_t length = 0;
+    for (int i = 0; i < count; i++)
+    {
+        char name[PLANT_NAME_SIZE];
+        int plant = status->topPlants[i];
+        int written = snprintf(status->topJson + length, STATUS_PLANT_JSON_SIZE,
+                               "%s{\"plant\":%d,\"name\":\"%s\",\"region\":%d,\"relativeLevel\":%f,\"waterLevel\":%f,\"active\":%s}",
+                               i > 0 ? "," : "", plant, plantName(plant, name), plants.regionId[plant] + 1, status->topLevels[i],
+                               fleet->waterLevel[plant], fleet->isActive[plant] ? "true" : "false");
+        length += written < STATUS_PLANT_JSON_SIZE ? written : STATUS_PLANT_JSON_SIZE - 1;
+        status->topJsonEnd[i] = (int)length;
+    }
 }
 
 /**
- * The routine for the sorting thread. This function continuously sorts the list of hydroelectric plants
- * based on certain criteria. It waits for a signal before performing the sorting operation.
- * The sorting is executed until a shutdown request is received.
+ * Reads the generation and recovery figures of a status snapshot from their atomics.
  *
- * @return Returns NULL upon completion.
+ * @param status The status snapshot to fill.
  */
-void *sortingThreadRoutine()
+void readStatusCounters(StatusSnapshot *status)
 {
-    while (!shutdownRequested)
+    status->builtAt = monotonicNanos();
+    status->generation = currentGeneration();
+    status->recoveryAttempts = atomic_load(&recoveryAttempts);
+    status->recoveries = atomic_load(&recoveries);
+    for (int r = 0; r < numRegions; r++)
     {
-        // Notify about sorting operation execution
-        // printf("%sExecuting sorting thread.%s\n", c_magenta, c_end);
-        // Sort the list of hydroelectric plants
-        sortList();
-        // Wait for a signal to start the sorting
-        sem_wait(&sortingSemaphore);
+        const Region *region = &regions[r];
+        RegionStatus *record = &status->regions[r];
+        record->generation = regionGeneration(region);
+        record->shotsLeft = atomic_load(&region->lastShots);
+        record->recovering = atomic_load(&region->waitingForRecover);
+        record->retryTick = atomic_load(&region->retryTick);
     }
-
-    // Clean up and orderly exit the thread
-    pthread_exit(NULL);
-    return NULL;
 }
 
 /**
- * Deactivates a given hydroelectric plant.
- * This function sets the active status of the plant to false (0) and updates the total energy
- * generated by reducing the capacity of the deactivated plant.
+ * Compares two entries of the top-plants heap of a status snapshot.
  *
- * @param plant A pointer to the HydroelectricPlant structure representing the plant to be deactivated.
+ * @param status The status snapshot.
+ * @param a The position of the first entry.
+ * @param b The position of the second entry.
+ * @return true if the first plant ranks below the second: a lower relative water level, or the same with a higher id.
  */
-void deactivatePlant(HydroelectricPlant *plant)
+bool ranksBelow(const StatusSnapshot *status, int a, int b)
 {
-    plant->isActive = 0;
-    pthread_mutex_lock(&energyMutex);        // Lock the mutex to ensure exclusive access to shared resource
-    totalEnergyGenerated -= plant->capacity; // Update the total energy generation
-    pthread_mutex_unlock(&energyMutex);      // Unlock the mutex
+    return status->topLevels[a] < status->topLevels[b] ||
+           (status->topLevels[a] == status->topLevels[b] && status->topPlants[a] > status->topPlants[b]);
 }
 
 /**
- * Activates a given hydroelectric plant.
- * This function sets the active status of the plant to true (1) and updates the total energy
- * generated by adding the capacity of the activated plant.
+ * Moves an entry of the top-plants min-heap of a status snapshot down until no child ranks below it.
  *
- * @param plant A pointer to the HydroelectricPlant structure representing the plant to be activated.
+ * @param status The status snapshot.
+ * @param position The position of the entry.
+ * @param size The number of entries in the heap.
  */
-void activatePlant(HydroelectricPlant *plant)
+void siftStatusPlant(StatusSnapshot *status, int position, int size)
 {
-    plant->isActive = 1;
-    pthread_mutex_lock(&energyMutex);        // Lock the mutex to ensure exclusive access to shared resource
-    totalEnergyGenerated += plant->capacity; // Update the total energy generation
-    pthread_mutex_unlock(&energyMutex);      // Unlock the mutex
+    while (true)
+    {
+        int lowest = position;
+        for (int child = 2 * position + 1; child <= 2 * position + 2 && child < size; child++)
+        {
+            if (ranksBelow(status, child, lowest))
+            {
+                lowest = child;
+            }
+        }
+        if (lowest == position)
+        {
+            return;
+        }
+        int plant = status->topPlants[position];
+        float level = status->topLevels[position];
+        status->topPlants[position] = status->topPlants[lowest];
+        status->topLevels[position] = status->topLevels[lowest];
+        status->topPlants[lowest] = plant;
+        status->topLevels[lowest] = level;
+        position = lowest;
+    }
 }
 
 /**
- * Inserts a hydroelectric plant into the global linked list in a sorted order.
- * The sorting is based on the comparison criteria defined in the comparePlants function.
- * The function allocates memory for a new HydroelectricPlantNode, assigns the provided plant to it,
- * and inserts it into the list such that the list remains sorted.
+ * The routine for the control thread. Waits on the listening socket and the connected clients with poll,
+ * accepts up to CONTROL_MAX_CLIENTS clients and answers every command line they send, until shutdown.
  *
- * @param plant A pointer to the HydroelectricPlant structure to be inserted into the list.
+ * @return Returns NULL upon completion.
  */
-void insertSorted(HydroelectricPlant *plant)
+void *controlThreadRoutine()
 {
-    HydroelectricPlantNode *newNode = malloc(sizeof(HydroelectricPlantNode)); // Allocate memory for new node
-    newNode->plant = plant;                                                   // Assign the plant to the new node
-    newNode->next = NULL;                                                     // Set the next pointer of the new node to NULL
-
-    // Insert the new node into the list in the sorted position
-    if (head == NULL || comparePlants(newNode->plant, head->plant) > 0) // If the list is empty or new node should be the new head
-    {
-        newNode->next = head; // Set the new node's next to current head
-        head = newNode;       // Update the head to the new node
-    }
-    else // Insert the new node at the correct sorted position in the list
+    struct pollfd fds[CONTROL_MAX_CLIENTS + 1];
+    ControlClient clients[CONTROL_MAX_CLIENTS];
+    int numClients = 0;
+    while (!atomic_load(&controlStopping))
     {
-        HydroelectricPlantNode *current = head;
-        // Traverse the list to find the correct position to insert the new node
-        while (current->next != NULL && comparePlants(newNode->plant, current->next->plant) <= 0)
+        fds[0] = (struct pollfd){.fd = controlSocket, .events = POLLIN};
+        for (int c = 0; c < numClients; c++)
+        {
+            fds[c + 1] = (struct pollfd){.fd = clients[c].fd, .events = POLLIN};
+        }
+        if (poll(fds, numClients + 1, STATUS_REFRESH_MS) <= 0)
+        {
+            continue; // Timed out, or interrupted by a signal
+        }
+
+        // A closed client is replaced by the last one, already served since the walk goes backwards
+        for (int c = numClients - 1; c >= 0; c--)
+        {
+            if (fds[c + 1].revents != 0 && !serveControlClient(&clients[c]))
+            {
+                close(clients[c].fd);
+                clients[c] = clients[--numClients];
+            }
+        }
+        if (fds[0].revents & POLLIN)
         {
-            current = current->next;
+            int fd = accept(controlSocket, NULL, NULL);
+            if (fd >= 0 && numClients == CONTROL_MAX_CLIENTS)
+            {
+                close(fd);
+            }
+            else if (fd >= 0)
+            {
+                struct timeval timeout = {1, 0}; // A client that stops reading cannot hold up the others for long
+                setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                clients[numClients].fd = fd;
+                clients[numClients].length = 0;
+                numClients++;
+            }
         }
-        newNode->next = current->next; // Set the new node's next to current node's next
-        current->next = newNode;       // Insert the new node after the current node
     }
+    for (int c = 0; c < numClients; c++)
+    {
+        close(clients[c].fd);
+    }
+    return NULL;
 }
+
 /**
- * Compares two hydroelectric plants based on their capacity and relative water levels.
- * The comparison is primarily based on the capacity of the plants, and secondarily on
- * their water levels relative to their minimum and maximum limits.
+ * Reads what a client sent and answers each complete command line with one reply line.
  *
- * @param a Pointer to the first HydroelectricPlant to compare.
- * @param b Pointer to the second HydroelectricPlant to compare.
- * @return An integer greater than 0 if 'a' has higher priority than 'b', less than 0 if 'b' has higher priority, or 0 if they are equal.
+ * @param client The client whose socket is readable.
+ * @return false if the client closed the connection, sent a line longer than CONTROL_LINE_SIZE or could not be answered.
  */
-int comparePlants(HydroelectricPlant *a, HydroelectricPlant *b)
+bool serveControlClient(ControlClient *client)
 {
-    // Then compare based on relative water level
-    if (a->waterLevel != b->waterLevel)
+    ssize_t received = recv(client->fd, client->line + client->length, CONTROL_LINE_SIZE - 1 - client->length, 0);
+    if (received <= 0)
     {
-        float relative_level_a = (a->waterLevel - a->minWaterLevel) / (a->maxWaterLevel - a->minWaterLevel);
-        float relative_level_b = (b->waterLevel - b->minWaterLevel) / (b->maxWaterLevel - b->minWaterLevel);
-        return (relative_level_a > relative_level_b) ? 1 : -1;
+        return false;
     }
-    // Compare based on capacity
-    if (a->capacity != b->capacity)
+    unsigned long long start = monotonicNanos();
+    client->length += (int)received;
+    char *cursor = client->line;
+    char *newline;
+    while ((newline = memchr(cursor, '\n', client->line + client->length - cursor)) != NULL)
     {
-        return (a->capacity > b->capacity) ? 1 : -1;
+        *newline = '\0';
+        size_t length = answerControlCommand(cursor, controlReply);
+        if (send(client->fd, controlReply, length, MSG_NOSIGNAL) != (ssize_t)length)
+        {
+            return false;
+        }
+        recordLatency(LATENCY_QUERY, monotonicNanos() - start);
+        controlQueries++;
+        cursor = newline + 1;
     }
-    return 0;
+    client->length -= (int)(cursor - client->line);
+    memmove(client->line, cursor, client->length);
+    if (client->length == CONTROL_LINE_SIZE - 1)
+    {
+        size_t length = appendReply(controlReply, 0, "{\"error\":\"command longer than %d bytes\"}\n", CONTROL_LINE_SIZE - 2);
+        send(client->fd, controlReply, length, MSG_NOSIGNAL);
+        return false;
+    }
+    return true;
 }
 
 /**
- * Sorts the global linked list of hydroelectric plants based on the criteria defined in comparePlants function.
- * The sorting is implemented using a modified insertion sort algorithm, suitable for linked lists.
+ * Answers one command of the control socket with one JSON line. Queries are answered from the published
+ * status snapshot, pinned for the time it takes to format the reply; changes are validated and queued for
+ * the engine, which applies them at the next tick boundary. Commands:
+ *   generation                  Fleet and region generation, bands and weather probabilities.
+ *   top [N]                     The N plants with the highest relative water level (default 10).
+ *   recovery                    Recovery counters and the recovery state of every region.
+ *   classes                     Plants and active plants of every class.
+ *   set weather A B C           New probabilities of no rain, downpour and flood.
+ *   set band [REGION] MIN MAX   New demand band of a region (default 1), MAX capped at its capacity.
+ *
+ * @param command The command line, without its newline; split in place.
+ * @param reply A buffer of CONTROL_REPLY_SIZE bytes.
+ * @return The length of the reply, newline included.
  */
-void sortList()
+size_t answerControlCommand(char *command, char *reply)
 {
-    if (!head || !head->next)
+    char *words[6];
+    int count = 0;
+    char *save = NULL;
+    for (char *word = strtok_r(command, " \t\r", &save); word != NULL; word = strtok_r(NULL, " \t\r", &save))
+    {
+        if (count == 6)
+        {
+            return appendReply(reply, 0, "{\"error\":\"too many arguments\"}\n");
+        }
+        words[count++] = word;
+    }
+    if (count == 0)
     {
-        return; // Nothing to sort if the list is empty or has only one element
+        return appendReply(reply, 0, "{\"error\":\"empty command\"}\n");
     }
 
-    HydroelectricPlantNode *sorted = NULL;  // Sorted part of the list
-    HydroelectricPlantNode *current = head; // Pointer to the current element in the original list
-
-    while (current != NULL)
+    if (strcmp(words[0], "set") == 0)
     {
-        HydroelectricPlantNode *next = current->next; // Store the next element
-
-        // Insert the current element into the correct position in the sorted part of the list
-        if (sorted == NULL || comparePlants(current->plant, sorted->plant) > 0)
+        ControlChange change = {0};
+        float values[3];
+        int first = count == 5 && strcmp(words[1], "band") == 0 ? 3 : 2; // First number of the new values
+        bool valid = count >= 2 && count - first <= 3;
+        for (int i = first; i < count && valid; i++)
         {
-            current->next = sorted;
-            sorted = current;
+            char *end;
+            values[i - first] = strtof(words[i], &end);
+            valid = end != words[i] && *end == '\0' && isfinite(values[i - first]) && values[i - first] >= 0.0f;
         }
-        else
+        if (valid && strcmp(words[1], "weather") == 0)
+        {
+            if (count != 5 || values[0] + values[1] + values[2] != 1.0f)
+            {
+                return appendReply(reply, 0, "{\"error\":\"set weather takes three probabilities summing to 1\"}\n");
+            }
+            if (weatherTrace != NULL)
+            {
+                return appendReply(reply, 0, "{\"error\":\"the weather is replayed from a trace\"}\n");
+            }
+            change.kind = CONTROL_SET_WEATHER;
+            memcpy(change.values, values, sizeof(values));
+            if (!queueControlChange(&change))
+            {
+                return appendReply(reply, 0, "{\"error\":\"too many changes waiting for the next tick\"}\n");
+            }
+            memcpy(controlWeather, values, sizeof(values));
+            return appendReply(reply, 0, "{\"ok\":true,\"probabilities\":[%f,%f,%f]}\n", values[0], values[1], values[2]);
+        }
+        if (valid && strcmp(words[1], "band") == 0)
         {
-            HydroelectricPlantNode *sortedCurrent = sorted;
-            while (sortedCurrent->next != NULL && comparePlants(current->plant, sortedCurrent->next->plant) <= 0)
+            int region = count == 5 ? atoi(words[2]) - 1 : 0;
+            if ((count != 4 && count != 5) || values[0] > values[1] || region < 0 || region >= numRegions)
+            {
+                return appendReply(reply, 0, "{\"error\":\"set band takes an optional region from 1 to %d, then MIN <= MAX\"}\n", numRegions);
+            }
+            if (values[0] > controlCapacity[region])
             {
-                sortedCurrent = sortedCurrent->next;
+                return appendReply(reply, 0, "{\"error\":\"the minimum exceeds the %f MW/s capacity of region %d\"}\n",
+                                   controlCapacity[region], region + 1);
             }
-            current->next = sortedCurrent->next;
-            sortedCurrent->next = current;
+            if (values[1] > controlCapacity[region])
+            {
+                values[1] = controlCapacity[region]; // No dispatch can go past the capacity of the region
+            }
+            change.kind = CONTROL_SET_BAND;
+            change.region = region;
+            memcpy(change.values, values, sizeof(float) * 2);
+            if (!queueControlChange(&change))
+            {
+                return appendReply(reply, 0, "{\"error\":\"too many changes waiting for the next tick\"}\n");
+            }
+            controlBands[region][0] = values[0];
+            controlBands[region][1] = values[1];
+            return appendReply(reply, 0, "{\"ok\":true,\"region\":%d,\"minGeneration\":%f,\"maxGeneration\":%f}\n", region + 1, values[0],
+                               values[1]);
         }
+        return appendReply(reply, 0, "{\"error\":\"usage: set weather A B C, or set band [REGION] MIN MAX\"}\n");
+    }
 
-        current = next; // Move to the next element in the original list
+    int limit = 10; // Plants listed by top
+    if (count == 2 && strcmp(words[0], "top") == 0)
+    {
+        limit = atoi(words[1]);
+        if (limit <= 0 || limit > STATUS_TOP_PLANTS)
+        {
+            return appendReply(reply, 0, "{\"error\":\"top lists 1 to %d plants\"}\n", STATUS_TOP_PLANTS);
+        }
+    }
+    else if (count != 1 || (strcmp(words[0], "generation") != 0 && strcmp(words[0], "top") != 0 &&
+                            strcmp(words[0], "recovery") != 0 && strcmp(words[0], "classes") != 0))
+    {
+        return appendReply(reply, 0, "{\"error\":\"unknown command; try generation, top [N], recovery, classes, set weather or set band\"}\n");
     }
 
-    head = sorted; // Update the head of the list to the sorted list
+    int buffer = acquireSnapshot(&statusSnapshots);
+    const StatusSnapshot *status = statusSnapshots.buffers[buffer];
+    size_t length = appendReply(reply, 0, "{\"tick\":%lu,\"age\":%llu,", status->tick, monotonicNanos() - status->builtAt);
+    if (strcmp(words[0], "generation") == 0)
+    {
+        length = appendReply(reply, length, "\"generation\":%f,\"probabilities\":[%f,%f,%f],\"regions\":[", status->generation,
+                             controlWeather[0], controlWeather[1], controlWeather[2]);
+        for (int r = 0; r < numRegions; r++)
+        {
+            length = appendReply(reply, length, "%s{\"region\":%d,\"generation\":%f,\"minGeneration\":%f,\"maxGeneration\":%f}",
+                                 r > 0 ? "," : "", r + 1, status->regions[r].generation, controlBands[r][0], controlBands[r][1]);
+        }
+    }
+    else if (strcmp(words[0], "top") == 0)
+    {
+        length = appendReply(reply, length, "\"plants\":[");
+        limit = limit < status->topCount ? limit : status->topCount;
+        if (limit > 0)
+        {
+            memcpy(reply + length, status->topJson, status->topJsonEnd[limit - 1]);
+            length += status->topJsonEnd[limit - 1];
+        }
+    }
+    else if (strcmp(words[0], "recovery") == 0)
+    {
+        length = appendReply(reply, length, "\"recoveryAttempts\":%lu,\"recoveries\":%lu,\"regions\":[", status->recoveryAttempts,
+                             status->recoveries);
+        for (int r = 0; r < numRegions; r++)
+        {
+            const RegionStatus *region = &status->regions[r];
+            length = appendReply(reply, length, "%s{\"region\":%d,\"recovering\":%s,\"recoveryShotsLeft\":%d", r > 0 ? "," : "", r + 1,
+                                 region->recovering ? "true" : "false", region->shotsLeft);
+            length = region->recovering ? appendReply(reply, length, ",\"retryTick\":%lu}", region->retryTick)
+                                        : appendReply(reply, length, "}");
+        }
+    }
+    else
+    {
+        length = appendReply(reply, length, "\"classes\":[");
+        for (int c = 0; c < numPlantClasses; c++)
+        {
+            length = appendReply(reply, length, "%s{\"class\":\"%s\",\"plants\":%d,\"active\":%d}", c > 0 ? "," : "", plantClasses[c].name,
+                                 status->classPlants[c], status->classActive[c]);
+        }
+    }
+    releaseSnapshot(&statusSnapshots, buffer);
+    return appendReply(reply, length, "]}\n");
 }
 
 /**
- * Applies a greedy algorithm to activate hydroelectric plants optimally.
- * The algorithm iterates through the list of plants and activates them if doing so doesn't exceed
- * the maximum generation capacity and if the plant's water level is above its minimum.
- * It aims to reach at least the minimum generation capacity. If the minimum capacity isn't reached,
- * it attempts to recover by recursively calling itself, decrementing a counter each time.
- * If the recovery attempts run out, it triggers a shutdown sequence.
+ * Appends formatted text to a control reply, truncating it at CONTROL_REPLY_SIZE.
  *
- * @return A boolean indicating whether a satisfactory generation level was achieved (true) or not (false).
+ * @param reply A buffer of CONTROL_REPLY_SIZE bytes.
+ * @param length The length of the reply so far.
+ * @param format The printf format of the text.
+ * @return The new length of the reply.
  */
-bool applyGreedyAlgorithm()
+size_t appendReply(char *reply, size_t length, const char *format, ...)
 {
-    printf("Applying greedy algorithm.\n");
+    va_list arguments;
+    va_start(arguments, format);
+    int written = vsnprintf(reply + length, CONTROL_REPLY_SIZE - length, format, arguments);
+    va_end(arguments);
+    length += written > 0 ? (size_t)written : 0;
+    return length < CONTROL_REPLY_SIZE ? length : CONTROL_REPLY_SIZE - 1;
+}
 
-    float currentGeneration = totalEnergyGenerated;
-    HydroelectricPlantNode *currentNode = head;
+/**
+ * Queues a runtime change for the engine. Only the control thread queues changes.
+ *
+ * @param change The validated change.
+ * @return false if CONTROL_CHANGES changes are already waiting for the next tick boundary.
+ */
+bool queueControlChange(const ControlChange *change)
+{
+    unsigned int head = atomic_load_explicit(&controlChangeHead, memory_order_relaxed);
+    if (head - atomic_load_explicit(&controlChangeTail, memory_order_acquire) == CONTROL_CHANGES)
+    {
+        return false;
+    }
+    controlChanges[head % CONTROL_CHANGES] = *change;
+    atomic_store_explicit(&controlChangeHead, head + 1, memory_order_release); // Hand the change to the engine
+    return true;
+}
 
-    // Activate plants optimally
-    while (currentNode != NULL)
+/**
+ * Applies the changes queued on the control socket, in order, at a tick boundary: the workers are parked,
+ * so the new weather probabilities hold for whole ticks. A new band takes effect with the dispatch pass
+ * run for it at the end of the tick; a pass already running on another dispatcher may see either band.
+ * With event scheduling, a change of weather also takes the idle plants off the timer wheels.
+ */
+void applyControlChanges()
+{
+    unsigned int tail = atomic_load_explicit(&controlChangeTail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&controlChangeHead, memory_order_acquire);
+    if (tail == head)
+    {
+        return;
+    }
+    bool weatherChanged = false;
+    for (; tail != head; tail++)
     {
-        if (!currentNode->plant->isActive && currentNode->plant->waterLevel > currentNode->plant->minWaterLevel &&
-            currentGeneration + currentNode->plant->capacity <= MAX_GENERATION)
+        const ControlChange *change = &controlChanges[tail % CONTROL_CHANGES];
+        if (change->kind == CONTROL_SET_WEATHER)
         {
-            activatePlant(currentNode->plant);
-            printf("%sActivated Plant %s%s\n", c_blue, currentNode->plant->name, c_end);
-            currentGeneration += currentNode->plant->capacity;
+            probA = change->values[0];
+            probB = change->values[1];
+            probC = change->values[2];
+            weatherChanged = true;
+            logEvent(LOG_EVENT_WEATHER_CHANGED, -1, 0, probA, probB);
         }
-        if (currentGeneration >= MIN_GENERATION)
+        else
         {
-            waitingForRecover = false;
-            return true; // Stop if minimum generation is reached
+            Region *region = &regions[change->region];
+            region->minGeneration = change->values[0];
+            region->maxGeneration = change->values[1];
+            atomic_store(&region->bandChanged, true);
+            logEvent(LOG_EVENT_BAND_CHANGED, -1, change->region, change->values[0], change->values[1]);
         }
-        currentNode = currentNode->next;
-    }
-    if (lastShots > 0)
-    {
-        waitingForRecover = true;
-        lastShots -= 1;
-        printf("%sALERT: starting recovery attempts before immediate shutdown - %i.%s\n", c_red, lastShots, c_end);
-        sleep(1);
-        return applyGreedyAlgorithm();
+        controlChangesApplied++;
     }
-    else
+    atomic_store_explicit(&controlChangeTail, tail, memory_order_release); // Give the slots back to the control thread
+    if (weatherChanged && scheduleMode == SCHEDULE_EVENT)
     {
-        shutdownPlantsAndPrintFinalStatus();
+        rescheduleIdlePlants();
     }
-    return false;
 }
 
 /**
- * Shuts down all hydroelectric plants and prints their final status. This function is called when no
- * combination of plant activations can maintain the required energy generation levels. It iterates
- * through all the plants, printing their final water level and activation status before signaling
- * the program to shut down.
+ * Takes every idle plant off the timer wheels after the weather probabilities changed, since their wake-up
+ * ticks were scanned with the old ones. Each is advanced on the next tick, which leaves it as it is unless
+ * it draws rain, and goes back on the wheel with a wake-up tick scanned with the new probabilities. Runs at
+ * a tick boundary, with the workers parked.
  */
-void shutdownPlantsAndPrintFinalStatus()
+void rescheduleIdlePlants()
 {
-    printf("%sNo combination can maintain the plants operational. Proceeding to shut down everything.%s\n", c_red, c_end);
-    printf("%sBelow is the final state of each plant.%s\n", c_red, c_end);
-    HydroelectricPlantNode *current = head;
-
-    while (current != NULL)
+    for (int w = 0; w < numWorkers; w++)
     {
-        HydroelectricPlant *plant = current->plant;
-        printf("Plant: %s, Min Water Level: %.2f, Max Water Level: %.2f, Current Water Level: %.2f, Status: %s\n",
-               plant->name,
-               plant->minWaterLevel,
-               plant->maxWaterLevel,
-               plant->waterLevel,
-               plant->isActive ? "Activated" : "Deactivated");
-        current = current->next;
+        EngineWorker *worker = &workers[w];
+        for (int plant = worker->first; plant < worker->last; plant++)
+        {
+            if (timerSlot[plant] >= 0)
+            {
+                removeTimer(worker, plant);
+                setBusyPlant(worker, plant, true);
+            }
+        }
     }
-    shutdownRequested = 1;
-}
\ No newline at end of file
+}
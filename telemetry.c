@@ -0,0 +1,379 @@
+// Reader of the columnar telemetry files written by blackout --telemetry
+#define _GNU_SOURCE
+// Headers
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include "telemetry.h"
+
+const char *rainTypeCodes[] = {"NL", "AG", "DI"};
+
+// Mapped telemetry file
+const unsigned char *file = NULL;
+size_t fileSize = 0;
+const TelemetryHeader *header = NULL;
+
+// Function declarations
+bool parseRange(const char *spec, long long *first, long long *last);
+bool openTelemetry(const char *path);
+void printInfo();
+bool extractChunk(const TelemetryChunkEntry *entry, long long firstPlant, long long lastPlant, long long firstTick, long long lastTick,
+                  float *levels, unsigned char *states, long long *generation);
+unsigned long long getBits(const unsigned char *run, unsigned long long bit, unsigned int count);
+long long unzigzag(unsigned long long value);
+size_t runBytes(unsigned long long values, unsigned int bits);
+bool runFits(unsigned long long values, unsigned int bits, size_t room);
+
+/**
+ * Extracts a range of plants and ticks from a telemetry file as CSV lines on stdout:
+ * tick,plant,water_level,active,rain,generation_mw. Only the chunks holding the ticks and, within them,
+ * the blocks holding the plants are decoded.
+ * Usage: blackout-telemetry [--plants FIRST:LAST] [--ticks FIRST:LAST] [--info] FILE
+ *
+ * @param argc The count of command-line arguments.
+ * @param argv The command-line arguments.
+ * @return int Returns 0 on successful execution, 1 on error.
+ */
+int main(int argc, char *argv[])
+{
+    static struct option longOptions[] = {
+        {"plants", required_argument, NULL, 'p'},
+        {"ticks", required_argument, NULL, 't'},
+        {"info", no_argument, NULL, 'i'},
+        {NULL, 0, NULL, 0}};
+
+    long long firstPlant = 0, lastPlant = LLONG_MAX;
+    long long firstTick = 0, lastTick = LLONG_MAX;
+    bool info = false;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", longOptions, NULL)) != -1)
+    {
+        if ((opt == 'p' && !parseRange(optarg, &firstPlant, &lastPlant)) || (opt == 't' && !parseRange(optarg, &firstTick, &lastTick)) ||
+            opt == '?')
+        {
+            fprintf(stderr, "Usage: %s [--plants FIRST:LAST] [--ticks FIRST:LAST] [--info] FILE\n", argv[0]);
+            return 1;
+        }
+        info = info || opt == 'i';
+    }
+    if (argc - optind != 1)
+    {
+        fprintf(stderr, "Usage: %s [--plants FIRST:LAST] [--ticks FIRST:LAST] [--info] FILE\n", argv[0]);
+        return 1;
+    }
+    if (!openTelemetry(argv[optind]))
+    {
+        return 1;
+    }
+    if (info)
+    {
+        printInfo();
+        return 0;
+    }
+
+    lastPlant = lastPlant < header->plantCount - 1 ? lastPlant : header->plantCount - 1;
+    if (firstPlant > lastPlant)
+    {
+        return 0;
+    }
+    size_t cells = (size_t)(lastPlant - firstPlant + 1) * header->chunkTicks;
+    float *levels = malloc(sizeof(float) * cells);
+    unsigned char *states = malloc(cells);
+    long long *generation = malloc(sizeof(long long) * header->chunkTicks);
+    if (levels == NULL || states == NULL || generation == NULL)
+    {
+        fprintf(stderr, "Error: Could not allocate memory for the plants.\n");
+        return 1;
+    }
+
+    printf("tick,plant,water_level,active,rain,generation_mw\n");
+    const TelemetryChunkEntry *index = (const TelemetryChunkEntry *)(file + header->indexOffset);
+    for (int c = 0; c < header->chunks; c++)
+    {
+        if ((long long)index[c].firstTick > lastTick || (long long)(index[c].firstTick + index[c].ticks) <= firstTick)
+        {
+            continue;
+        }
+        if (!extractChunk(&index[c], firstPlant, lastPlant, firstTick, lastTick, levels, states, generation))
+        {
+            fprintf(stderr, "Error: Chunk %d of the telemetry file is corrupt.\n", c);
+            return 1;
+        }
+    }
+    free(levels);
+    free(states);
+    free(generation);
+    return 0;
+}
+
+/**
+ * Parses a FIRST:LAST range, both ends included; either end may be left out.
+ *
+ * @param spec The range.
+ * @param first Output, the first value, left as is if omitted.
+ * @param last Output, the last value, left as is if omitted.
+ * @return false if the range is invalid.
+ */
+bool parseRange(const char *spec, long long *first, long long *last)
+{
+    char *end;
+    const char *colon = strchr(spec, ':');
+    if (colon == NULL)
+    {
+        return false;
+    }
+    if (colon != spec)
+    {
+        *first = strtoll(spec, &end, 10);
+        if (end != colon || *first < 0)
+        {
+            return false;
+        }
+    }
+    if (colon[1] != '\0')
+    {
+        *last = strtoll(colon + 1, &end, 10);
+        if (*end != '\0' || *last < *first)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Maps a telemetry file and checks its header and chunk index.
+ *
+ * @param path The path of the telemetry file.
+ * @return false if the file cannot be read or is not a complete telemetry file.
+ */
+bool openTelemetry(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) != 0)
+    {
+        fprintf(stderr, "Error: Could not open the telemetry file %s.\n", path);
+        return false;
+    }
+    fileSize = (size_t)status.st_size;
+    void *mapping = fileSize >= sizeof(TelemetryHeader) ? mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    file = mapping;
+    header = mapping;
+    if (mapping == MAP_FAILED || memcmp(header->magic, "BLACKTLM", 8) != 0 || header->version != TELEMETRY_VERSION ||
+        header->headerSize != sizeof(TelemetryHeader) || header->chunkTicks <= 0 || header->chunkTicks > TELEMETRY_MAX_CHUNK_TICKS ||
+        header->blockPlants <= 0 || header->blockPlants > TELEMETRY_MAX_BLOCK_PLANTS || header->indexOffset == 0 ||
+        header->indexOffset > fileSize || (fileSize - header->indexOffset) / sizeof(TelemetryChunkEntry) < (size_t)header->chunks)
+    {
+        fprintf(stderr, "Error: %s is not a complete telemetry file of version %d.\n", path, TELEMETRY_VERSION);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Prints the header of the telemetry file and its chunks.
+ */
+void printInfo()
+{
+    printf("Telemetry: %d plants, ticks %llu to %llu (%llu recorded, %llu dropped), %d chunks of up to %d ticks in blocks of %d plants, "
+           "%zu bytes (%.2f per plant-tick).\n",
+           header->plantCount, header->firstTick, header->firstTick + header->ticks + header->droppedTicks - 1, header->ticks,
+           header->droppedTicks, header->chunks, header->chunkTicks, header->blockPlants, fileSize,
+           header->ticks > 0 ? (double)fileSize / ((double)header->ticks * header->plantCount) : 0.0);
+    const TelemetryChunkEntry *index = (const TelemetryChunkEntry *)(file + header->indexOffset);
+    for (int c = 0; c < header->chunks; c++)
+    {
+        printf("Chunk %d: ticks %llu to %llu, %u bytes at %llu.\n", c, index[c].firstTick, index[c].firstTick + index[c].ticks - 1,
+               index[c].size, index[c].offset);
+    }
+}
+
+/**
+ * Decodes the selected plants of one chunk and prints the selected ticks, tick by tick.
+ *
+ * @param entry The index entry of the chunk.
+ * @param firstPlant The first plant to print.
+ * @param lastPlant The last plant to print, within the fleet.
+ * @param firstTick The first tick to print.
+ * @param lastTick The last tick to print.
+ * @param levels Scratch room for the chunk ticks of the plants to print.
+ * @param states Scratch room of the same size.
+ * @param generation Scratch room for the generation of chunkTicks ticks.
+ * @return false if the chunk is corrupt.
+ */
+bool extractChunk(const TelemetryChunkEntry *entry, long long firstPlant, long long lastPlant, long long firstTick, long long lastTick,
+                  float *levels, unsigned char *states, long long *generation)
+{
+    if (entry->offset > fileSize || fileSize - entry->offset < entry->size || entry->size < sizeof(TelemetryChunkHeader))
+    {
+        return false;
+    }
+    const unsigned char *chunk = file + entry->offset;
+    TelemetryChunkHeader chunkHeader;
+    memcpy(&chunkHeader, chunk, sizeof(chunkHeader));
+    int ticks = chunkHeader.ticks;
+    int blocks = chunkHeader.blocks;
+    size_t generationBytes = runBytes(ticks - 1, chunkHeader.generationBits);
+    if (ticks <= 0 || ticks > header->chunkTicks || chunkHeader.generationBits > 64 || blocks < 0 ||
+        lastPlant / header->blockPlants >= blocks ||
+        sizeof(chunkHeader) + generationBytes + sizeof(unsigned int) * ((size_t)blocks + 1) > entry->size)
+    {
+        return false;
+    }
+
+    // Generation of every tick of the chunk
+    generation[0] = chunkHeader.generationBase;
+    const unsigned char *run = chunk + sizeof(chunkHeader);
+    for (int t = 1; t < ticks; t++)
+    {
+        generation[t] = generation[t - 1] + unzigzag(getBits(run, (unsigned long long)(t - 1) * chunkHeader.generationBits,
+                                                             chunkHeader.generationBits));
+    }
+    const unsigned char *offsets = run + generationBytes;
+
+    // Only the blocks holding the selected plants are read, and within them only those plants
+    for (long long b = firstPlant / header->blockPlants; b <= lastPlant / header->blockPlants; b++)
+    {
+        unsigned int start, end;
+        memcpy(&start, offsets + sizeof(unsigned int) * b, sizeof(start));
+        memcpy(&end, offsets + sizeof(unsigned int) * (b + 1), sizeof(end));
+        long long blockFirst = b * header->blockPlants;
+        long long count = header->plantCount - blockFirst < header->blockPlants ? header->plantCount - blockFirst : header->blockPlants;
+        TelemetryBlockHeader block;
+        if (start > end || end > entry->size || end - start < sizeof(block))
+        {
+            return false;
+        }
+        memcpy(&block, chunk + start, sizeof(block));
+        size_t room = end - start - sizeof(block); // Left for the runs, checked one run at a time
+        if (block.firstBits > 64 || block.deltaBits > 64 || !runFits(count, block.firstBits, room))
+        {
+            return false;
+        }
+        room -= runBytes(count, block.firstBits);
+        if (!runFits((unsigned long long)count * (ticks - 1), block.deltaBits, room))
+        {
+            return false;
+        }
+        room -= runBytes((unsigned long long)count * (ticks - 1), block.deltaBits);
+        if (!runFits((unsigned long long)count * ticks, TELEMETRY_STATE_BITS, room))
+        {
+            return false;
+        }
+        const unsigned char *firstRun = chunk + start + sizeof(block);
+        const unsigned char *deltaRun = firstRun + runBytes(count, block.firstBits);
+        const unsigned char *stateRun = deltaRun + runBytes((unsigned long long)count * (ticks - 1), block.deltaBits);
+
+        long long from = firstPlant > blockFirst ? firstPlant : blockFirst;
+        long long to = lastPlant < blockFirst + count - 1 ? lastPlant : blockFirst + count - 1;
+        for (long long plant = from; plant <= to; plant++)
+        {
+            long long p = plant - blockFirst;
+            long long value = block.firstBase + (long long)getBits(firstRun, (unsigned long long)p * block.firstBits, block.firstBits);
+            for (int t = 0; t < ticks; t++)
+            {
+                if (t > 0)
+                {
+                    unsigned long long bit = ((unsigned long long)p * (ticks - 1) + t - 1) * block.deltaBits;
+                    value += unzigzag(getBits(deltaRun, bit, block.deltaBits));
+                }
+                size_t cell = (size_t)(plant - firstPlant) * ticks + t;
+                if (block.levelMode == TELEMETRY_LEVEL_FIXED)
+                {
+                    levels[cell] = ldexpf((float)value, -block.scaleBits);
+                }
+                else
+                {
+                    int bits = (int)value;
+                    memcpy(&levels[cell], &bits, sizeof(float));
+                }
+                states[cell] = (unsigned char)getBits(stateRun, ((unsigned long long)p * ticks + t) * TELEMETRY_STATE_BITS, TELEMETRY_STATE_BITS);
+            }
+        }
+    }
+
+    for (int t = 0; t < ticks; t++)
+    {
+        long long tick = (long long)chunkHeader.firstTick + t;
+        if (tick < firstTick || tick > lastTick)
+        {
+            continue;
+        }
+        for (long long plant = firstPlant; plant <= lastPlant; plant++)
+        {
+            size_t cell = (size_t)(plant - firstPlant) * ticks + t;
+            unsigned int rain = states[cell] >> 1;
+            printf("%lld,%lld,%.9g,%d,%s,%.3f\n", tick, plant, levels[cell], states[cell] & 1, rain < 3 ? rainTypeCodes[rain] : "??",
+                   (double)generation[t] / 1000.0);
+        }
+    }
+    return true;
+}
+
+/**
+ * Reads a value from a bit-packed run, least significant bits first.
+ *
+ * @param run The start of the run.
+ * @param bit The position of the value in the run, in bits.
+ * @param count The width of the value, up to 64 bits.
+ * @return The value.
+ */
+unsigned long long getBits(const unsigned char *run, unsigned long long bit, unsigned int count)
+{
+    unsigned long long value = 0;
+    for (unsigned int read = 0; read < count;)
+    {
+        unsigned int shift = (unsigned int)((bit + read) & 7);
+        unsigned int take = 8 - shift < count - read ? 8 - shift : count - read;
+        unsigned long long bits = (run[(bit + read) >> 3] >> shift) & ((1u << take) - 1);
+        value |= bits << read;
+        read += take;
+    }
+    return value;
+}
+
+/**
+ * Reverses the zigzag encoding of a change.
+ *
+ * @param value The zigzag-encoded change.
+ * @return The signed change.
+ */
+long long unzigzag(unsigned long long value)
+{
+    return (long long)(value >> 1) ^ -(long long)(value & 1);
+}
+
+/**
+ * Returns the size of a bit-packed run, which ends on a byte boundary.
+ *
+ * @param values The number of values in the run.
+ * @param bits The width of each value.
+ * @return The size in bytes.
+ */
+size_t runBytes(unsigned long long values, unsigned int bits)
+{
+    return (size_t)((values * bits + 7) / 8);
+}
+
+/**
+ * Tells whether a bit-packed run fits in the room left in a block, without overflowing on corrupt widths.
+ *
+ * @param values The number of values in the run.
+ * @param bits The width of each value.
+ * @param room The bytes left.
+ * @return true if the run fits.
+ */
+bool runFits(unsigned long long values, unsigned int bits, size_t room)
+{
+    return bits == 0 || values <= (unsigned long long)room * 8 / bits;
+}
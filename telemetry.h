@@ -0,0 +1,83 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+// Columnar telemetry file, written by blackout --telemetry and read by blackout-telemetry.
+//
+// The file is a TelemetryHeader, the chunks, then an index of one TelemetryChunkEntry per chunk. A chunk
+// holds up to chunkTicks consecutive ticks of the whole fleet: a TelemetryChunkHeader, the fleet generation
+// of each tick, the offsets of its blocks, then one block per blockPlants plants. A block is a
+// TelemetryBlockHeader followed by three bit-packed runs, each starting on a byte boundary:
+//   - the water level of every plant at the first tick of the chunk, minus firstBase, on firstBits bits;
+//   - plant by plant, the zigzag-encoded change of its water level from one tick to the next, on deltaBits bits;
+//   - plant by plant and tick by tick, isActive in bit 0 and the rain type in bits 1 and 2.
+// Water levels are stored as integers: in units of 1/2^scaleBits, the coarsest that holds every level of the
+// block exactly, or as the bits of the float if none up to 1/2^TELEMETRY_MAX_SCALE_BITS does, so they always
+// come back exactly. Every field is little-endian, and every value of a run has the same width, so a reader
+// can go straight to any plant.
+
+#define TELEMETRY_VERSION 1
+// Ticks per chunk and plants per block
+#define TELEMETRY_CHUNK_TICKS 16
+#define TELEMETRY_BLOCK_PLANTS 4096
+// Largest chunks and blocks a reader accepts, which keep every run size well within 64 bits
+#define TELEMETRY_MAX_CHUNK_TICKS 65536
+#define TELEMETRY_MAX_BLOCK_PLANTS (1 << 20)
+// Finest unit of the water levels of a fixed-point block, 1/2^TELEMETRY_MAX_SCALE_BITS
+#define TELEMETRY_MAX_SCALE_BITS 8
+// Bits of the state of a plant at one tick
+#define TELEMETRY_STATE_BITS 3
+
+// How the water levels of a block are turned into integers
+enum
+{
+    TELEMETRY_LEVEL_FIXED, // level * 2^scaleBits
+    TELEMETRY_LEVEL_FLOAT  // The bits of the float
+};
+
+// Header at the start of a telemetry file
+typedef struct
+{
+    char magic[8]; // "BLACKTLM"
+    unsigned int version;
+    unsigned int headerSize;
+    int plantCount;
+    int chunkTicks;
+    int blockPlants;
+    int chunks;
+    unsigned long long firstTick;    // First recorded tick
+    unsigned long long ticks;        // Ticks recorded
+    unsigned long long droppedTicks; // Ticks left out because the writer was behind
+    unsigned long long indexOffset;  // Offset of the chunk index, written when the file is closed
+} TelemetryHeader;
+
+// Entry of the chunk index
+typedef struct
+{
+    unsigned long long firstTick;
+    unsigned long long offset; // Of the TelemetryChunkHeader
+    unsigned int ticks;
+    unsigned int size;
+} TelemetryChunkEntry;
+
+// Header of a chunk, followed by the generation run and blocks + 1 block offsets from the chunk start
+typedef struct
+{
+    unsigned long long firstTick;
+    int ticks;
+    int blocks;
+    long long generationBase;    // Fleet generation at the first tick, in kW
+    unsigned int generationBits; // Width of the zigzag-encoded changes of the following ticks
+    unsigned int reserved;
+} TelemetryChunkHeader;
+
+// Header of a block
+typedef struct
+{
+    int levelMode; // TELEMETRY_LEVEL_FIXED or TELEMETRY_LEVEL_FLOAT
+    int scaleBits; // Of a fixed-point block
+    int firstBase;
+    unsigned int firstBits;
+    unsigned int deltaBits;
+} TelemetryBlockHeader;
+
+#endif